@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 
 #include <crypto/sha256.h>
+#include <crypto/Lyra2Z/Lyra2Z.h>
 #include <key.h>
 #include <validation.h>
 #include <util.h>
@@ -43,9 +44,11 @@ main(int argc, char** argv)
     }
 
     SHA256AutoDetect();
+    lyra2z_autodetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
+    InitPoWCache();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
     int64_t evaluations = gArgs.GetArg("-evals", DEFAULT_BENCH_EVALUATIONS);
@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 #include <coins.h>
+#include <hash.h>
 #include <policy/policy.h>
 #include <wallet/crypter.h>
 
@@ -85,3 +86,28 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Fill a cache with 100k coins on top of another cache, look each of them up
+// once and flush them to it: the pattern of connecting a block with a cache
+// per block, where every entry is allocated, found and freed.
+static void CCoinsCacheFillFlush(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    std::vector<COutPoint> vOutPoints;
+    for (uint32_t i = 0; i < 100000; i++)
+        vOutPoints.emplace_back((CHashWriter(SER_GETHASH, 0) << i).GetHash(), i % 4);
+
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    while (state.KeepRunning()) {
+        CCoinsViewCache base(&coinsDummy);
+        CCoinsViewCache cache(&base);
+        for (const COutPoint& outpoint : vOutPoints)
+            cache.AddCoin(outpoint, Coin(CTxOut(CENT, script), 1, 0, false), false);
+        for (const COutPoint& outpoint : vOutPoints)
+            assert(cache.HaveCoinInCache(outpoint));
+        bool success = cache.Flush();
+        assert(success);
+    }
+}
+
+BENCHMARK(CCoinsCacheFillFlush, 10);
@@ -14,6 +14,9 @@
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
+#include <crypto/Lyra2Z/Lyra2.h>
+#include <crypto/Lyra2Z/Lyra2Z.h>
+#include <crypto/scrypt.h>
 
 /* Number of bytes to hash per iteration */
 static const uint64_t BUFFER_SIZE = 1000*1000;
@@ -60,6 +63,43 @@ static void SHA512(benchmark::State& state)
         CSHA512().Write(in.data(), in.size()).Finalize(hash);
 }
 
+static void LYRA2Z_Alloc(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning())
+        LYRA2(in.data(), 32, in.data(), 32, in.data(), 32, 8, 8, 8);
+}
+
+static void LYRA2Z_Scratchpad(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    std::vector<uint64_t> matrix(LYRA2Z_MATRIX_SIZE / sizeof(uint64_t));
+    while (state.KeepRunning())
+        LYRA2_sp(in.data(), 32, in.data(), 32, in.data(), 32, 8, 8, 8, matrix.data());
+}
+
+static void LYRA2Z_80b(benchmark::State& state)
+{
+    std::vector<char> in(80,0);
+    while (state.KeepRunning())
+        lyra2z_hash(in.data(), in.data());
+}
+
+static void SCRYPT_80b(benchmark::State& state)
+{
+    std::vector<char> in(80,0);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256(in.data(), in.data());
+}
+
+static void SCRYPT_80b_Generic(benchmark::State& state)
+{
+    std::vector<char> in(80,0);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_sp_generic(in.data(), in.data(), scratchpad.data());
+}
+
 static void SipHash_32b(benchmark::State& state)
 {
     uint256 x;
@@ -93,6 +133,11 @@ BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(LYRA2Z_Alloc, 50 * 1000);
+BENCHMARK(LYRA2Z_Scratchpad, 50 * 1000);
+BENCHMARK(LYRA2Z_80b, 50 * 1000);
+BENCHMARK(SCRYPT_80b, 1500);
+BENCHMARK(SCRYPT_80b_Generic, 1500);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,138 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <hash.h>
+#include <kernel.h>
+#include <validation.h>
+
+#include <vector>
+
+namespace {
+
+/**
+ * A synthetic chain of alternating proof-of-work and proof-of-stake blocks,
+ * registered in mapBlockIndex, chainActive and the stake modifier index for
+ * as long as it lives. Stake modifiers are flagged on the same blocks
+ * ComputeNextStakeModifier would generate them on, but their values are made
+ * up, so building it is cheap.
+ */
+class StakeChain
+{
+public:
+    std::vector<CBlockIndex> blocks;
+    std::vector<uint256> hashes;
+
+    explicit StakeChain(int nBlocks) : blocks(nBlocks), hashes(nBlocks)
+    {
+        const Consensus::Params& params = Params().GetConsensus();
+        const int64_t nInterval = params.nStakeModifierInterval;
+        int64_t nModifierTime = 0;
+
+        for (int i = 0; i < nBlocks; i++) {
+            CBlockIndex& block = blocks[i];
+            hashes[i] = (CHashWriter(SER_GETHASH, 0) << i).GetHash();
+            block.phashBlock = &hashes[i];
+            block.pprev = i ? &blocks[i - 1] : nullptr;
+            block.nHeight = i;
+            block.nTime = 1530000000 + i * params.nPosTargetSpacing;
+            block.nBits = 0x1d00ffff;
+            if (i % 2) {
+                block.SetProofOfStake();
+                block.hashProofOfStake = Hash(hashes[i].begin(), hashes[i].end());
+            }
+            block.SetStakeEntropyBit(hashes[i].GetCheapHash() & 1);
+            if (i == 0 || (blocks[i - 1].GetBlockTime() / nInterval > nModifierTime / nInterval &&
+                           block.GetBlockTime() / nInterval > nModifierTime / nInterval)) {
+                block.SetStakeModifier(hashes[i].GetCheapHash(), true);
+                nModifierTime = block.GetBlockTime();
+            } else {
+                block.SetStakeModifier(blocks[i - 1].nStakeModifier, false);
+            }
+            mapBlockIndex[hashes[i]] = &block;
+        }
+        chainActive.SetTip(&blocks.back());
+        stakeModifierIndex.Rebuild(chainActive.Tip());
+    }
+
+    ~StakeChain()
+    {
+        chainActive.SetTip(nullptr);
+        stakeModifierIndex.Rebuild(nullptr);
+        for (const uint256& hash : hashes)
+            mapBlockIndex.erase(hash);
+    }
+};
+
+} // namespace
+
+// Generation of a new stake modifier on top of a 10k block index: every
+// candidate in the selection interval is hashed in each of the 64 rounds.
+static void ComputeNextStakeModifierBench(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    StakeChain chain(10000);
+
+    const CBlockIndex* pindex = &chain.blocks.back();
+    while (!pindex->GeneratedStakeModifier())
+        pindex = pindex->pprev;
+
+    uint64_t nStakeModifier;
+    bool fGeneratedStakeModifier;
+    while (state.KeepRunning()) {
+        assert(ComputeNextStakeModifier(pindex, nStakeModifier, fGeneratedStakeModifier));
+        assert(fGeneratedStakeModifier);
+    }
+}
+
+// One step of the kernel search the minter runs for each of its coins, with
+// the stake modifier looked up from the tip of a 10k block index.
+static void CheckStakeKernelHashBench(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    StakeChain chain(10000);
+
+    CBlock blockFrom;
+    blockFrom.nTime = chain.blocks[3000].nTime;
+    blockFrom.SetNewFormatBlock();
+    const CTxOut txOutPrev(1000 * COIN, CScript());
+    const COutPoint prevout(chain.hashes[3000], 1);
+
+    uint32_t nTimeTx = chain.blocks.back().nTime;
+    uint256 hashProofOfStake;
+    while (state.KeepRunning()) {
+        CheckStakeKernelHash(0x1d00ffff, blockFrom, 81, txOutPrev, prevout, nTimeTx++, hashProofOfStake);
+    }
+}
+
+// A full kernel search round of the minter: 1000 coins, 60 timestamps each,
+// and no kernel meeting the target.
+static void FindStakeKernelBench(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    StakeChain chain(10000);
+
+    std::vector<CStakeKernelCandidate> vCandidates(1000);
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        vCandidates[i].nTimeBlockFrom = chain.blocks[i].nTime;
+        vCandidates[i].nTxPrevOffset = 81;
+        vCandidates[i].prevout = COutPoint(chain.hashes[i], 1);
+        vCandidates[i].nValue = 1000 * COIN;
+    }
+
+    size_t nCandidate;
+    uint32_t nTimeTx;
+    uint256 hashProofOfStake;
+    while (state.KeepRunning()) {
+        assert(!FindStakeKernel(chainActive.Tip(), 0x1a00ffff, vCandidates, chain.blocks.back().nTime, 60, nCandidate, nTimeTx, hashProofOfStake));
+    }
+}
+
+BENCHMARK(ComputeNextStakeModifierBench, 3);
+BENCHMARK(CheckStakeKernelHashBench, 40 * 1000);
+BENCHMARK(FindStakeKernelBench, 20);
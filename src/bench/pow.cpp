@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
+#include <primitives/block.h>
+
+#include <vector>
+
+static CBlockHeader CreateHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = uint256S("0x1d2e3f4a5b6c7d8e9f0a1b2c3d4e5f6a7b8c9d0e1f2a3b4c5d6e7f8091a2b3c4");
+    header.hashMerkleRoot = uint256S("0x4c3b2a1908f7e6d5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b");
+    header.nTime = 1530000000;
+    header.nBits = 0x1e0fffff;
+    header.nNonce = 0;
+    header.SetNewFormatBlock();
+    return header;
+}
+
+// Proof-of-work hash of a header just below nLyra2ZHeight (scrypt) and at it
+// (Lyra2Z). The nonce changes every iteration, as it does while mining.
+static void PoWHash(benchmark::State& state, int nHeightOffset)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const int nHeight = params.nLyra2ZHeight + nHeightOffset;
+    CBlockHeader header = CreateHeader();
+
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        header.GetPoWHash(nHeight, params);
+    }
+}
+
+static void PoWHash_Scrypt(benchmark::State& state)
+{
+    PoWHash(state, -1);
+}
+
+static void PoWHash_Lyra2Z(benchmark::State& state)
+{
+    PoWHash(state, 0);
+}
+
+// DarkGravityWave over a chain in which proof-of-work and proof-of-stake
+// blocks alternate, so that every step also has to skip a PoS block.
+static void DarkGravityWaveBench(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const int nBlocks = 4 * params.nPowAveragingWindowv2 + 1;
+
+    std::vector<CBlockIndex> blocks(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1530000000 + i * params.nPosTargetSpacing;
+        if (i % 2) {
+            blocks[i].SetProofOfStake();
+            blocks[i].nBits = 0x1d00ffff;
+        } else {
+            blocks[i].nBits = 0x1c08b5b1 + (i % 7) * 0x100;
+        }
+        blocks[i].BuildSkip();
+    }
+
+    while (state.KeepRunning()) {
+        DarkGravityWave(&blocks.back(), params);
+    }
+}
+
+BENCHMARK(PoWHash_Scrypt, 1200);
+BENCHMARK(PoWHash_Lyra2Z, 35 * 1000);
+BENCHMARK(DarkGravityWaveBench, 300);
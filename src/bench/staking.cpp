@@ -0,0 +1,299 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <fs.h>
+#include <hash.h>
+#include <kernel.h>
+#include <miner.h>
+#include <pubkey.h>
+#include <pow.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <timedata.h>
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <wallet/db.h>
+#include <wallet/wallet.h>
+
+#include <vector>
+
+namespace {
+
+/** Target per coin day of the proof-of-stake blocks: an output of the wallet meets it about once a minute */
+const unsigned int STAKE_BITS = 0x1e100000;
+/** Seconds between the blocks of the chain, so that it spans a few weeks */
+const int64_t BLOCK_SPACING = 90 * 60;
+/** Number of blocks the outputs of the wallet are confirmed in, from TLRHeight */
+const int COIN_BLOCKS = 50;
+
+std::unique_ptr<CWalletDBWrapper> MakeMockWalletDB()
+{
+    bitdb.MakeMock();
+    return std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "bench_staking.dat"));
+}
+
+/**
+ * A testnet chain past TLRHeight + TLRInitLim, and a wallet of nCoins
+ * matured outputs of 1000 coins confirmed in its first new format blocks,
+ * with the UTXO set, stake origin index and wallet stake positions to go
+ * with them. The block index is synthetic: stake modifiers are flagged on the
+ * blocks ComputeNextStakeModifier would generate them on, but their values
+ * are made up. The chain state and wallet databases are in memory, and the
+ * clock is mocked to just past the tip.
+ */
+class StakingSetup
+{
+public:
+    ECCVerifyHandle verifyHandle;
+    std::vector<CBlockIndex> blocks;
+    std::vector<uint256> hashes;
+    CWallet wallet;
+    fs::path pathTemp;
+
+    unsigned int nBits;
+    CStakeKernelCandidate kernel;
+    uint32_t nKernelTime;
+
+    explicit StakingSetup(int nCoins) : wallet(MakeMockWalletDB())
+    {
+        SelectParams(CBaseChainParams::TESTNET);
+        const Consensus::Params& params = Params().GetConsensus();
+
+        InitSignatureCache();
+        InitScriptExecutionCache();
+        ClearDatadirCache();
+        pathTemp = fs::temp_directory_path() / strprintf("bench_staking_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        fs::create_directories(pathTemp);
+        gArgs.ForceSetArg("-datadir", pathTemp.string());
+        pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+        versionbitscache.Clear();
+
+        bool fFirstRun;
+        wallet.LoadWallet(fFirstRun);
+
+        BuildChain(params.TLRHeight + params.TLRInitLim + 230);
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        SetMockTime(pindexTip->GetBlockTime() + 10 * 60);
+        FillWallet(nCoins);
+
+        CBlockHeader header;
+        header.SetProofOfStake();
+        nBits = GetNextWorkRequired(pindexTip, &header, params, true);
+
+        // A kernel for the benchmarks that need one
+        std::vector<CStakeKernelCandidate> vCandidates;
+        assert(wallet.GetStakeCandidates(GetAdjustedTime(), vCandidates));
+        size_t nKernel;
+        uint256 hashProofOfStake;
+        assert(FindStakeKernel(pindexTip, nBits, vCandidates, GetAdjustedTime(), MAX_STAKE_SEARCH_INTERVAL, nKernel, nKernelTime, hashProofOfStake));
+        kernel = vCandidates[nKernel];
+    }
+
+    ~StakingSetup()
+    {
+        chainActive.SetTip(nullptr);
+        stakeModifierIndex.Rebuild(nullptr);
+        for (const uint256& hash : hashes)
+            mapBlockIndex.erase(hash);
+        versionbitscache.Clear();
+        pcoinsTip.reset();
+        pcoinsdbview.reset();
+        pblocktree.reset();
+        SetMockTime(0);
+        ClearDatadirCache();
+        fs::remove_all(pathTemp);
+        bitdb.Flush(true);
+        bitdb.Reset();
+    }
+
+private:
+    void BuildChain(int nBlocks)
+    {
+        const Consensus::Params& params = Params().GetConsensus();
+        const int64_t nInterval = params.nStakeModifierInterval;
+        const int64_t nTimeFirst = GetTime() - nBlocks * BLOCK_SPACING;
+        int64_t nModifierTime = 0;
+
+        blocks.resize(nBlocks);
+        hashes.resize(nBlocks);
+        for (int i = 0; i < nBlocks; i++) {
+            CBlockIndex& block = blocks[i];
+            hashes[i] = (CHashWriter(SER_GETHASH, 0) << std::string("staking") << i).GetHash();
+            block.phashBlock = &hashes[i];
+            block.pprev = i ? &blocks[i - 1] : nullptr;
+            block.nHeight = i;
+            block.nTime = nTimeFirst + i * BLOCK_SPACING;
+            block.nVersion = VERSIONBITS_TOP_BITS;
+            if (i > params.TLRHeight + params.TLRInitLim && i % 2) {
+                block.SetProofOfStake();
+                block.nBits = STAKE_BITS;
+                block.hashProofOfStake = Hash(hashes[i].begin(), hashes[i].end());
+                block.nPowHeight = blocks[i - 1].nPowHeight;
+            } else {
+                block.nBits = UintToArith256(params.powLimit).GetCompact();
+                block.nPowHeight = i ? blocks[i - 1].nPowHeight + 1 : 0;
+            }
+            if (i >= params.TLRHeight)
+                block.nFlags |= BLOCK_NEW_FORMAT;
+            block.SetStakeEntropyBit(hashes[i].GetCheapHash() & 1);
+            if (i == 0 || (blocks[i - 1].GetBlockTime() / nInterval > nModifierTime / nInterval &&
+                           block.GetBlockTime() / nInterval > nModifierTime / nInterval)) {
+                block.SetStakeModifier(hashes[i].GetCheapHash(), true);
+                nModifierTime = block.GetBlockTime();
+            } else {
+                block.SetStakeModifier(blocks[i - 1].nStakeModifier, false);
+            }
+            block.BuildSkip();
+            mapBlockIndex[hashes[i]] = &block;
+        }
+        chainActive.SetTip(&blocks.back());
+        stakeModifierIndex.Rebuild(chainActive.Tip());
+    }
+
+    void FillWallet(int nCoins)
+    {
+        const Consensus::Params& params = Params().GetConsensus();
+
+        LOCK2(cs_main, wallet.cs_wallet);
+        CKey key;
+        key.MakeNewKey(true);
+        assert(wallet.AddKeyPubKey(key, key.GetPubKey()));
+        assert(wallet.TopUpKeyPool(10));
+        const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        std::vector<std::pair<uint256, CStakeTxOrigin> > vOrigins;
+        for (int n = 0; n < nCoins; n++) {
+            const int nHeight = params.TLRHeight + n % COIN_BLOCKS;
+            const int nIndex = 1 + n / COIN_BLOCKS;
+            const unsigned int nTxOffset = 81 + 200 * nIndex;
+
+            CMutableTransaction tx;
+            tx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+            tx.vout.emplace_back(1000 * COIN, scriptPubKey);
+            CWalletTx wtx(&wallet, MakeTransactionRef(std::move(tx)));
+            wtx.hashBlock = hashes[nHeight];
+            wtx.nIndex = nIndex;
+            const uint256 txid = wtx.GetHash();
+            wallet.LoadToWallet(wtx);
+
+            const CBlockIndex& block = blocks[nHeight];
+            pcoinsTip->AddCoin(COutPoint(txid, 0), Coin(wtx.tx->vout[0], nHeight, block.nTime, false), false);
+            wallet.mapStakeTxPos[txid] = CStakeTxPos(hashes[nHeight], block.GetBlockHeader(), nTxOffset);
+            vOrigins.emplace_back(txid, CStakeTxOrigin{nHeight, nTxOffset});
+        }
+        pcoinsTip->SetBestBlock(hashes.back());
+        assert(pblocktree->WriteStakeTxOrigins(vOrigins));
+    }
+};
+
+/** The coinstake and block of setup's kernel, signed */
+void CreateStakeBlock(StakingSetup& setup, CBlock& block)
+{
+    bool fPoSCancel = false;
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewPoSBlock(fPoSCancel, &setup.wallet, setup.kernel, setup.nKernelTime));
+    assert(pblocktemplate);
+    block = pblocktemplate->block;
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    assert(SignBlock(block, setup.wallet));
+}
+
+} // namespace
+
+// The coinstake of a kernel found by the minter, assembled under the locks
+// from all the stakeable outputs of the wallet
+static void CreateCoinStake(benchmark::State& state, int nCoins)
+{
+    StakingSetup setup(nCoins);
+    while (state.KeepRunning()) {
+        CMutableTransaction txCoinStake;
+        CAmount nPosReward;
+        assert(setup.wallet.CreateCoinStake(setup.wallet, setup.nBits, setup.kernel, setup.nKernelTime, txCoinStake, nPosReward));
+    }
+}
+
+// The same, and the block around it with the mempool, checked by TestBlockValidity()
+static void CreateNewPoSBlock(benchmark::State& state, int nCoins)
+{
+    StakingSetup setup(nCoins);
+    while (state.KeepRunning()) {
+        bool fPoSCancel = false;
+        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewPoSBlock(fPoSCancel, &setup.wallet, setup.kernel, setup.nKernelTime));
+        assert(pblocktemplate);
+    }
+}
+
+static void CreateCoinStake10k(benchmark::State& state) { CreateCoinStake(state, 10000); }
+static void CreateCoinStake100k(benchmark::State& state) { CreateCoinStake(state, 100000); }
+static void CreateNewPoSBlock10k(benchmark::State& state) { CreateNewPoSBlock(state, 10000); }
+static void CreateNewPoSBlock100k(benchmark::State& state) { CreateNewPoSBlock(state, 100000); }
+
+// Signature of a minted block with the key of its coinstake
+static void SignPoSBlock(benchmark::State& state)
+{
+    StakingSetup setup(10000);
+    CBlock block;
+    CreateStakeBlock(setup, block);
+    while (state.KeepRunning()) {
+        assert(SignBlock(block, setup.wallet));
+    }
+}
+
+// The proof-of-stake checks ConnectBlock() runs on a minted block before its
+// transactions: coinstake kernel and the next stake modifier
+static void PoSContextualBlockChecksBench(benchmark::State& state)
+{
+    StakingSetup setup(10000);
+    CBlock block;
+    CreateStakeBlock(setup, block);
+
+    LOCK(cs_main);
+    CBlockIndex indexNew(block);
+    indexNew.pprev = chainActive.Tip();
+    indexNew.nHeight = indexNew.pprev->nHeight + 1;
+    indexNew.nPowHeight = indexNew.pprev->nPowHeight;
+    CCoinsViewCache view(pcoinsTip.get());
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        assert(PoSContextualBlockChecks(block, validationState, &indexNew, view, true));
+    }
+}
+
+// Cost per coin of the minter's kernel search: one iteration checks the
+// kernel of one output of the wallet at one timestamp, including the lookup
+// of its stake modifier, against a target none of them meets
+static void StakeKernelCheckPerCoin(benchmark::State& state)
+{
+    StakingSetup setup(10000);
+    std::vector<CStakeKernelCandidate> vCandidates;
+    assert(setup.wallet.GetStakeCandidates(GetAdjustedTime(), vCandidates));
+
+    std::vector<CStakeKernelCandidate> vCandidate(1);
+    size_t n = 0;
+    size_t nKernel;
+    uint32_t nTimeTx;
+    uint256 hashProofOfStake;
+    while (state.KeepRunning()) {
+        vCandidate[0] = vCandidates[n++ % vCandidates.size()];
+        assert(!FindStakeKernel(chainActive.Tip(), 0x1a00ffff, vCandidate, setup.nKernelTime, 1, nKernel, nTimeTx, hashProofOfStake));
+    }
+}
+
+BENCHMARK(CreateCoinStake10k, 20);
+BENCHMARK(CreateCoinStake100k, 2);
+BENCHMARK(CreateNewPoSBlock10k, 20);
+BENCHMARK(CreateNewPoSBlock100k, 2);
+BENCHMARK(SignPoSBlock, 5000);
+BENCHMARK(PoSContextualBlockChecksBench, 50000);
+BENCHMARK(StakeKernelCheckPerCoin, 200 * 1000);
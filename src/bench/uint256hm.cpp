@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <hash.h>
+#include <txmempool.h>
+#include <uint256hm.h>
+
+#include <unordered_map>
+#include <vector>
+
+typedef std::unordered_map<uint256, uint64_t, SaltedTxidHasher> StdMap;
+typedef uint256HashMap<uint64_t> FlatMap;
+
+static const int MAP_SIZE = 200000;
+
+static std::vector<uint256> MakeKeys(int n, int seed)
+{
+    std::vector<uint256> vKeys(n);
+    for (int i = 0; i < n; i++)
+        vKeys[i] = (CHashWriter(SER_GETHASH, 0) << seed << i).GetHash();
+    return vKeys;
+}
+
+// 1000 lookups of keys in a 200k entry map, and 1000 of keys not in it
+template <typename Map>
+static void Find(benchmark::State& state)
+{
+    const std::vector<uint256> vKeys = MakeKeys(MAP_SIZE, 0);
+    const std::vector<uint256> vMissing = MakeKeys(1000, 1);
+    Map map;
+    for (int i = 0; i < MAP_SIZE; i++)
+        map[vKeys[i]] = i;
+
+    size_t nKey = 0;
+    uint64_t nSum = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            nSum += map.find(vKeys[nKey])->second;
+            nKey = (nKey + 7919) % MAP_SIZE;
+            nSum += map.count(vMissing[i]);
+        }
+    }
+    assert(nSum > 0);
+}
+
+// 1000 insertions and 1000 erasures in a 200k entry map
+template <typename Map>
+static void InsertErase(benchmark::State& state)
+{
+    const std::vector<uint256> vKeys = MakeKeys(2 * MAP_SIZE, 0);
+    Map map;
+    for (int i = 0; i < MAP_SIZE; i++)
+        map[vKeys[i]] = i;
+
+    size_t nOldest = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            map.erase(vKeys[nOldest % vKeys.size()]);
+            map[vKeys[(nOldest + MAP_SIZE) % vKeys.size()]] = i;
+            nOldest++;
+        }
+    }
+    assert(map.size() == MAP_SIZE);
+}
+
+static void UnorderedMapFind(benchmark::State& state) { Find<StdMap>(state); }
+static void Uint256HashMapFind(benchmark::State& state) { Find<FlatMap>(state); }
+static void UnorderedMapInsertErase(benchmark::State& state) { InsertErase<StdMap>(state); }
+static void Uint256HashMapInsertErase(benchmark::State& state) { InsertErase<FlatMap>(state); }
+
+BENCHMARK(UnorderedMapFind, 100);
+BENCHMARK(Uint256HashMapFind, 100);
+BENCHMARK(UnorderedMapInsertErase, 100);
+BENCHMARK(Uint256HashMapInsertErase, 100);
@@ -145,8 +145,11 @@ CBlockIndex* CBlockIndex::GetAncestor(int height)
 
 void CBlockIndex::BuildSkip()
 {
-    if (pprev)
+    if (pprev) {
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+        pprevPoW = pprev->IsProofOfWork() ? pprev : pprev->pprevPoW;
+        pprevPoS = pprev->IsProofOfStake() ? pprev : pprev->pprevPoS;
+    }
 }
 
 arith_uint256 GetBlockProof(const CBlockIndex& block)
@@ -180,6 +180,10 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    //! pointers to the index of the closest proof-of-work and proof-of-stake predecessors of this block, if any
+    CBlockIndex* pprevPoW;
+    CBlockIndex* pprevPoS;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -275,6 +279,8 @@ public:
         phashBlock = nullptr;
         pprev = nullptr;
         pskip = nullptr;
+        pprevPoW = nullptr;
+        pprevPoS = nullptr;
         nHeight = 0;
         nPowHeight = 0;
         nFile = 0;
@@ -414,7 +420,7 @@ public:
         return false;
     }
 
-    //! Build the skiplist pointer for this entry.
+    //! Build the skiplist pointer and the proof-of-work/proof-of-stake predecessor pointers for this entry.
     void BuildSkip();
 
     //! Efficiently find an ancestor of this block.
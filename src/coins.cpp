@@ -44,7 +44,7 @@ CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    CCoinsMap::iterator ret = cacheCoins.emplace(outpoint, std::move(tmp)).first;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -68,7 +68,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     if (coin.out.scriptPubKey.IsUnspendable()) return;
     CCoinsMap::iterator it;
     bool inserted;
-    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    std::tie(it, inserted) = cacheCoins.emplace(outpoint);
     bool fresh = false;
     if (!inserted) {
         cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
@@ -132,6 +132,10 @@ bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
+bool CCoinsViewCache::HaveEntryInCache(const COutPoint &outpoint) const {
+    return cacheCoins.count(outpoint) != 0;
+}
+
 uint256 CCoinsViewCache::GetBestBlock() const {
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
@@ -143,7 +147,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
 }
 
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -196,6 +200,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             }
         }
     }
+    mapCoins.clear();
     hashBlock = hashBlockIn;
     return true;
 }
@@ -207,6 +212,12 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+void CCoinsViewCache::Detach(CCoinsMap &mapCoinsOut) {
+    mapCoinsOut.swap(cacheCoins);
+    cacheCoins.clear();
+    cachedCoinsUsage = 0;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -244,6 +255,32 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
     return true;
 }
 
+void CCoinsViewStaged::Stage(const COutPoint &outpoint, Coin&& coin)
+{
+    mapStaged.emplace(outpoint, std::move(coin));
+}
+
+bool CCoinsViewStaged::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    auto it = mapStaged.find(outpoint);
+    if (it == mapStaged.end())
+        return base->GetCoin(outpoint, coin);
+    if (cache->HaveEntryInCache(outpoint)) {
+        mapStaged.erase(it);
+        return base->GetCoin(outpoint, coin);
+    }
+    coin = std::move(it->second);
+    mapStaged.erase(it);
+    return true;
+}
+
+bool CCoinsViewStaged::HaveCoin(const COutPoint &outpoint) const
+{
+    if (mapStaged.count(outpoint) && !cache->HaveEntryInCache(outpoint))
+        return true;
+    return base->HaveCoin(outpoint);
+}
+
 static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
 static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_OUTPUT_WEIGHT;
 
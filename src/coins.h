@@ -11,6 +11,7 @@
 #include <core_memusage.h>
 #include <hash.h>
 #include <memusage.h>
+#include <poolhashmap.h>
 #include <serialize.h>
 #include <uint256.h>
 #include <chainparams.h>
@@ -96,8 +97,8 @@ public:
 class SaltedOutpointHasher
 {
 private:
-    /** Salt */
-    const uint64_t k0, k1;
+    /** Salt (not const, so that the hasher of a CCoinsMap can be swapped with it) */
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -131,7 +132,7 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef PoolHashMap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -176,7 +177,7 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
+    //! The passed mapCoins can be modified; implementations may clear it.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
     //! Get a cursor to iterate over the whole state
@@ -248,6 +249,13 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Check if this cache has an entry for the given utxo, spent or not.
+     * Unlike HaveCoinInCache(), a spent entry counts: it hides whatever the
+     * backing CCoinsView still has for the utxo.
+     */
+    bool HaveEntryInCache(const COutPoint &outpoint) const;
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -280,6 +288,12 @@ public:
      */
     bool Flush();
 
+    /**
+     * Move the cached coins out into mapCoinsOut, leaving this cache empty, for the
+     * caller to push to the base itself as Flush would. The best block is kept.
+     */
+    void Detach(CCoinsMap &mapCoinsOut);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -309,6 +323,34 @@ private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 };
 
+/**
+ * CCoinsView that serves coins staged ahead of time, and passes every other
+ * lookup and all writes through to its backing view. A staged coin is handed
+ * out once, which is all a CCoinsViewCache on top of it asks for.
+ *
+ * Staged coins are read from below the backing cache, so an entry the cache
+ * has for the same outpoint, even a spent one, is newer and wins.
+ *
+ * ConnectTip stages the inputs of a block, read from the coins database in
+ * parallel, so that connecting the block does not wait for them one by one.
+ */
+class CCoinsViewStaged : public CCoinsViewBacked
+{
+private:
+    CCoinsViewCache *cache;
+    mutable std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapStaged;
+
+public:
+    explicit CCoinsViewStaged(CCoinsViewCache *cacheIn) : CCoinsViewBacked(cacheIn), cache(cacheIn) {}
+
+    //! Stage coin as the unspent output at outpoint in the backing view
+    void Stage(const COutPoint &outpoint, Coin&& coin);
+    size_t GetStagedCount() const { return mapStaged.size(); }
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+};
+
 //! Utility function to add all of a transaction's outputs to a cache.
 // When check is false, this assumes that overwrites are only possible for coinbase transactions.
 // When check is true, the underlying view may be queried to determine whether an addition is
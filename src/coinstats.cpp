@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <chainparams.h>
+#include <coins.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <undo.h>
+#include <version.h>
+
+#include <assert.h>
+
+namespace {
+
+/** Hash a coin into the set as its outpoint followed by its height, coinbase
+ *  flag, time and output, uncompressed. The database does not store the time
+ *  of coins of legacy blocks, so it is hashed as 0 for them, as a coin read
+ *  back has it; the hash of the set therefore depends on the chain parameters. */
+void HashCoin(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin, bool fRemove)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << VARINT(coin.nHeight * 2 + coin.fCoinBase);
+    ss << (Params().isLegacyBlock(coin.nHeight) ? 0 : coin.nTime);
+    ss << coin.out;
+    const unsigned char* data = (const unsigned char*)ss.data();
+    if (fRemove) {
+        muhash.Remove(data, ss.size());
+    } else {
+        muhash.Insert(data, ss.size());
+    }
+}
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+} // namespace
+
+void CCoinsSetStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    assert(!coin.IsSpent());
+    HashCoin(muhash, outpoint, coin, false);
+    nTransactionOutputs++;
+    nTotalAmount += coin.out.nValue;
+    nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+}
+
+void CCoinsSetStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    assert(!coin.IsSpent());
+    HashCoin(muhash, outpoint, coin, true);
+    nTransactionOutputs--;
+    nTotalAmount -= coin.out.nValue;
+    nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+}
+
+void CCoinsSetStats::ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight, const uint256& hashBlockIn)
+{
+    assert(block.hashPrevBlock == hashBlock);
+    assert(blockundo.vtxundo.size() + 1 == block.vtx.size());
+
+    // The same coins UpdateCoins() spends and adds, in the same order
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            assert(txundo.vprevout.size() == tx.vin.size());
+            for (size_t j = 0; j < tx.vin.size(); j++)
+                RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+        }
+        const uint256& txid = tx.GetHash();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                AddCoin(COutPoint(txid, o), Coin(tx.vout[o], nHeight, block.nTime, tx.IsCoinBase()));
+        }
+    }
+    hashBlock = hashBlockIn;
+}
+
+uint256 CCoinsSetStats::GetHash() const
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <amount.h>
+#include <crypto/muhash.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+class CBlock;
+class CBlockUndo;
+class COutPoint;
+class Coin;
+
+/** Running totals and a rolling hash of the UTXO set as of block hashBlock.
+ *
+ *  The hash is a MuHash3072 of the coins, so it does not depend on the order
+ *  they were added in, and a block can be applied to it, or taken back out,
+ *  by only hashing the coins the block creates and spends.
+ */
+class CCoinsSetStats
+{
+public:
+    uint256 hashBlock;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CCoinsSetStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Apply a connected block, given the coins it spent. Its parent must be hashBlock.
+    void ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, int nHeight, const uint256& hashBlockIn);
+
+    //! The finalized MuHash of the set, which takes a modular inversion
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+#endif // BITCOIN_COINSTATS_H
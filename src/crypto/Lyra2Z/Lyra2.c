@@ -31,6 +31,10 @@
  * integer parameters (treated as type "unsigned int") in the order they are provided, plus the value
  * of nCols, (i.e., basil = kLen || pwdlen || saltlen || timeCost || nRows || nCols).
  *
+ * The memory matrix is provided by the caller, so repeated invocations (e.g. per block header or per
+ * nonce) do not touch the heap. Rows are addressed directly inside the matrix instead of through a
+ * separately allocated table of row pointers.
+ *
  * @param K The derived key to be output by the algorithm
  * @param kLen Desired key length
  * @param pwd User password
@@ -40,10 +44,11 @@
  * @param timeCost Parameter to determine the processing time (T)
  * @param nRows Number or rows of the memory matrix (R)
  * @param nCols Number of columns of the memory matrix (C)
+ * @param wholeMatrix Memory matrix of at least nRows * nCols * BLOCK_LEN_BYTES bytes
  *
- * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ * @return 0 if the key is generated correctly; -1 if there is an error (no matrix provided)
  */
-int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+int LYRA2_sp(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, uint64_t *wholeMatrix) {
 
     //============================= Basic variables ============================//
     int64_t row = 2; //index of row to be processed
@@ -56,31 +61,19 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     int64_t i; //auxiliary iteration counter
     //==========================================================================/
 
-    //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
-
+    //=================== Initializing the Memory Matrix =======================//
+    if (wholeMatrix == NULL) {
+      return -1;
+    }
 
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
     const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
-    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
-      return -1;
-    }
-    memset(wholeMatrix, 0, i);
+    memset(wholeMatrix, 0, (size_t) ((int64_t) nRows * ROW_LEN_BYTES));
 
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    //Row r of the matrix starts ROW_LEN_INT64 * r words into wholeMatrix
+#define MEM_ROW(r) (wholeMatrix + (r) * ROW_LEN_INT64)
+    uint64_t *ptrWord;
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -123,10 +116,8 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16];
+    const lyra2_sponge *sponge = lyra2_sponge_active;
     initState(state);
     //==========================================================================/
 
@@ -134,17 +125,17 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     //Absorbing salt, password and basil: this is the only place in which the block length is hard-coded to 512 bits
     ptrWord = wholeMatrix;
     for (i = 0; i < nBlocksInput; i++) {
-      absorbBlockBlake2Safe(state, ptrWord); //absorbs each block of pad(pwd || salt || basil)
+      sponge->absorbBlockBlake2Safe(state, ptrWord); //absorbs each block of pad(pwd || salt || basil)
       ptrWord += BLOCK_LEN_BLAKE2_SAFE_INT64; //goes to next block of pad(pwd || salt || basil)
     }
 
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    sponge->reducedSqueezeRow0(state, MEM_ROW(0), nCols); //The locally copied password is most likely overwritten here
+    sponge->reducedDuplexRow1(state, MEM_ROW(0), MEM_ROW(1), nCols);
 
     do {
       //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-      reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+      sponge->reducedDuplexRowSetup(state, MEM_ROW(prev), MEM_ROW(rowa), MEM_ROW(row), nCols);
 
 
       //updates the value of row* (deterministically picked during Setup))
@@ -177,7 +168,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
         //------------------------------------------------------------------------------------------
 
         //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-        reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+        sponge->reducedDuplexRow(state, MEM_ROW(prev), MEM_ROW(rowa), MEM_ROW(row), nCols);
 
         //update prev: it now points to the last row ever computed
         prev = row;
@@ -194,24 +185,36 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    sponge->absorbBlock(state, MEM_ROW(rowa));
+#undef MEM_ROW
 
     //Squeezes the key
     squeeze(state, K, kLen);
     //==========================================================================/
 
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
-    //==========================================================================/
 
     return 0;
 }
 
+/**
+ * Same as LYRA2_sp(), but allocates (and frees) the memory matrix itself.
+ *
+ * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ */
+int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+    uint64_t *wholeMatrix = malloc((size_t) (nRows * nCols * BLOCK_LEN_BYTES));
+    if (wholeMatrix == NULL) {
+      return -1;
+    }
+
+    int ret = LYRA2_sp(K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols, wholeMatrix);
+
+    free(wholeMatrix);
+    return ret;
+}
+
 int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
 
     //============================= Basic variables ============================//
@@ -27,26 +27,151 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "Lyra2Z.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include "sph_blake.h"
 #include "Lyra2.h"
+#include "Sponge.h"
 
-void lyra2z_hash(const char* input, char* output)
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__)) && !defined(DISABLE_OPTIMIZED_LYRA2Z)
+#define LYRA2Z_DETECT_X86 1
+#include <cpuid.h>
+#if defined(ENABLE_AVX2)
+extern const lyra2_sponge lyra2_sponge_avx2;
+#endif
+#if defined(ENABLE_AVX512)
+extern const lyra2_sponge lyra2_sponge_avx512;
+#endif
+#endif
+
+void lyra2z_hash_sp(const char* input, char* output, char* scratchpad)
 {
     sph_blake256_context     ctx_blake;
 
     uint32_t hashA[8], hashB[8];
+    uint64_t *matrix;
 
     sph_blake256_init(&ctx_blake);
     sph_blake256 (&ctx_blake, input, 80);
-    sph_blake256_close (&ctx_blake, hashA);	
-	
-	LYRA2(hashB, 32, hashA, 32, hashA, 32, 8, 8, 8);
-	
-	memcpy(output, hashB, 32);
+    sph_blake256_close (&ctx_blake, hashA);
+
+    matrix = (uint64_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+    LYRA2_sp(hashB, 32, hashA, 32, hashA, 32, 8, 8, 8, matrix);
+
+    memcpy(output, hashB, 32);
 }
 
+void lyra2z_hash(const char* input, char* output)
+{
+    char scratchpad[LYRA2Z_SCRATCHPAD_SIZE];
+    lyra2z_hash_sp(input, output, scratchpad);
+}
+
+/* Known answers computed with the scalar implementation; they cover every sponge operation */
+static int lyra2z_selftest(void)
+{
+    static const unsigned char out1[32] = {
+        0x6b, 0x0d, 0xed, 0x5a, 0xfb, 0x3b, 0x27, 0xcf, 0x0e, 0x60, 0x12, 0x43, 0xff, 0xd9, 0xb3, 0x7e,
+        0xe6, 0x53, 0x31, 0xa2, 0xd4, 0x6c, 0x7a, 0xdd, 0x2a, 0x6a, 0x82, 0x69, 0x58, 0xab, 0x1c, 0x0b
+    };
+    static const unsigned char out2[32] = {
+        0x9b, 0x63, 0xbf, 0x26, 0x2e, 0xc6, 0xf6, 0x78, 0xd7, 0x3e, 0x10, 0x1f, 0x57, 0xda, 0xdc, 0xfe,
+        0x07, 0xb6, 0xd1, 0xf0, 0x1c, 0x2b, 0x6e, 0xbf, 0xbc, 0x84, 0xed, 0x3f, 0xa2, 0xbe, 0x94, 0x7d
+    };
+    static const unsigned char out3[32] = {
+        0x67, 0x2f, 0x60, 0x47, 0x37, 0xcf, 0xc6, 0x35, 0xf2, 0x09, 0x76, 0xa8, 0x6c, 0xf9, 0x55, 0xb6,
+        0x7a, 0x1a, 0x00, 0xee, 0x40, 0xac, 0xff, 0x5d, 0xcf, 0xd5, 0xd5, 0x2a, 0xad, 0xa7, 0x0b, 0x24
+    };
+    char in[80], out[32];
+    int i;
+
+    // Bytes 0..79
+    for (i = 0; i < 80; i++)
+        in[i] = (char)i;
+    lyra2z_hash(in, out);
+    if (memcmp(out, out1, sizeof(out))) return 0;
+    // All zero
+    memset(in, 0, sizeof(in));
+    lyra2z_hash(in, out);
+    if (memcmp(out, out2, sizeof(out))) return 0;
+    // All ones
+    memset(in, 0xff, sizeof(in));
+    lyra2z_hash(in, out);
+    if (memcmp(out, out3, sizeof(out))) return 0;
+    return 1;
+}
+
+#if defined(LYRA2Z_DETECT_X86)
+/* Whether the OS saves the register state selected by mask on context switches */
+static int lyra2z_os_supports(uint32_t mask)
+{
+    uint32_t eax, edx;
+    __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & mask) == mask;
+}
+#endif
+
+/* The sponge implementation called name, or NULL unless it is compiled in and this CPU runs it */
+static const lyra2_sponge* lyra2z_find_sponge(const char* name)
+{
+    if (strcmp(name, "standard") == 0)
+        return &lyra2_sponge_generic;
+
+#if defined(LYRA2Z_DETECT_X86)
+    uint32_t eax, ebx, ecx, edx;
+    int have_xsave = 0, have_avx2 = 0, have_avx512 = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_xsave = ((ecx >> 27) & 1) && ((ecx >> 28) & 1); // OSXSAVE and AVX
+    }
+    if (have_xsave && __get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        have_avx2 = ((ebx >> 5) & 1) && lyra2z_os_supports(0x06);
+        have_avx512 = have_avx2 && ((ebx >> 16) & 1) && ((ebx >> 31) & 1) && lyra2z_os_supports(0xe6); // AVX512F and AVX512VL
+    }
+    (void)have_avx2;
+    (void)have_avx512;
+
+#if defined(ENABLE_AVX2)
+    if (have_avx2 && strcmp(name, "avx2") == 0)
+        return &lyra2_sponge_avx2;
+#endif
+#if defined(ENABLE_AVX512)
+    if (have_avx512 && strcmp(name, "avx512") == 0)
+        return &lyra2_sponge_avx512;
+#endif
+#endif
+
+    return NULL;
+}
+
+int lyra2z_select(const char* name)
+{
+    const lyra2_sponge* sponge = lyra2z_find_sponge(name);
+    if (!sponge)
+        return 0;
+    lyra2_sponge_active = sponge;
+    return 1;
+}
+
+const char* lyra2z_autodetect(void)
+{
+    static const char* const names[] = {"avx512", "avx2", "standard"};
+    const char* ret = NULL;
+    size_t i;
+
+    for (i = 0; !ret; i++) {
+        if (lyra2z_select(names[i]))
+            ret = names[i];
+    }
+
+    assert(lyra2z_selftest());
+    return ret;
+}
@@ -5,7 +5,25 @@
 extern "C" {
 #endif
 
+/* Lyra2Z runs Lyra2 with timeCost = 8 over an 8 x 8 matrix of 96-byte blocks */
+#define LYRA2Z_MATRIX_SIZE (8 * 8 * 96)
+/* Extra 63 bytes let the matrix be aligned to a cache line inside the scratchpad */
+#define LYRA2Z_SCRATCHPAD_SIZE (LYRA2Z_MATRIX_SIZE + 63)
+
 void lyra2z_hash(const char* input, char* output);
+void lyra2z_hash_sp(const char* input, char* output, char* scratchpad);
+
+/** Autodetect the best available Lyra2Z sponge implementation. BLAKE-256
+ *  always runs the portable sph_blake code.
+ *  Returns the name of the implementation.
+ */
+const char* lyra2z_autodetect(void);
+
+/** Use the sponge implementation called name ("standard", "avx2" or "avx512").
+ *  Returns 0, leaving the current one in use, if it is not compiled in or the
+ *  CPU does not support it.
+ */
+int lyra2z_select(const char* name);
 
 #ifdef __cplusplus
 }
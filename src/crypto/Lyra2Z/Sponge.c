@@ -390,6 +390,17 @@ inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOu
     }
 }
 
+const lyra2_sponge lyra2_sponge_generic = {
+    absorbBlock,
+    absorbBlockBlake2Safe,
+    reducedSqueezeRow0,
+    reducedDuplexRow1,
+    reducedDuplexRowSetup,
+    reducedDuplexRow
+};
+
+// By default use the scalar sponge. This keeps LYRA2 working if lyra2z_autodetect() was never called
+const lyra2_sponge *lyra2_sponge_active = &lyra2_sponge_generic;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -92,6 +92,25 @@ void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint
 //---- Misc
 void printArray(unsigned char *array, unsigned int size, char *name);
 
+//---- Runtime dispatch
+/**
+ * The sponge operations used by LYRA2_sp(). The scalar implementation above is always
+ * available; SIMD implementations (Sponge_avx2.c, Sponge_avx512.c) are
+ * selected at startup by lyra2z_autodetect(). All of them operate on the same
+ * 16 x uint64_t state layout, so they are interchangeable between calls.
+ */
+typedef struct lyra2_sponge {
+    void (*absorbBlock)(uint64_t *state, const uint64_t *in);
+    void (*absorbBlockBlake2Safe)(uint64_t *state, const uint64_t *in);
+    void (*reducedSqueezeRow0)(uint64_t* state, uint64_t* rowOut, uint64_t nCols);
+    void (*reducedDuplexRow1)(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols);
+    void (*reducedDuplexRowSetup)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+    void (*reducedDuplexRow)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols);
+} lyra2_sponge;
+
+extern const lyra2_sponge lyra2_sponge_generic;
+extern const lyra2_sponge *lyra2_sponge_active;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -0,0 +1,191 @@
+/**
+ * 256-bit implementation of the Lyra2 sponge row operations (see Sponge.c),
+ * shared by Sponge_avx2.c and Sponge_avx512.c.
+ *
+ * Each of the four rows (a, b, c, d) of the Blake2b state lives in one 256-bit
+ * register, and a 12-word block spans exactly three of them. The including file
+ * must define ROTR64_32, ROTR64_24, ROTR64_16 and ROTR64_63 for __m256i, and
+ * SPONGE_FN(name) to give the functions below unique names.
+ *
+ * This software is hereby placed in the public domain.
+ */
+#ifndef SPONGE_AVX_H_
+#define SPONGE_AVX_H_
+
+#include <immintrin.h>
+
+/* Number of 256-bit words in a BLOCK_LEN_INT64 block */
+#define BLOCK_LEN_M256 (BLOCK_LEN_INT64 / 4)
+
+/* Blake2b's G function over all four columns (or diagonals) at once */
+#define G_AVX(a, b, c, d) \
+  do { \
+    a = _mm256_add_epi64(a, b); \
+    d = ROTR64_32(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi64(c, d); \
+    b = ROTR64_24(_mm256_xor_si256(b, c)); \
+    a = _mm256_add_epi64(a, b); \
+    d = ROTR64_16(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi64(c, d); \
+    b = ROTR64_63(_mm256_xor_si256(b, c)); \
+  } while(0)
+
+/* One round of Blake2b's compression function: columns, then diagonals */
+#define ROUND_LYRA_AVX(s) \
+  do { \
+    G_AVX(s[0], s[1], s[2], s[3]); \
+    s[1] = _mm256_permute4x64_epi64(s[1], _MM_SHUFFLE(0, 3, 2, 1)); \
+    s[2] = _mm256_permute4x64_epi64(s[2], _MM_SHUFFLE(1, 0, 3, 2)); \
+    s[3] = _mm256_permute4x64_epi64(s[3], _MM_SHUFFLE(2, 1, 0, 3)); \
+    G_AVX(s[0], s[1], s[2], s[3]); \
+    s[1] = _mm256_permute4x64_epi64(s[1], _MM_SHUFFLE(2, 1, 0, 3)); \
+    s[2] = _mm256_permute4x64_epi64(s[2], _MM_SHUFFLE(1, 0, 3, 2)); \
+    s[3] = _mm256_permute4x64_epi64(s[3], _MM_SHUFFLE(0, 3, 2, 1)); \
+  } while(0)
+
+/* rotW(rand): the first BLOCK_LEN_INT64 words of the state rotated right by one word */
+static inline void rotw_avx(__m256i r[BLOCK_LEN_M256], const __m256i s[4]) {
+    const __m256i a = _mm256_permute4x64_epi64(s[0], _MM_SHUFFLE(2, 1, 0, 3));
+    const __m256i b = _mm256_permute4x64_epi64(s[1], _MM_SHUFFLE(2, 1, 0, 3));
+    const __m256i c = _mm256_permute4x64_epi64(s[2], _MM_SHUFFLE(2, 1, 0, 3));
+    r[0] = _mm256_blend_epi32(a, c, 0x03);
+    r[1] = _mm256_blend_epi32(b, a, 0x03);
+    r[2] = _mm256_blend_epi32(c, b, 0x03);
+}
+
+static inline void load_state_avx(__m256i s[4], const uint64_t *state) {
+    int i;
+    for (i = 0; i < 4; i++)
+        s[i] = _mm256_loadu_si256((const __m256i*)state + i);
+}
+
+static inline void store_state_avx(uint64_t *state, const __m256i s[4]) {
+    int i;
+    for (i = 0; i < 4; i++)
+        _mm256_storeu_si256((__m256i*)state + i, s[i]);
+}
+
+static void SPONGE_FN(blake2bLyra)(__m256i s[4]) {
+    int i;
+    for (i = 0; i < 12; i++)
+        ROUND_LYRA_AVX(s);
+}
+
+static void SPONGE_FN(absorbBlock)(uint64_t *state, const uint64_t *in) {
+    __m256i s[4];
+    int i;
+    load_state_avx(s, state);
+    for (i = 0; i < BLOCK_LEN_M256; i++)
+        s[i] = _mm256_xor_si256(s[i], _mm256_loadu_si256((const __m256i*)in + i));
+    SPONGE_FN(blake2bLyra)(s);
+    store_state_avx(state, s);
+}
+
+static void SPONGE_FN(absorbBlockBlake2Safe)(uint64_t *state, const uint64_t *in) {
+    __m256i s[4];
+    int i;
+    load_state_avx(s, state);
+    for (i = 0; i < BLOCK_LEN_BLAKE2_SAFE_INT64 / 4; i++)
+        s[i] = _mm256_xor_si256(s[i], _mm256_loadu_si256((const __m256i*)in + i));
+    SPONGE_FN(blake2bLyra)(s);
+    store_state_avx(state, s);
+}
+
+static void SPONGE_FN(reducedSqueezeRow0)(uint64_t* state, uint64_t* rowOut, uint64_t nCols) {
+    __m256i s[4];
+    __m256i* ptrWord = (__m256i*)(rowOut + (nCols-1)*BLOCK_LEN_INT64);
+    uint64_t col;
+    int i;
+    load_state_avx(s, state);
+    //M[row][C-1-col] = H.reduced_squeeze()
+    for (col = 0; col < nCols; col++) {
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWord + i, s[i]);
+        ptrWord -= BLOCK_LEN_M256;
+        ROUND_LYRA_AVX(s);
+    }
+    store_state_avx(state, s);
+}
+
+static void SPONGE_FN(reducedDuplexRow1)(uint64_t *state, uint64_t *rowIn, uint64_t *rowOut, uint64_t nCols) {
+    __m256i s[4], in[BLOCK_LEN_M256];
+    const __m256i* ptrWordIn = (const __m256i*)rowIn;
+    __m256i* ptrWordOut = (__m256i*)(rowOut + (nCols-1)*BLOCK_LEN_INT64);
+    uint64_t col;
+    int i;
+    load_state_avx(s, state);
+    for (col = 0; col < nCols; col++) {
+        //Absorbing "M[prev][col]"
+        for (i = 0; i < BLOCK_LEN_M256; i++) {
+            in[i] = _mm256_loadu_si256(ptrWordIn + i);
+            s[i] = _mm256_xor_si256(s[i], in[i]);
+        }
+        ROUND_LYRA_AVX(s);
+        //M[row][C-1-col] = M[prev][col] XOR rand
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWordOut + i, _mm256_xor_si256(in[i], s[i]));
+        ptrWordIn += BLOCK_LEN_M256;
+        ptrWordOut -= BLOCK_LEN_M256;
+    }
+    store_state_avx(state, s);
+}
+
+static void SPONGE_FN(reducedDuplexRowSetup)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    __m256i s[4], in[BLOCK_LEN_M256], inOut[BLOCK_LEN_M256], rot[BLOCK_LEN_M256];
+    const __m256i* ptrWordIn = (const __m256i*)rowIn;
+    __m256i* ptrWordInOut = (__m256i*)rowInOut;
+    __m256i* ptrWordOut = (__m256i*)(rowOut + (nCols-1)*BLOCK_LEN_INT64);
+    uint64_t col;
+    int i;
+    load_state_avx(s, state);
+    for (col = 0; col < nCols; col++) {
+        //Absorbing "M[prev] [+] M[row*]"
+        for (i = 0; i < BLOCK_LEN_M256; i++) {
+            in[i] = _mm256_loadu_si256(ptrWordIn + i);
+            inOut[i] = _mm256_loadu_si256(ptrWordInOut + i);
+            s[i] = _mm256_xor_si256(s[i], _mm256_add_epi64(in[i], inOut[i]));
+        }
+        ROUND_LYRA_AVX(s);
+        //M[row][col] = M[prev][col] XOR rand
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWordOut + i, _mm256_xor_si256(in[i], s[i]));
+        //M[row*][col] = M[row*][col] XOR rotW(rand)
+        rotw_avx(rot, s);
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWordInOut + i, _mm256_xor_si256(inOut[i], rot[i]));
+        ptrWordInOut += BLOCK_LEN_M256;
+        ptrWordIn += BLOCK_LEN_M256;
+        ptrWordOut -= BLOCK_LEN_M256;
+    }
+    store_state_avx(state, s);
+}
+
+static void SPONGE_FN(reducedDuplexRow)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, uint64_t nCols) {
+    __m256i s[4], rot[BLOCK_LEN_M256];
+    const __m256i* ptrWordIn = (const __m256i*)rowIn;
+    __m256i* ptrWordInOut = (__m256i*)rowInOut;
+    __m256i* ptrWordOut = (__m256i*)rowOut;
+    uint64_t col;
+    int i;
+    load_state_avx(s, state);
+    for (col = 0; col < nCols; col++) {
+        //Absorbing "M[prev] [+] M[row*]"
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            s[i] = _mm256_xor_si256(s[i], _mm256_add_epi64(_mm256_loadu_si256(ptrWordIn + i), _mm256_loadu_si256(ptrWordInOut + i)));
+        ROUND_LYRA_AVX(s);
+        //M[rowOut][col] = M[rowOut][col] XOR rand
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWordOut + i, _mm256_xor_si256(_mm256_loadu_si256(ptrWordOut + i), s[i]));
+        //M[rowInOut][col] = M[rowInOut][col] XOR rotW(rand)
+        //(rowOut may alias rowInOut, so reload before the second update)
+        rotw_avx(rot, s);
+        for (i = 0; i < BLOCK_LEN_M256; i++)
+            _mm256_storeu_si256(ptrWordInOut + i, _mm256_xor_si256(_mm256_loadu_si256(ptrWordInOut + i), rot[i]));
+        ptrWordOut += BLOCK_LEN_M256;
+        ptrWordInOut += BLOCK_LEN_M256;
+        ptrWordIn += BLOCK_LEN_M256;
+    }
+    store_state_avx(state, s);
+}
+
+#endif /* SPONGE_AVX_H_ */
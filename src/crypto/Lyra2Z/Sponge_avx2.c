@@ -0,0 +1,34 @@
+/**
+ * AVX2 implementation of the Lyra2 sponge row operations (see Sponge_avx.h).
+ *
+ * This software is hereby placed in the public domain.
+ */
+#include "Lyra2.h"
+#include "Sponge.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+/* 64-bit rotations to the right; 32, 24 and 16 are whole-byte shuffles */
+#define ROTR64_32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR64_24(x) _mm256_shuffle_epi8((x), _mm256_setr_epi8( \
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, \
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10))
+#define ROTR64_16(x) _mm256_shuffle_epi8((x), _mm256_setr_epi8( \
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, \
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9))
+#define ROTR64_63(x) _mm256_or_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define SPONGE_FN(name) name##_avx2
+#include "Sponge_avx.h"
+
+const lyra2_sponge lyra2_sponge_avx2 = {
+    absorbBlock_avx2,
+    absorbBlockBlake2Safe_avx2,
+    reducedSqueezeRow0_avx2,
+    reducedDuplexRow1_avx2,
+    reducedDuplexRowSetup_avx2,
+    reducedDuplexRow_avx2
+};
+
+#endif
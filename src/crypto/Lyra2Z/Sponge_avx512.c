@@ -0,0 +1,34 @@
+/**
+ * AVX-512 implementation of the Lyra2 sponge row operations (see Sponge_avx.h).
+ *
+ * The Blake2b state is only 1024 bits wide and its rounds are inherently serial, so
+ * wider registers do not help a single hash. What AVX-512VL does add is a native
+ * 64-bit rotate (vprorq), which replaces the shuffles and shift/or pairs of the
+ * AVX2 version in every G function.
+ *
+ * This software is hereby placed in the public domain.
+ */
+#include "Lyra2.h"
+#include "Sponge.h"
+
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+#include <immintrin.h>
+
+#define ROTR64_32(x) _mm256_ror_epi64((x), 32)
+#define ROTR64_24(x) _mm256_ror_epi64((x), 24)
+#define ROTR64_16(x) _mm256_ror_epi64((x), 16)
+#define ROTR64_63(x) _mm256_ror_epi64((x), 63)
+
+#define SPONGE_FN(name) name##_avx512
+#include "Sponge_avx.h"
+
+const lyra2_sponge lyra2_sponge_avx512 = {
+    absorbBlock_avx512,
+    absorbBlockBlake2Safe_avx512,
+    reducedSqueezeRow0_avx512,
+    reducedDuplexRow1_avx512,
+    reducedDuplexRowSetup_avx512,
+    reducedDuplexRow_avx512
+};
+
+#endif
@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A number modulo the prime 2^3072 - 1103717, stored as little endian limbs. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const size_t BYTE_SIZE = 384;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    //! Serialize the limbs, which need not be fully reduced unless Divide was called last
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    Num3072 GetInverse() const;
+};
+
+/** A hash of a set of byte strings ("MuHash"), which does not depend on the
+ *  order they were added in, and from which they can be removed again.
+ *
+ *  Each element is hashed to a number modulo a 3072 bit prime, and the set to
+ *  the product of the numbers of its elements. Removed elements are multiplied
+ *  into a separate denominator, so that the inversion it takes to divide by
+ *  them, which is slow, is done once in Finalize rather than once per element.
+ *
+ *  The hash of a set is the SHA256 of its product, so two MuHash3072 of the
+ *  same set give the same Finalize whatever the elements added and removed
+ *  on the way.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add the elements of another set hash
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Remove the elements of another set hash
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        numerator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        denominator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        denominator = Num3072(data);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -2,6 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <crypto/sha256.h>
 #include <crypto/common.h>
 
@@ -16,6 +20,16 @@ namespace sha256_sse4
 {
 void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 }
+namespace sha256d_sse2
+{
+void TransformD_4way(unsigned char* out, const unsigned char* in, size_t len);
+}
+#if defined(ENABLE_AVX2) && !defined(DISABLE_OPTIMIZED_SHA256)
+namespace sha256d_avx2
+{
+void TransformD_8way(unsigned char* out, const unsigned char* in, size_t len);
+}
+#endif
 #endif
 #endif
 
@@ -174,21 +188,76 @@ bool SelfTest(TransformType tr) {
 
 TransformType Transform = sha256::Transform;
 
+typedef void (*TransformDType)(unsigned char*, const unsigned char*, size_t);
+
+TransformDType TransformD4Way = nullptr;
+TransformDType TransformD8Way = nullptr;
+
+/** Check a multi-way TransformD against CSHA256, for every message length. */
+bool SelfTestD(TransformDType tr, int lanes)
+{
+    unsigned char in[8 * 55], out[8 * 32], expected[32];
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = i * 7 + 1;
+    }
+    for (size_t len = 0; len <= 55; len++) {
+        tr(out, in, len);
+        for (int l = 0; l < lanes; l++) {
+            CSHA256().Write(in + l * len, len).Finalize(expected);
+            CSHA256().Write(expected, 32).Finalize(expected);
+            if (memcmp(out + 32 * l, expected, 32)) return false;
+        }
+    }
+    return true;
+}
+
 } // namespace
 
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+/** Whether the OS saves the register state selected by mask on context switches. */
+static bool AVXEnabled(uint32_t mask)
+{
+    uint32_t eax, edx;
+    __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & mask) == mask;
+}
+#endif
+
 std::string SHA256AutoDetect()
 {
+    std::string ret = "standard";
 #if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
     uint32_t eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
+    bool have_sse4 = false, have_avx2 = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse4 = (ecx >> 19) & 1;
+        bool have_avx = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled(0x06); // OSXSAVE and AVX
+        if (have_avx && __get_cpuid_max(0, nullptr) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            have_avx2 = (ebx >> 5) & 1;
+        }
+    }
+    (void)have_avx2;
+
+    if (have_sse4) {
         Transform = sha256_sse4::Transform;
-        assert(SelfTest(Transform));
-        return "sse4";
+        ret = "sse4(1way)";
+    }
+    // SSE2 is part of x86-64
+    TransformD4Way = sha256d_sse2::TransformD_4way;
+    ret += ",sse2(4way)";
+#if defined(ENABLE_AVX2) && !defined(DISABLE_OPTIMIZED_SHA256)
+    if (have_avx2) {
+        TransformD8Way = sha256d_avx2::TransformD_8way;
+        ret += ",avx2(8way)";
     }
+#endif
 #endif
 
     assert(SelfTest(Transform));
-    return "standard";
+    if (TransformD4Way) assert(SelfTestD(TransformD4Way, 4));
+    if (TransformD8Way) assert(SelfTestD(TransformD8Way, 8));
+    return ret;
 }
 
 ////// SHA-256
@@ -247,3 +316,31 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256DShort(unsigned char* output, const unsigned char* input, size_t len, size_t blocks)
+{
+    assert(len <= 55);
+    if (TransformD8Way) {
+        while (blocks >= 8) {
+            TransformD8Way(output, input, len);
+            output += 32 * 8;
+            input += len * 8;
+            blocks -= 8;
+        }
+    }
+    if (TransformD4Way) {
+        while (blocks >= 4) {
+            TransformD4Way(output, input, len);
+            output += 32 * 4;
+            input += len * 4;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        CSHA256().Write(input, len).Finalize(output);
+        CSHA256().Write(output, 32).Finalize(output);
+        output += 32;
+        input += len;
+        --blocks;
+    }
+}
@@ -26,6 +26,13 @@ public:
     CSHA256& Reset();
 };
 
+/** Compute the double-SHA256 of `blocks` messages of `len` bytes each, stored
+ *  back to back in `input`, writing 32 bytes per message to `output`. Each
+ *  message must fit a single block (len <= 55), which lets several of them be
+ *  hashed at once, one per SIMD lane.
+ */
+void SHA256DShort(unsigned char* output, const unsigned char* input, size_t len, size_t blocks);
+
 /** Autodetect the best available SHA256 implementation.
  *  Returns the name of the implementation.
  */
@@ -0,0 +1,41 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(__x86_64__) || defined(__amd64__)
+
+#include <crypto/common.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+namespace sha256d_avx2 {
+namespace {
+
+static const int LANES = 8;
+typedef __m256i vec;
+
+inline vec K(uint32_t x) { return _mm256_set1_epi32(x); }
+inline vec Add(vec x, vec y) { return _mm256_add_epi32(x, y); }
+inline vec Xor(vec x, vec y) { return _mm256_xor_si256(x, y); }
+inline vec Or(vec x, vec y) { return _mm256_or_si256(x, y); }
+inline vec And(vec x, vec y) { return _mm256_and_si256(x, y); }
+inline vec ShR(vec x, int n) { return _mm256_srli_epi32(x, n); }
+inline vec ShL(vec x, int n) { return _mm256_slli_epi32(x, n); }
+inline vec Load(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+inline void Store(uint32_t* p, vec x) { _mm256_storeu_si256((__m256i*)p, x); }
+
+#include <crypto/sha256_multiway.h>
+
+} // namespace
+
+void TransformD_8way(unsigned char* out, const unsigned char* in, size_t len)
+{
+    TransformD(out, in, len);
+}
+
+} // namespace sha256d_avx2
+
+#endif
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Double-SHA256 of several short messages at once, one message per vector
+// lane. Shared by sha256_sse2.cpp and sha256_avx2.cpp: the including file
+// includes crypto/common.h and string.h, then defines, inside its own
+// namespace, LANES, the vector type `vec` and the K(), Add(), Xor(), Or(),
+// And(), ShR(), ShL(), Load() and Store() helpers.
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+inline vec Ch(vec x, vec y, vec z) { return Xor(z, And(x, Xor(y, z))); }
+inline vec Maj(vec x, vec y, vec z) { return Or(And(x, y), And(z, Or(x, y))); }
+inline vec Sigma0(vec x) { return Xor(Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19))), Or(ShR(x, 22), ShL(x, 10))); }
+inline vec Sigma1(vec x) { return Xor(Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21))), Or(ShR(x, 25), ShL(x, 7))); }
+inline vec sigma0(vec x) { return Xor(Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14))), ShR(x, 3)); }
+inline vec sigma1(vec x) { return Xor(Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13))), ShR(x, 10)); }
+
+static const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul,
+};
+
+static const uint32_t ROUND_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/** Compress the block w (which is overwritten) into a fresh SHA-256 state s. */
+inline void Compress(vec s[8], vec w[16])
+{
+    vec a = K(INIT[0]), b = K(INIT[1]), c = K(INIT[2]), d = K(INIT[3]);
+    vec e = K(INIT[4]), f = K(INIT[5]), g = K(INIT[6]), h = K(INIT[7]);
+
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16) {
+            w[i & 15] = Add(Add(sigma1(w[(i - 2) & 15]), w[(i - 7) & 15]), Add(sigma0(w[(i - 15) & 15]), w[i & 15]));
+        }
+        vec t1 = Add(Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), K(ROUND_K[i]))), w[i & 15]);
+        vec t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+
+    s[0] = Add(a, K(INIT[0]));
+    s[1] = Add(b, K(INIT[1]));
+    s[2] = Add(c, K(INIT[2]));
+    s[3] = Add(d, K(INIT[3]));
+    s[4] = Add(e, K(INIT[4]));
+    s[5] = Add(f, K(INIT[5]));
+    s[6] = Add(g, K(INIT[6]));
+    s[7] = Add(h, K(INIT[7]));
+}
+
+/** Double-SHA256 of LANES messages of len (at most 55) bytes each, stored back to back. */
+void TransformD(unsigned char* out, const unsigned char* in, size_t len)
+{
+    uint32_t words[16][LANES];
+    unsigned char block[64];
+    for (int l = 0; l < LANES; l++) {
+        memset(block, 0, sizeof(block));
+        memcpy(block, in + l * len, len);
+        block[len] = 0x80;
+        WriteBE64(block + 56, len << 3);
+        for (int j = 0; j < 16; j++) {
+            words[j][l] = ReadBE32(block + 4 * j);
+        }
+    }
+
+    vec w[16], s[8];
+    for (int j = 0; j < 16; j++) {
+        w[j] = Load(words[j]);
+    }
+    Compress(s, w);
+
+    // The 32-byte hash, padded, is the only block of the second pass.
+    for (int j = 0; j < 8; j++) {
+        w[j] = s[j];
+    }
+    w[8] = K(0x80000000ul);
+    for (int j = 9; j < 15; j++) {
+        w[j] = K(0);
+    }
+    w[15] = K(256);
+    Compress(s, w);
+
+    for (int j = 0; j < 8; j++) {
+        Store(words[j], s[j]);
+    }
+    for (int l = 0; l < LANES; l++) {
+        for (int j = 0; j < 8; j++) {
+            WriteBE32(out + 32 * l + 4 * j, words[j][l]);
+        }
+    }
+}
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
@@ -0,0 +1,41 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(__x86_64__) || defined(__amd64__)
+
+#include <crypto/common.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+namespace sha256d_sse2 {
+namespace {
+
+static const int LANES = 4;
+typedef __m128i vec;
+
+inline vec K(uint32_t x) { return _mm_set1_epi32(x); }
+inline vec Add(vec x, vec y) { return _mm_add_epi32(x, y); }
+inline vec Xor(vec x, vec y) { return _mm_xor_si128(x, y); }
+inline vec Or(vec x, vec y) { return _mm_or_si128(x, y); }
+inline vec And(vec x, vec y) { return _mm_and_si128(x, y); }
+inline vec ShR(vec x, int n) { return _mm_srli_epi32(x, n); }
+inline vec ShL(vec x, int n) { return _mm_slli_epi32(x, n); }
+inline vec Load(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void Store(uint32_t* p, vec x) { _mm_storeu_si128((__m128i*)p, x); }
+
+#include <crypto/sha256_multiway.h>
+
+} // namespace
+
+void TransformD_4way(unsigned char* out, const unsigned char* in, size_t len)
+{
+    TransformD(out, in, len);
+}
+
+} // namespace sha256d_sse2
+
+#endif
@@ -14,8 +14,10 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
+#include <coinstats.h>
 #include <compat/sanity.h>
 #include <consensus/validation.h>
+#include <crypto/Lyra2Z/Lyra2Z.h>
 #include <fs.h>
 #include <httpserver.h>
 #include <httprpc.h>
@@ -191,6 +193,7 @@ void Shutdown()
 #ifdef ENABLE_WALLET
     FlushWallets();
 #endif
+    GenerateTalers(false, 0, Params(), nullptr);
     MapPort(false);
 
     // Because these depend on each-other, we make sure that neither can be
@@ -243,6 +246,7 @@ void Shutdown()
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
         }
+        pcoinsStats.reset();
         pcoinsTip.reset();
         pcoinscatcher.reset();
         pcoinsdbview.reset();
@@ -335,6 +339,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write the UTXO cache to disk in the background while validation continues, which may keep up to twice as many coins in memory while a write lags behind (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -350,6 +355,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Start a new node from a UTXO snapshot written by dumptxoutset, instead of connecting the blocks up to it. Requires -prune, -snapshotblock and -snapshotmuhash; ignored once the node has blocks"));
+    strUsage += HelpMessageOpt("-snapshotblock=<hash>", _("The block hash that the UTXO snapshot of -loadsnapshot must be of, as dumptxoutset on a node you trust returns it"));
+    strUsage += HelpMessageOpt("-snapshotmuhash=<hash>", _("The muhash that the coins of the UTXO snapshot of -loadsnapshot must have, as dumptxoutset on a node you trust returns it"));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
@@ -372,7 +380,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u, 0 with -prune)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info)"));
@@ -789,6 +797,12 @@ void InitParameterInteraction()
             LogPrintf("%s: parameter interaction: -blocksonly=1 -> setting -whitelistrelay=0\n", __func__);
     }
 
+    // a pruned node does not keep the blocks that a transaction index points into
+    if (gArgs.GetArg("-prune", 0)) {
+        if (gArgs.SoftSetBoolArg("-txindex", false))
+            LogPrintf("%s: parameter interaction: -prune set -> setting -txindex=0\n", __func__);
+    }
+
     // Forcing relay from whitelisted hosts implies we will accept relays from them in the first place.
     if (gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
         if (gArgs.SoftSetBoolArg("-whitelistrelay", true))
@@ -910,6 +924,20 @@ bool AppInitParameterInteraction()
             return InitError(_("Prune mode is incompatible with -txindex."));
     }
 
+    // the blocks below a UTXO snapshot are never downloaded, so a node started from one is pruned
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        if (!gArgs.GetArg("-prune", 0))
+            return InitError(_("Loading a UTXO snapshot requires -prune."));
+        if (gArgs.GetBoolArg("-reindex", false) || gArgs.GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadsnapshot is incompatible with -reindex and -reindex-chainstate."));
+        // the snapshot itself cannot prove which coins are right, so its hashes come from a node the user trusts
+        for (const char* pszArg : {"-snapshotblock", "-snapshotmuhash"}) {
+            const std::string strHash = gArgs.GetArg(pszArg, "");
+            if (strHash.size() != 64 || !IsHex(strHash))
+                return InitError(strprintf(_("-loadsnapshot requires %s=<hash>, as dumptxoutset on a node you trust returns it."), pszArg));
+        }
+    }
+
     // -bind and -whitebind can't be set when not listening
     size_t nUserBind = gArgs.GetArgs("-bind").size() + gArgs.GetArgs("-whitebind").size();
     if (nUserBind != 0 && !gArgs.GetBoolArg("-listen", DEFAULT_LISTEN)) {
@@ -985,6 +1013,7 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fBackgroundFlush = gArgs.GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1174,6 +1203,8 @@ bool AppInitSanityChecks()
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string lyra2z_algo = lyra2z_autodetect();
+    LogPrintf("Using the '%s' Lyra2Z implementation\n", lyra2z_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1237,11 +1268,18 @@ bool AppInitMain()
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    InitPoWCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        // Header PoW checks reuse the -par thread count; the two pools are rarely busy at the same time
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPoWCheck);
+        // Input prefetch threads mostly wait on the coins database rather than use a core
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
     }
 
     // Start the lightweight task scheduler thread
@@ -1424,6 +1462,7 @@ bool AppInitMain()
         do {
             try {
                 UnloadBlockIndex();
+                pcoinsStats.reset();
                 pcoinsTip.reset();
                 pcoinsdbview.reset();
                 pcoinscatcher.reset();
@@ -1457,7 +1496,7 @@ bool AppInitMain()
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
                 // Check for changed -txindex state
-                if (fTxIndex != DEFAULT_TXINDEX) {
+                if (fTxIndex != gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
                     break;
                 }
@@ -1500,6 +1539,15 @@ bool AppInitMain()
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
 
+                // Pick up the running UTXO set statistics if they were written along with these
+                // coins. If not, they are unknown until gettxoutsetinfo scans the coins once.
+                pcoinsStats.reset(new CCoinsSetStats());
+                if (!pcoinsTip->GetBestBlock().IsNull() &&
+                    (!pcoinsdbview->ReadStats(*pcoinsStats) || pcoinsStats->hashBlock != pcoinsTip->GetBestBlock())) {
+                    LogPrintf("UTXO set statistics are not up to date and will be rebuilt by gettxoutsetinfo\n");
+                    pcoinsStats.reset();
+                }
+
                 bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
                 if (!is_coinsview_empty) {
                     // LoadChainTip sets chainActive based on pcoinsTip's best block
@@ -1587,6 +1635,29 @@ bool AppInitMain()
         LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
     }
 
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
+        }
+        if (nHeight < 0) {
+            // A new node connects its genesis block only in the import thread, but the snapshot builds on it
+            CValidationState state;
+            if (!ActivateBestChain(state, chainparams))
+                return InitError(strprintf(_("Failed to connect the genesis block: %s"), FormatStateMessage(state)));
+        }
+        if (nHeight > 0) {
+            LogPrintf("Not loading the UTXO snapshot, as the chain is at height %d already\n", nHeight);
+        } else {
+            CCoinsSetStats stats;
+            std::string strError;
+            if (!LoadUTXOSnapshot(chainparams, fs::absolute(gArgs.GetArg("-loadsnapshot", ""), GetDataDir()), uint256S(gArgs.GetArg("-snapshotblock", "")),
+                                  uint256S(gArgs.GetArg("-snapshotmuhash", "")), stats, strError))
+                return InitError(strError);
+        }
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1741,7 +1812,7 @@ bool AppInitMain()
 
 #ifdef ENABLE_WALLET
     if (gArgs.GetBoolArg("-stakegen", true))
-        StartMinting(threadGroup);
+        StartMinting(threadGroup, scheduler);
 #endif
     // ********************************************************* Step 12: finished
 
@@ -2,11 +2,13 @@
 // Distributed under the GPL3 software license, see the accompanying
 // file COPYING or http://www.gnu.org/licenses/gpl.html.
 
+#include <algorithm>
 #include <boost/assign/list_of.hpp>
 
 #include "kernel.h"
 #include "db.h"
-#include "uint256hm.h"
+#include <crypto/common.h>
+#include <crypto/sha256.h>
 #include <chainparams.h>
 #include "util.h"
 #include <wallet/wallet.h>
@@ -20,6 +22,49 @@ using namespace std;
 // Hard checkpoints of stake modifiers to ensure they are deterministic
 static std::map<int, unsigned int> mapStakeModifierCheckpoints;
 
+CStakeModifierIndex stakeModifierIndex;
+
+void CStakeModifierIndex::Connect(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    while (!vEntries.empty() && vEntries.back().nHeight >= pindex->nHeight)
+        vEntries.pop_back();
+    if (pindex->GeneratedStakeModifier())
+        vEntries.push_back(Entry{pindex->GetBlockTime(), pindex->nStakeModifier, pindex->nHeight});
+}
+
+void CStakeModifierIndex::Disconnect(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    while (!vEntries.empty() && vEntries.back().nHeight >= pindex->nHeight)
+        vEntries.pop_back();
+}
+
+void CStakeModifierIndex::Rebuild(const CBlockIndex* pindexTip)
+{
+    LOCK(cs);
+    vEntries.clear();
+    for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev) {
+        if (pindex->GeneratedStakeModifier())
+            vEntries.push_back(Entry{pindex->GetBlockTime(), pindex->nStakeModifier, pindex->nHeight});
+    }
+    reverse(vEntries.begin(), vEntries.end());
+}
+
+bool CStakeModifierIndex::Find(int64_t nTime, int nHeightMax, Entry& entry) const
+{
+    LOCK(cs);
+    auto itTime = upper_bound(vEntries.begin(), vEntries.end(), nTime,
+        [](int64_t nTime, const Entry& e) { return nTime < e.nTime; });
+    auto itHeight = upper_bound(vEntries.begin(), vEntries.end(), nHeightMax,
+        [](int nHeight, const Entry& e) { return nHeight < e.nHeight; });
+    auto it = min(itTime, itHeight);
+    if (it == vEntries.begin())
+        return false;
+    entry = *--it;
+    return true;
+}
+
 // Get the last stake modifier and its generation time from a given block
 static bool GetLastStakeModifier(const CBlockIndex* pindex, uint64_t& nStakeModifier, int64_t& nModifierTime)
 {
@@ -50,51 +95,74 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
+// A block of the selection interval of a new stake modifier. The selection
+// hash of a block only depends on the block and on the previous modifier, so
+// it is the same in all 64 rounds and is computed once.
+struct CStakeModifierCandidate
+{
+    int64_t nTime;
+    uint256 hashBlock;
+    const CBlockIndex* pindex;
+    arith_uint256 hashSelection;
+
+    bool operator<(const CStakeModifierCandidate& other) const
+    {
+        return nTime < other.nTime || (nTime == other.nTime && hashBlock < other.hashBlock);
+    }
+};
+
+// Compute the selection hashes of the candidates: the hash of each block's
+// proof-hash and the previous proof-of-stake modifier
+static void ComputeSelectionHashes(vector<CStakeModifierCandidate>& vCandidates, uint64_t nStakeModifierPrev)
+{
+    static const size_t SELECTION_DATA_SIZE = 32 + 8;
+
+    vector<unsigned char> vData(vCandidates.size() * SELECTION_DATA_SIZE);
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        const CBlockIndex* pindex = vCandidates[i].pindex;
+        const uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
+        memcpy(vData.data() + i * SELECTION_DATA_SIZE, hashProof.begin(), 32);
+        WriteLE64(vData.data() + i * SELECTION_DATA_SIZE + 32, nStakeModifierPrev);
+    }
+    vector<unsigned char> vHashes(vCandidates.size() * CSHA256::OUTPUT_SIZE);
+    SHA256DShort(vHashes.data(), vData.data(), SELECTION_DATA_SIZE, vCandidates.size());
+
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        uint256 hash;
+        memcpy(hash.begin(), vHashes.data() + i * CSHA256::OUTPUT_SIZE, CSHA256::OUTPUT_SIZE);
+        vCandidates[i].hashSelection = UintToArith256(hash);
+        // the selection hash is divided by 2**32 so that proof-of-stake block
+        // is always favored over proof-of-work block. this is to preserve
+        // the energy efficiency property
+        if (vCandidates[i].pindex->IsProofOfStake())
+            vCandidates[i].hashSelection >>= 32;
+    }
+}
+
+// select a block from the candidate blocks in vCandidates (sorted by
+// timestamp), excluding already selected blocks flagged in vSelected, and
+// with timestamp up to nSelectionIntervalStop.
 static bool SelectBlockFromCandidates(
-    vector<pair<int64_t, uint256> >& vSortedByTimestamp,
-    map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev,
-    const CBlockIndex** pindexSelected)
+    const vector<CStakeModifierCandidate>& vCandidates,
+    const vector<bool>& vSelected,
+    int64_t nSelectionIntervalStop,
+    size_t& nSelected)
 {
     bool fSelected = false;
-    arith_uint256 hashBest = 0;
-    *pindexSelected = (const CBlockIndex*) 0;
-    for (const pair<int64_t, uint256>& item : vSortedByTimestamp)
+    for (size_t i = 0; i < vCandidates.size(); i++)
     {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+        if (fSelected && vCandidates[i].nTime > nSelectionIntervalStop)
             break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+        if (vSelected[i])
             continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-        CDataStream ss(SER_GETHASH, 0);
-        ss << hashProof << nStakeModifierPrev;
-        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest)
-        {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
-        }
-        else if (!fSelected)
+        if (!fSelected || vCandidates[i].hashSelection < vCandidates[nSelected].hashSelection)
         {
             fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
+            nSelected = i;
         }
     }
-    LogPrint(BCLog::STAKEMODIFIER, "SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString());
+    if (fSelected)
+        LogPrint(BCLog::STAKEMODIFIER, "SelectBlockFromCandidates: selection hash=%s\n", vCandidates[nSelected].hashSelection.ToString());
     return fSelected;
 }
 
@@ -140,35 +208,38 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     }
 
     // Sort candidate blocks by timestamp
-    vector<pair<int64_t, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * Params().GetConsensus().nStakeModifierInterval / Params().GetConsensus().nPosTargetSpacing);
+    vector<CStakeModifierCandidate> vCandidates;
+    vCandidates.reserve(64 * Params().GetConsensus().nStakeModifierInterval / Params().GetConsensus().nPosTargetSpacing);
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / Params().GetConsensus().nStakeModifierInterval) * Params().GetConsensus().nStakeModifierInterval - nSelectionInterval;
     const CBlockIndex* pindex = pindexPrev;
     while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
     {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        vCandidates.push_back(CStakeModifierCandidate{pindex->GetBlockTime(), pindex->GetBlockHash(), pindex, arith_uint256()});
         pindex = pindex->pprev;
     }
     int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    reverse(vCandidates.begin(), vCandidates.end());
+    sort(vCandidates.begin(), vCandidates.end());
+    ComputeSelectionHashes(vCandidates, nStakeModifier);
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
+    vector<bool> vSelected(vCandidates.size(), false);
+    for (int nRound=0; nRound<min(64, (int)vCandidates.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        size_t nSelected = 0;
+        if (!SelectBlockFromCandidates(vCandidates, vSelected, nSelectionIntervalStop, nSelected))
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
+        pindex = vCandidates[nSelected].pindex;
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
         // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
+        vSelected[nSelected] = true;
         LogPrint(BCLog::STAKEMODIFIER, "ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n",
                 nRound, DateTimeStrFormat(nSelectionIntervalStop), pindex->nHeight, pindex->GetStakeEntropyBit());
     }
@@ -187,11 +258,14 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        for (const pair<uint256, const CBlockIndex*>& item : mapSelectedBlocks)
+        for (size_t i = 0; i < vCandidates.size(); i++)
         {
+            if (!vSelected[i])
+                continue;
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake()? "S" : "W");
+            pindex = vCandidates[i].pindex;
+            strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, pindex->IsProofOfStake()? "S" : "W");
         }
         LogPrint(BCLog::STAKEMODIFIER, "ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap);
     }
@@ -203,9 +277,9 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-static bool GetKernelStakeModifier(const CBlock& blockFrom, unsigned int nCoinStakeTime, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifier(const CBlockIndex* pindexTip, unsigned int nCoinStakeTime, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
-    const CBlockIndex* pindex = chainActive.Tip();
+    const CBlockIndex* pindex = pindexTip;
     nStakeModifierHeight = pindex->nHeight;
     nStakeModifierTime = pindex->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -222,25 +296,29 @@ static bool GetKernelStakeModifier(const CBlock& blockFrom, unsigned int nCoinSt
         else
             return false;
     }
-    // loop to find the stake modifier earlier by
+    // find the stake modifier earlier by
     // (nStakeMinAge minus a selection interval)
-    while (nStakeModifierTime + Params().GetConsensus().nStakeMinAge - nStakeModifierSelectionInterval > (int64_t) nCoinStakeTime)
-    {
-        if (!pindex->pprev)
-        {   // reached genesis block; should not happen
-            return error("GetKernelStakeModifier() : reached genesis block");
-        }
-        pindex = pindex->pprev;
-        if (pindex->GeneratedStakeModifier())
-        {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
-        }
+    CStakeModifierIndex::Entry entry;
+    if (!stakeModifierIndex.Find((int64_t) nCoinStakeTime - Params().GetConsensus().nStakeMinAge + nStakeModifierSelectionInterval, pindex->nHeight, entry))
+    {   // reached genesis block; should not happen
+        return error("GetKernelStakeModifier() : reached genesis block");
     }
-    nStakeModifier = pindex->nStakeModifier;
+    nStakeModifier = entry.nStakeModifier;
+    nStakeModifierHeight = entry.nHeight;
+    nStakeModifierTime = entry.nTime;
     return true;
 }
 
+// Coin age of a kernel, in coin days
+static arith_uint256 GetCoinDayWeight(CAmount nValue, uint32_t nTimeBlockFrom, uint32_t nTimeTx)
+{
+    // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
+    // this change increases active coins participating the hash and helps
+    // to secure the network when proof-of-stake difficulty is low
+    int64_t nTimeWeight = min((int64_t)nTimeTx - nTimeBlockFrom, Params().GetConsensus().nStakeMaxAge) - Params().GetConsensus().nStakeMinAge;
+    return arith_uint256(nValue) * nTimeWeight / COIN / (24 * 60 * 60);
+}
+
 // ppcoin kernel protocol
 // coinstake must meet hash target according to the protocol:
 // kernel (input 0) must meet the formula
@@ -275,17 +353,13 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
 
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
-    // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
-    // this change increases active coins participating the hash and helps
-    // to secure the network when proof-of-stake difficulty is low
-    int64_t nTimeWeight = min((int64_t)nTimeTx - nTimeBlockFrom, Params().GetConsensus().nStakeMaxAge) - Params().GetConsensus().nStakeMinAge;
-    arith_uint256 bnCoinDayWeight = arith_uint256(txOutPrev.nValue) * nTimeWeight / COIN / (24 * 60 * 60);
+    arith_uint256 bnCoinDayWeight = GetCoinDayWeight(txOutPrev.nValue, nTimeBlockFrom, nTimeTx);
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom,blockFrom.GetBlockTime(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
+    if (!GetKernelStakeModifier(chainActive.Tip(), blockFrom.GetBlockTime(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
         return false;
 
     ss << nStakeModifier << nTimeBlockFrom << nTxPrevOffset << nTimeBlockFrom << prevout.n << nTimeTx;
@@ -323,49 +397,167 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
     return true;
 }
 
+// Number of kernels hashed at once
+static const size_t KERNEL_BATCH_SIZE = 64;
+// Serialized size of a kernel: nStakeModifier, nTimeBlockFrom, nTxPrevOffset,
+// nTimeBlockFrom, prevout.n and nTimeTx
+static const size_t KERNEL_SIZE = 28;
+
+// Hash the kernels of every candidate at nSearchInterval timestamps, from
+// nTimeTx backward (fForward false) or forward, in batches with
+// SHA256DShort(), and call fHit(nCandidate, nTime, hashProofOfStake) on each
+// one that meets the target, until it returns true. Kernels below the minimum
+// age are skipped.
+template <typename HitFunc>
+static bool SearchStakeKernels(const CBlockIndex* pindexTip, unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, bool fForward, HitFunc fHit)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    // The coin day weight only grows with the timestamp, so the target at the
+    // latest timestamp bounds the targets of all the timestamps searched for a
+    // candidate, and the exact target is only needed for hashes below that bound.
+    const uint32_t nTimeLast = fForward ? nTimeTx + nSearchInterval - 1 : nTimeTx;
+    std::vector<arith_uint256> vTargetMax(vCandidates.size());
+
+    unsigned char kernels[KERNEL_BATCH_SIZE * KERNEL_SIZE];
+    unsigned char hashes[KERNEL_BATCH_SIZE * CSHA256::OUTPUT_SIZE];
+    std::pair<size_t, uint32_t> slots[KERNEL_BATCH_SIZE]; // candidate and timestamp of each kernel
+    size_t nSlots = 0;
+
+    // Hash the batch and report the kernels that meet their target
+    auto check_batch = [&]() {
+        SHA256DShort(hashes, kernels, KERNEL_SIZE, nSlots);
+        for (size_t i = 0; i < nSlots; i++) {
+            uint256 hash;
+            memcpy(hash.begin(), hashes + i * CSHA256::OUTPUT_SIZE, CSHA256::OUTPUT_SIZE);
+            const arith_uint256 bnHash = UintToArith256(hash);
+            const CStakeKernelCandidate& candidate = vCandidates[slots[i].first];
+            if (bnHash > vTargetMax[slots[i].first])
+                continue;
+            if (bnHash > GetCoinDayWeight(candidate.nValue, candidate.nTimeBlockFrom, slots[i].second) * bnTargetPerCoinDay)
+                continue;
+            if (fHit(slots[i].first, slots[i].second, hash))
+                return true;
+        }
+        nSlots = 0;
+        return false;
+    };
+
+    for (size_t nCandidate = 0; nCandidate < vCandidates.size(); nCandidate++) {
+        const CStakeKernelCandidate& candidate = vCandidates[nCandidate];
+
+        uint64_t nStakeModifier = 0;
+        int nStakeModifierHeight = 0;
+        int64_t nStakeModifierTime = 0;
+        if (!GetKernelStakeModifier(pindexTip, candidate.nTimeBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+            continue;
+        vTargetMax[nCandidate] = GetCoinDayWeight(candidate.nValue, candidate.nTimeBlockFrom, nTimeLast) * bnTargetPerCoinDay;
+
+        // Everything but nTimeTx is fixed for the candidate
+        unsigned char prefix[KERNEL_SIZE - 4];
+        WriteLE64(prefix, nStakeModifier);
+        WriteLE32(prefix + 8, candidate.nTimeBlockFrom);
+        WriteLE32(prefix + 12, candidate.nTxPrevOffset);
+        WriteLE32(prefix + 16, candidate.nTimeBlockFrom);
+        WriteLE32(prefix + 20, candidate.prevout.n);
+
+        for (unsigned int n = 0; n < nSearchInterval; n++) {
+            const uint32_t nTime = fForward ? nTimeTx + n : nTimeTx - n;
+            if ((int64_t)candidate.nTimeBlockFrom + params.nStakeMinAge > nTime) { // Min age requirement
+                if (fForward)
+                    continue;
+                break;
+            }
+            unsigned char* kernel = kernels + nSlots * KERNEL_SIZE;
+            memcpy(kernel, prefix, sizeof(prefix));
+            WriteLE32(kernel + sizeof(prefix), nTime);
+            slots[nSlots++] = std::make_pair(nCandidate, nTime);
+            if (nSlots == KERNEL_BATCH_SIZE && check_batch())
+                return true;
+        }
+    }
+
+    return nSlots > 0 && check_batch();
+}
+
+bool FindStakeKernel(const CBlockIndex* pindexTip, unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, size_t& nCandidateRet, uint32_t& nTimeTxRet, uint256& hashProofOfStake)
+{
+    return SearchStakeKernels(pindexTip, nBits, vCandidates, nTimeTx, nSearchInterval, false, [&](size_t nCandidate, uint32_t nTime, const uint256& hash) {
+        nCandidateRet = nCandidate;
+        nTimeTxRet = nTime;
+        hashProofOfStake = hash;
+        return true;
+    });
+}
+
+void GetStakeKernelSchedule(const CBlockIndex* pindexTip, unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, std::vector<CStakeKernelHit>& vHits)
+{
+    vHits.clear();
+    // Kernels of a candidate are searched in time order, so its first hit is its earliest
+    std::vector<bool> vHit(vCandidates.size(), false);
+    SearchStakeKernels(pindexTip, nBits, vCandidates, nTimeTx, nSearchInterval, true, [&](size_t nCandidate, uint32_t nTime, const uint256& hash) {
+        if (!vHit[nCandidate]) {
+            vHit[nCandidate] = true;
+            vHits.push_back(CStakeKernelHit{nCandidate, nTime, hash});
+        }
+        return false;
+    });
+    std::stable_sort(vHits.begin(), vHits.end(), [](const CStakeKernelHit& a, const CStakeKernelHit& b) {
+        return a.nTimeTx < b.nTimeTx;
+    });
+}
+
 // Check kernel hash target and coinstake signature
-bool CheckProofOfStake(CValidationState& state, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, unsigned int nBlockTime)
+// Offset of txid in the block of pindexFrom, from the stake origin index.
+// Blocks connected before the index existed are indexed from disk on first use.
+bool GetStakeTxOffset(const CBlockIndex* pindexFrom, const uint256& txid, unsigned int& nTxOffset)
+{
+    CStakeTxOrigin origin;
+    if (pblocktree->ReadStakeTxOrigin(txid, origin) && origin.nHeight == pindexFrom->nHeight) {
+        nTxOffset = origin.nTxOffset;
+        return true;
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindexFrom, Params().GetConsensus()))
+        return false;
+    std::vector<std::pair<uint256, CStakeTxOrigin> > vOrigins;
+    GetStakeTxOrigins(block, pindexFrom->nHeight, vOrigins);
+    // The offset is still found below; only the next lookup reads the block again
+    if (!pblocktree->WriteStakeTxOrigins(vOrigins))
+        LogPrintf("%s: failed to write the stake origins of block %s\n", __func__, pindexFrom->GetBlockHash().ToString());
+    for (const auto& entry : vOrigins) {
+        if (entry.first == txid) {
+            nTxOffset = entry.second.nTxOffset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CheckProofOfStake(CValidationState& state, const CBlockIndex* pindexPrev, const CCoinsViewCache& view, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, unsigned int nBlockTime)
 {
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx->vin[0];
 
-    // Transaction index is required to get to block header
-    if (!fTxIndex)
-        return error("CheckProofOfStake() : transaction index not available");
+    // The coinstake spends the kernel, so it has to be in the UTXO set the
+    // block is connected to
+    const Coin& coinPrev = view.AccessCoin(txin.prevout);
+    if (coinPrev.IsSpent())
+        return state.DoS(1, error("CheckProofOfStake() : txPrev not found"));
 
-    // First try finding the previous transaction in database
-    CTransactionRef txTmp;
-    uint256 hashBlock;
-    if (!GetTransaction(txin.prevout.hash, txTmp, Params().GetConsensus(), hashBlock))
-        return state.DoS(1, error("CheckProofOfStake() : txPrev not found")); // previous transaction not in main chain, may occur during initial download
-
-    // Verify signature
-    PrecomputedTransactionData txdata(*tx);
-    if (!CScriptCheck(txTmp->vout[tx->vin[0].prevout.n], *tx, 0, 0, true, &txdata)())
-        return state.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx->GetHash().ToString()));
-
-    // Get transaction index for the previous transaction
-    CDiskTxPos postx;
-    if (!pblocktree->ReadTxIndex(txin.prevout.hash, postx))
-        return error("CheckProofOfStake() : tx index not found");  // tx index not found
-
-    // Read txPrev and header of its block
-    CBlockHeader header;
-    CTransactionRef txPrev;
-    {
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> txPrev;
-        } catch (std::exception& e) {
-            return error("%s() : deserialize or I/O error in CheckProofOfStake()", __PRETTY_FUNCTION__);
-        }
-        if (txPrev->GetHash() != txin.prevout.hash)
-            return error("%s() : txid mismatch in CheckProofOfStake()", __PRETTY_FUNCTION__);
-    }
+    // Header of the block of txPrev, and the offset of txPrev in it
+    const CBlockIndex* pindexFrom = pindexPrev->GetAncestor(coinPrev.nHeight);
+    if (!pindexFrom)
+        return error("CheckProofOfStake() : block of txPrev not found");
+    unsigned int nTxPrevOffset;
+    if (!GetStakeTxOffset(pindexFrom, txin.prevout.hash, nTxPrevOffset))
+        return error("CheckProofOfStake() : stake origin of %s not found", txin.prevout.hash.ToString());
+    const CBlock blockFrom(pindexFrom->GetBlockHeader());
 
-    if (!CheckStakeKernelHash(nBits, header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, txPrev->vout[txin.prevout.n], txin.prevout, nBlockTime, hashProofOfStake, logCategories & BCLog::STAKEMODIFIER))
+    if (!CheckStakeKernelHash(nBits, blockFrom, nTxPrevOffset, coinPrev.out, txin.prevout, nBlockTime, hashProofOfStake, logCategories & BCLog::STAKEMODIFIER))
         return state.DoS(1, error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s", tx->GetHash().ToString(), hashProofOfStake.ToString())); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -6,11 +6,50 @@
 
 #include <chain.h>
 #include <consensus/validation.h>
+#include <sync.h>
+
+#include <vector>
+
+class CCoinsViewCache;
 
 // MODIFIER_INTERVAL_RATIO:
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+// Stake modifiers generated on the active chain, by generation time.
+// Generation times strictly increase with height, so the modifier a kernel
+// has to use can be found with a binary search instead of a chain walk.
+class CStakeModifierIndex
+{
+public:
+    struct Entry
+    {
+        int64_t nTime;
+        uint64_t nStakeModifier;
+        int nHeight;
+    };
+
+private:
+    mutable CCriticalSection cs;
+    std::vector<Entry> vEntries;
+
+public:
+    // Record the modifier of a block that extends the chain at its height,
+    // dropping any entry left from a block previously connected there
+    void Connect(const CBlockIndex* pindex);
+
+    // Drop the entries of pindex and its descendants
+    void Disconnect(const CBlockIndex* pindex);
+
+    // Reload all entries from the chain ending in pindexTip
+    void Rebuild(const CBlockIndex* pindexTip);
+
+    // Find the last modifier generated at or before nTime, up to nHeightMax
+    bool Find(int64_t nTime, int nHeightMax, Entry& entry) const;
+};
+
+extern CStakeModifierIndex stakeModifierIndex;
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
@@ -18,9 +57,51 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTxOut& txOutPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
 
-// Check kernel hash target and coinstake signature
+// A coin to search stake kernels for, with what CheckStakeKernelHash() reads
+// from the (new format) block and the transaction the coin comes from
+struct CStakeKernelCandidate
+{
+    uint32_t nTimeBlockFrom;
+    unsigned int nTxPrevOffset;
+    COutPoint prevout;
+    CAmount nValue;
+};
+
+// Search the kernels of vCandidates at nTimeTx, nTimeTx - 1, ... down to
+// nTimeTx - nSearchInterval + 1, candidate by candidate, and return the first
+// one that meets the target. Same result as calling CheckStakeKernelHash() for
+// each of them in turn, but the fixed part of every kernel is prepared once
+// and the kernels are hashed in batches with SHA256DShort(). Stake modifiers
+// are looked up as of pindexTip rather than chainActive.Tip(), so that the
+// search needs no lock and can run on a snapshot of the candidates.
+bool FindStakeKernel(const CBlockIndex* pindexTip, unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, size_t& nCandidateRet, uint32_t& nTimeTxRet, uint256& hashProofOfStake);
+
+// The earliest timestamp a stake kernel candidate meets the target at
+struct CStakeKernelHit
+{
+    size_t nCandidate;
+    uint32_t nTimeTx;
+    uint256 hashProofOfStake;
+};
+
+// The same search forward in time: for each of vCandidates, the first of
+// nTimeTx, nTimeTx + 1, ... up to nTimeTx + nSearchInterval - 1 its kernel
+// meets the target at, as seen from a block on top of pindexTip. Since the
+// kernels only depend on the stake modifiers and nBits, which are fixed by
+// pindexTip, the result stays valid until the tip changes. vHits is sorted
+// by timestamp.
+void GetStakeKernelSchedule(const CBlockIndex* pindexTip, unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, std::vector<CStakeKernelHit>& vHits);
+
+// Offset of txid in the block of pindexFrom, from the stake origin index
+bool GetStakeTxOffset(const CBlockIndex* pindexFrom, const uint256& txid, unsigned int& nTxOffset);
+
+// Check kernel hash target of a coinstake in a block on top of pindexPrev,
+// whose UTXO set is view. Everything but the offset of the kernel's
+// transaction in its block (which comes from the stake origin index) is read
+// from view and the block index. The signature of the kernel input is left to
+// the script checks of ConnectBlock().
 // Sets hashProofOfStake on success return
-bool CheckProofOfStake(CValidationState& state, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, unsigned int nBlockTime);
+bool CheckProofOfStake(CValidationState& state, const CBlockIndex* pindexPrev, const CCoinsViewCache& view, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, unsigned int nBlockTime);
 
 // Get stake modifier checksum
 unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex);
@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <poolhashmap.h>
 
 #include <stdlib.h>
 
@@ -116,6 +117,15 @@ static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
 
+// PoolHashMap allocates its table and nodes in a few large blocks, whose
+// malloc overhead is negligible
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const PoolHashMap<X, Y, Z>& m)
+{
+    return m.memory_usage();
+}
+
 // indirectmap has underlying map with pointer as key
 
 template<typename X, typename Y>
@@ -20,6 +20,8 @@
 #include <policy/policy.h>
 #include <pow.h>
 #include <primitives/transaction.h>
+#include <scheduler.h>
+#include <script/script.h>
 #include <script/standard.h>
 #include <timedata.h>
 #include <util.h>
@@ -27,13 +29,18 @@
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <utility>
 #ifdef ENABLE_WALLET
+#include <kernel.h>
 #include <wallet/wallet.h>
 #include <warnings.h>
-#include <boost/thread.hpp>
 #endif
+
+#include <boost/thread.hpp>
 //////////////////////////////////////////////////////////////////////////////
 //
 // BitcoinMiner
@@ -124,7 +131,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewPoSBlock(bool& fPoSCanc
     return CreateNewBlock(scriptDummy, fMineWitnessTx, true, fPoSCancel, pwallet);
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fAddProofOfStake, bool& fPoSCancel, CWallet* pwallet)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewPoSBlock(bool& fPoSCancel, CWallet* pwallet, const CStakeKernelCandidate& kernel, uint32_t nKernelTime, bool fMineWitnessTx)
+{
+    CScript scriptDummy = CScript() << OP_TRUE;
+    return CreateNewBlock(scriptDummy, fMineWitnessTx, true, fPoSCancel, pwallet, &kernel, nKernelTime);
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fAddProofOfStake, bool& fPoSCancel, CWallet* pwallet, const CStakeKernelCandidate* pkernel, uint32_t nKernelTime)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -155,17 +168,23 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus(), true);
         CMutableTransaction txCoinStake;
-        nCoinStakeTime = GetAdjustedTime();
-        int64_t nSearchTime = nCoinStakeTime;
-        if (nSearchTime > nLastCoinStakeSearchTime) {
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, txCoinStake, nCoinStakeTime, nPosReward)) {
-                if (nCoinStakeTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME)) {
-                    pblock->vtx.push_back(MakeTransactionRef(std::move(txCoinStake)));
-                    fPoSCancel = false;
-                }
+        bool fCoinStake = false;
+        if (pkernel) {
+            // The kernel search was done by the caller
+            nCoinStakeTime = nKernelTime;
+            fCoinStake = pwallet->CreateCoinStake(*pwallet, pblock->nBits, *pkernel, nCoinStakeTime, txCoinStake, nPosReward);
+        } else {
+            nCoinStakeTime = GetAdjustedTime();
+            int64_t nSearchTime = nCoinStakeTime;
+            if (nSearchTime > nLastCoinStakeSearchTime) {
+                fCoinStake = pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, txCoinStake, nCoinStakeTime, nPosReward);
+                nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+                nLastCoinStakeSearchTime = nSearchTime;
             }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
+        }
+        if (fCoinStake && nCoinStakeTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME)) {
+            pblock->vtx.push_back(MakeTransactionRef(std::move(txCoinStake)));
+            fPoSCancel = false;
         }
         if (fPoSCancel)
             return nullptr;
@@ -503,6 +522,16 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+static void SetExtraNonce(CBlock* pblock, unsigned int nHeight, unsigned int nExtraNonce)
+{
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -514,123 +543,480 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(*pblock->vtx[0]);
-    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
-
-    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    SetExtraNonce(pblock, nHeight, nExtraNonce);
 }
 
-#ifdef ENABLE_WALLET
 //////////////////////////////////////////////////////////////////////////////
 //
-// Internal minter
+// Internal proof-of-work miner
 //
-void BitcoinMinter(CWallet *pwallet)
+
+namespace {
+
+/** Bumped on every tip change, telling the miner threads to rebuild their block */
+std::atomic<unsigned int> nMinerGeneration(0);
+
+class CMinerNotifier : public CValidationInterface
 {
-    LogPrintf("CPUMinter started for proof-of-stake");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("bitcoin-stake-minter");
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override {
+        ++nMinerGeneration;
+    }
+};
 
-    // Each thread has its own key and counter
-    CReserveKey reservekey(pwallet);
-    unsigned int nExtraNonce = 0;
+CMinerNotifier minerNotifier;
 
-    // Compute timeout for pos as sqrt(numUTXO)
-    unsigned int pos_timio;
-    {
-        std::vector<COutput> vCoins;
-        pwallet->AvailableCoins(vCoins, false);
-        pos_timio = gArgs.GetArg("-staketimio", 500) + 30 * sqrt(vCoins.size());
-        LogPrintf("Set proof-of-stake timeout: %ums for %u UTXOs\n", pos_timio, vCoins.size());
+CCriticalSection cs_minerThreads;
+boost::thread_group* minerThreads = nullptr;
+//! Miner threads running; a thread that stops on an error takes itself off without cs_minerThreads
+std::atomic<int> nMinerThreads(0);
+
+CCriticalSection cs_hashMeter;
+double dHashesPerSec = 0;
+int64_t nHashMeterStart = 0;
+uint64_t nHashMeterCount = 0;
+
+void UpdateHashMeter(uint64_t nHashes)
+{
+    LOCK(cs_hashMeter);
+    nHashMeterCount += nHashes;
+    int64_t nNow = GetTimeMillis();
+    if (nNow - nHashMeterStart >= 4000) {
+        dHashesPerSec = 1000.0 * nHashMeterCount / (nNow - nHashMeterStart);
+        nHashMeterStart = nNow;
+        nHashMeterCount = 0;
     }
+}
 
-    std::string strMintMessage = _("Info: Minting suspended due to locked wallet.");
+/** Hashes between checks for a new tip, a stale template and thread interruption */
+const unsigned int MINER_BATCH_SIZE = 0x100;
+
+void ProcessBlockFound(const CBlock* pblock, int nHeight, const CChainParams& chainparams)
+{
+    LogPrintf("TalerMiner: proof-of-work block found %s at height %d\n", pblock->GetHash().ToString(), nHeight);
+    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
+    if (nHeight >= chainparams.GetConsensus().TLRHeight) {
+        shared_pblock->SetNewFormatBlock();
+    }
+    if (!ProcessNewBlock(chainparams, shared_pblock, true, nullptr))
+        LogPrintf("TalerMiner: ProcessNewBlock, block not accepted\n");
+}
+
+/**
+ * One proof-of-work miner thread. Thread nThreadId of nThreads uses extranonces
+ * nThreadId, nThreadId + nThreads, ..., so every thread searches its own part of
+ * the (extranonce, nonce) space.
+ */
+void TalerMiner(const CChainParams& chainparams, std::shared_ptr<CReserveScript> coinbaseScript, int nThreadId, int nThreads)
+{
+    LogPrintf("TalerMiner %d started\n", nThreadId);
+    RenameThread("taler-miner");
+
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    std::vector<char> scratchpad(POW_SCRATCHPAD_SIZE);
+    unsigned int nExtraNonce = nThreadId;
+    uint256 hashPrevBlock;
 
     try {
         while (true) {
-            if (Params().MiningRequiresPeers()) {
+            if (chainparams.MiningRequiresPeers()) {
                 // Busy-wait for the network to come online so we don't waste time mining
                 // on an obsolete chain. In regtest mode we expect to fly solo.
-                do {
-                    size_t nodeCount = g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL);
-                    if (nodeCount != 0 && !IsInitialBlockDownload())
-                        break;
-                    MilliSleep(5000);
-                } while (true);
+                while (g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL) == 0 || IsInitialBlockDownload())
+                    MilliSleep(1000);
             }
 
-            while (pwallet->IsLocked())
+            //
+            // Create new block
+            //
+            unsigned int nGeneration = nMinerGeneration;
+            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(coinbaseScript->reserveScript));
+            if (!pblocktemplate.get())
+                throw std::runtime_error("CreateNewBlock returned no block template");
+            CBlock *pblock = &pblocktemplate->block;
+            const CBlockIndex* pindexPrev;
             {
-                strMintWarning = strMintMessage;
-                MilliSleep(5000);
+                LOCK(cs_main);
+                pindexPrev = mapBlockIndex.at(pblock->hashPrevBlock);
             }
-            strMintWarning = "";
+            const int nHeight = pindexPrev->nHeight + 1;
+            if (hashPrevBlock != pblock->hashPrevBlock) {
+                nExtraNonce = nThreadId;
+                hashPrevBlock = pblock->hashPrevBlock;
+            }
+            nExtraNonce += nThreads;
+            SetExtraNonce(pblock, nHeight, nExtraNonce);
 
             //
-            // Create new block
+            // Search
             //
-            CBlockIndex* pindexPrev = chainActive.Tip();
+            int64_t nStart = GetTime();
+            pblock->nNonce = 0;
+            while (true) {
+                bool fFound = false;
+                bool fExhausted = false;
+                unsigned int nHashes = 0;
+                while (nHashes < MINER_BATCH_SIZE) {
+                    uint256 hash = pblock->GetPoWHash(nHeight, consensusParams, scratchpad.data());
+                    ++nHashes;
+                    if (CheckProofOfWork(hash, nHeight, pblock->nBits, consensusParams)) {
+                        fFound = true;
+                        break;
+                    }
+                    if (++pblock->nNonce == 0) {
+                        fExhausted = true;
+                        break;
+                    }
+                }
+                UpdateHashMeter(nHashes);
 
-            bool fPoSCancel = false;  // fPoSCancel == true means that we failed to create coinstake and exited without going further (by returning NULL)
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewPoSBlock(fPoSCancel, pwallet));
-            if (fPoSCancel) {
-                MilliSleep(pos_timio);
-                continue;
+                if (fFound) {
+                    ProcessBlockFound(pblock, nHeight, chainparams);
+                    coinbaseScript->KeepScript();
+                    break;
+                }
+
+                // Check for stop or if block needs to be rebuilt
+                boost::this_thread::interruption_point();
+                if (fExhausted || nGeneration != nMinerGeneration)
+                    break;
+                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                    break;
+
+                // Update nTime every few seconds
+                if (UpdateTime(pblock, consensusParams, pindexPrev) < 0)
+                    break; // Recreate the block if the clock has run backwards
             }
+        }
+    }
+    catch (const boost::thread_interrupted&)
+    {
+        LogPrintf("TalerMiner %d terminated\n", nThreadId);
+        throw;
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("Error in TalerMiner %d, stopping it: %s\n", nThreadId, e.what());
+        --nMinerThreads;
+        return;
+    }
+}
 
-            if (!pblocktemplate.get())
-            {
-                LogPrintf("Error in BitcoinMinter. Minter stopped\n");
+} // namespace
+
+void GenerateTalers(bool fGenerate, int nThreads, const CChainParams& chainparams, std::shared_ptr<CReserveScript> coinbaseScript)
+{
+    LOCK(cs_minerThreads);
+
+    if (nThreads < 0)
+        nThreads = GetNumCores();
+
+    if (minerThreads != nullptr) {
+        minerThreads->interrupt_all();
+        minerThreads->join_all();
+        delete minerThreads;
+        minerThreads = nullptr;
+        nMinerThreads = 0;
+        UnregisterValidationInterface(&minerNotifier);
+    }
+
+    if (nThreads == 0 || !fGenerate)
+        return;
+
+    {
+        LOCK(cs_hashMeter);
+        dHashesPerSec = 0;
+        nHashMeterStart = GetTimeMillis();
+        nHashMeterCount = 0;
+    }
+    RegisterValidationInterface(&minerNotifier);
+    minerThreads = new boost::thread_group();
+    nMinerThreads = nThreads;
+    for (int i = 0; i < nThreads; i++)
+        minerThreads->create_thread(boost::bind(&TalerMiner, boost::cref(chainparams), coinbaseScript, i, nThreads));
+}
+
+int GetMinerThreads()
+{
+    return nMinerThreads;
+}
+
+double GetHashesPerSec()
+{
+    LOCK(cs_hashMeter);
+    return dHashesPerSec;
+}
+
+#ifdef ENABLE_WALLET
+//////////////////////////////////////////////////////////////////////////////
+//
+// Internal minter
+//
+
+// Sign and submit a proof-of-stake block found by the minter; false if the
+// wallet could not sign it
+static bool ProcessStakeFound(CBlock* pblock, CWallet* pwallet, const std::string& strMintMessage)
+{
+    if (!SignBlock(*pblock, *pwallet))
+    {
+        strMintWarning = strMintMessage;
+        return false;
+    }
+    strMintWarning = "";
+    LogPrintf("CPUMinter : proof-of-stake block found %s\n", pblock->GetHash().ToString());
+    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
+    if (!ProcessNewBlock(Params(), shared_pblock, true, nullptr))
+        LogPrintf("CPUMinter : ProcessNewBlock, block not accepted\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    return true;
+}
+
+// Wait for peers and for the wallet to be unlocked before minting
+static void WaitForMinting(CWallet* pwallet, const std::string& strMintMessage)
+{
+    if (Params().MiningRequiresPeers()) {
+        // Busy-wait for the network to come online so we don't waste time mining
+        // on an obsolete chain. In regtest mode we expect to fly solo.
+        do {
+            size_t nodeCount = g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL);
+            if (nodeCount != 0 && !IsInitialBlockDownload())
+                break;
+            MilliSleep(5000);
+        } while (true);
+    }
+
+    while (pwallet->IsLocked())
+    {
+        strMintWarning = strMintMessage;
+        MilliSleep(5000);
+    }
+    strMintWarning = "";
+}
+
+namespace {
+
+boost::mutex csStakeMinter;
+boost::condition_variable cvStakeMinter;
+/** Bumped on every tip change and scheduled kernel time, waking the minters up */
+uint64_t nStakeMinterWakeups = 0;
+
+void WakeStakeMinter()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csStakeMinter);
+        ++nStakeMinterWakeups;
+    }
+    cvStakeMinter.notify_all();
+}
+
+/** Wakes the stake minter up when the tip changes, as its kernel schedule is then stale */
+class CStakeMinterNotifier : public CValidationInterface
+{
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override {
+        if (!fInitialDownload)
+            WakeStakeMinter();
+    }
+};
+
+CStakeMinterNotifier stakeMinterNotifier;
+
+/** GetTimeMillis() of the wakeup pending on the scheduler, or 0 if there is none */
+int64_t nStakeMinterWakeupTime = 0;
+
+/**
+ * Have the scheduler wake the minter up at nTime (GetTimeMillis()). Only one
+ * wakeup is kept pending: a later one is dropped, and an earlier one takes
+ * its place, leaving the one it replaced to do nothing when it runs.
+ */
+void ScheduleStakeMinterWakeup(CScheduler& scheduler, int64_t nTime)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csStakeMinter);
+        if (nStakeMinterWakeupTime != 0 && nStakeMinterWakeupTime <= nTime)
+            return;
+        nStakeMinterWakeupTime = nTime;
+    }
+    scheduler.scheduleFromNow([nTime]() {
+        {
+            boost::unique_lock<boost::mutex> lock(csStakeMinter);
+            if (nStakeMinterWakeupTime != nTime)
                 return;
-            }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+            nStakeMinterWakeupTime = 0;
+            ++nStakeMinterWakeups;
+        }
+        cvStakeMinter.notify_all();
+    }, std::max<int64_t>(nTime - GetTimeMillis(), 0));
+}
 
-            // if proof-of-stake block found then process block
-            if (pblock->IsProofOfStake())
+/**
+ * Sleep until WakeStakeMinter() is called or nTimeout milliseconds have
+ * passed. nWakeupsSeen is the wakeup count the caller last saw, so a wakeup
+ * that came while it was busy returns at once.
+ */
+void WaitForStakeMinterWakeup(uint64_t& nWakeupsSeen, int64_t nTimeout)
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    const boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(nTimeout);
+    while (nStakeMinterWakeups == nWakeupsSeen) {
+        if (cvStakeMinter.wait_until(lock, deadline) == boost::cv_status::timeout)
+            break;
+    }
+    nWakeupsSeen = nStakeMinterWakeups;
+}
+
+/** The stake candidates one -stakethreads worker searches, and the earliest kernels it found among them */
+struct StakeShard
+{
+    std::vector<CStakeKernelCandidate> vCandidates;
+    std::vector<CStakeKernelHit> vHits;
+};
+
+void ScheduleStakeShard(StakeShard* shard, const CBlockIndex* pindexTip, unsigned int nBits, uint32_t nTime, unsigned int nSearchInterval)
+{
+    GetStakeKernelSchedule(pindexTip, nBits, shard->vCandidates, nTime, nSearchInterval, shard->vHits);
+}
+
+/** A kernel of the schedule, to be minted once its timestamp has come */
+struct ScheduledKernel
+{
+    CStakeKernelCandidate kernel;
+    uint32_t nTime;
+    uint256 hashProofOfStake;
+};
+
+/**
+ * Event-driven minter. Kernels only depend on the stake modifiers and the
+ * target, which are fixed by the tip, so for each new tip the earliest
+ * timestamp every stake candidate meets the target at over the next
+ * STAKE_SCHEDULE_INTERVAL seconds is computed once, on -stakethreads threads
+ * and without holding cs_main or cs_wallet. The minter then sleeps until the
+ * first of these timestamps, a new tip or the end of the schedule, with a
+ * single wakeup pending on the scheduler, and only assembles a block when a
+ * kernel is known to be due.
+ */
+void ScheduledMinter(CWallet* pwallet, CScheduler& scheduler, int nThreads)
+{
+    LogPrintf("CPUMinter started for proof-of-stake with %d schedule threads\n", nThreads);
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("bitcoin-stake-minter");
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::string strMintMessage = _("Info: Minting suspended due to locked wallet.");
+
+    unsigned int nExtraNonce = 0;
+    std::vector<StakeShard> vShards(nThreads);
+    std::vector<ScheduledKernel> vSchedule;
+    size_t nNextKernel = 0;
+    const CBlockIndex* pindexSchedule = nullptr;
+    int64_t nScheduleEnd = 0;
+    uint64_t nWakeupsSeen = 0;
+
+    try {
+        while (true) {
+            WaitForMinting(pwallet, strMintMessage);
+
+            const CBlockIndex* pindexPrev;
+            unsigned int nBits = 0;
             {
-                if (!SignBlock(*pblock, *pwallet))
-                {
-                    strMintWarning = strMintMessage;
-                    continue;
+                LOCK(cs_main);
+                pindexPrev = chainActive.Tip();
+                CBlockHeader header;
+                header.SetProofOfStake();
+                nBits = GetNextWorkRequired(pindexPrev, &header, consensusParams, true);
+            }
+            if (pindexPrev->nHeight + 1 <= consensusParams.TLRHeight + consensusParams.TLRInitLim) {
+                WaitForStakeMinterWakeup(nWakeupsSeen, STAKE_SCHEDULE_INTERVAL * 1000);
+                continue;
+            }
+
+            int64_t nNow = GetAdjustedTime();
+            if (pindexPrev != pindexSchedule || nNow >= nScheduleEnd) {
+                std::vector<CStakeKernelCandidate> vCandidates;
+                pwallet->GetStakeCandidates(nNow + STAKE_SCHEDULE_INTERVAL - 1, vCandidates);
+                for (StakeShard& shard : vShards)
+                    shard.vCandidates.clear();
+                for (size_t i = 0; i < vCandidates.size(); i++)
+                    vShards[i % nThreads].vCandidates.push_back(vCandidates[i]);
+
+                std::vector<std::thread> workers;
+                for (int i = 1; i < nThreads; i++)
+                    workers.emplace_back(ScheduleStakeShard, &vShards[i], pindexPrev, nBits, nNow, STAKE_SCHEDULE_INTERVAL);
+                ScheduleStakeShard(&vShards[0], pindexPrev, nBits, nNow, STAKE_SCHEDULE_INTERVAL);
+                for (std::thread& worker : workers)
+                    worker.join();
+
+                vSchedule.clear();
+                for (const StakeShard& shard : vShards) {
+                    for (const CStakeKernelHit& hit : shard.vHits)
+                        vSchedule.push_back(ScheduledKernel{shard.vCandidates[hit.nCandidate], hit.nTimeTx, hit.hashProofOfStake});
                 }
-                strMintWarning = "";
-                LogPrintf("CPUMinter : proof-of-stake block found %s\n", pblock->GetHash().ToString());
-                SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
-                if (ProcessNewBlock(Params(), shared_pblock, true, nullptr)) {
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                    // Rest for ~3 minutes after successful block to preserve close quick
-                    MilliSleep(60 * 1000 + GetRand(4 * 60 * 1000));
-                } else {
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                std::stable_sort(vSchedule.begin(), vSchedule.end(), [](const ScheduledKernel& a, const ScheduledKernel& b) {
+                    return a.nTime < b.nTime;
+                });
+                nNextKernel = 0;
+                pindexSchedule = pindexPrev;
+                nScheduleEnd = nNow + STAKE_SCHEDULE_INTERVAL;
+                nLastCoinStakeSearchInterval = STAKE_SCHEDULE_INTERVAL;
+                LogPrint(BCLog::COINSTAKE, "ScheduledMinter : %u kernels among %u stake candidates at height %d\n", vSchedule.size(), vCandidates.size(), pindexPrev->nHeight);
+            }
+
+            // Mint the first due kernel that still makes a valid coinstake
+            while (nNextKernel < vSchedule.size() && vSchedule[nNextKernel].nTime <= GetAdjustedTime()) {
+                const ScheduledKernel& next = vSchedule[nNextKernel++];
+                LogPrint(BCLog::COINSTAKE, "ScheduledMinter : kernel due at %u, hashProof=%s\n", next.nTime, next.hashProofOfStake.ToString());
+
+                bool fPoSCancel = false;
+                std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewPoSBlock(fPoSCancel, pwallet, next.kernel, next.nTime));
+                if (fPoSCancel)
+                    continue; // spent or stale kernel
+                if (!pblocktemplate.get())
+                {
+                    LogPrintf("Error in ScheduledMinter. Minter stopped\n");
+                    return;
                 }
+                CBlock *pblock = &pblocktemplate->block;
+                IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+                ProcessStakeFound(pblock, pwallet, strMintMessage);
+                break;
+            }
+
+            // Sleep until the next kernel is due, the schedule runs out or the tip changes
+            nNow = GetAdjustedTime();
+            int64_t nWakeup = nScheduleEnd;
+            if (nNextKernel < vSchedule.size())
+                nWakeup = std::min<int64_t>(nWakeup, vSchedule[nNextKernel].nTime);
+            if (nWakeup > nNow) {
+                ScheduleStakeMinterWakeup(scheduler, GetTimeMillis() + (nWakeup - nNow) * 1000);
+                WaitForStakeMinterWakeup(nWakeupsSeen, STAKE_SCHEDULE_INTERVAL * 1000);
             }
-            MilliSleep(pos_timio);
+            boost::this_thread::interruption_point();
         }
     }
-    catch (boost::thread_interrupted)
+    catch (const boost::thread_interrupted&)
     {
-        LogPrintf("BitcoinMinter terminated\n");
+        LogPrintf("ScheduledMinter terminated\n");
         return;
     }
     catch (const std::runtime_error &e)
     {
-        LogPrintf("BitcoinMinter runtime error: %s\n", e.what());
+        LogPrintf("ScheduledMinter runtime error: %s\n", e.what());
         return;
     }
 }
 
+} // namespace
+
 // pos: stake minter thread
-void static ThreadStakeMinter(void* parg)
+void static ThreadStakeMinter(CWallet* pwallet, CScheduler* pscheduler)
 {
     LogPrintf("ThreadStakeMinter started\n");
-    CWallet* pwallet = (CWallet*)parg;
     try
     {
-        BitcoinMinter(pwallet);
+        const int nStakeThreads = gArgs.GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+        ScheduledMinter(pwallet, *pscheduler, std::max(nStakeThreads, 1));
     }
     catch (std::exception& e) {
         PrintExceptionContinue(&e, "ThreadStakeMinter()");
@@ -641,10 +1027,13 @@ void static ThreadStakeMinter(void* parg)
 }
 
 // pos: stake minter
-void MintStake(boost::thread_group& threadGroup, CWallet* pwallet)
+void MintStake(boost::thread_group& threadGroup, CScheduler& scheduler, CWallet* pwallet)
 {
+    static std::once_flag registered;
+    std::call_once(registered, []() { RegisterValidationInterface(&stakeMinterNotifier); });
+
     //mint proof-of-stake blocks in the background
-    threadGroup.create_thread(boost::bind(&ThreadStakeMinter, pwallet));
+    threadGroup.create_thread(boost::bind(&ThreadStakeMinter, pwallet, &scheduler));
 }
 
 #endif // ENABLE_WALLET
@@ -16,8 +16,11 @@
 
 class CBlockIndex;
 class CChainParams;
+class CReserveScript;
+class CScheduler;
 class CScript;
 class CWallet;
+struct CStakeKernelCandidate;
 
 namespace Consensus { struct Params; };
 
@@ -26,6 +29,10 @@ namespace boost {
 } // namespace boost
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -stakethreads: compute the kernel schedule in the minter thread */
+static const int DEFAULT_STAKE_THREADS = 0;
+/** Seconds ahead the stake minter computes the earliest kernel of each coin for */
+static const unsigned int STAKE_SCHEDULE_INTERVAL = 300;
 
 struct CBlockTemplate
 {
@@ -165,7 +172,9 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
     std::unique_ptr<CBlockTemplate> CreateNewPoSBlock(bool& fPoSCancel, CWallet* pwallet, bool fMineWitnessTx=true);
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fProofOfStake, bool& fPoSCancel, CWallet* pwallet);
+    /** Construct a new proof-of-stake block template around a kernel found among pwallet->GetStakeCandidates() at nKernelTime */
+    std::unique_ptr<CBlockTemplate> CreateNewPoSBlock(bool& fPoSCancel, CWallet* pwallet, const CStakeKernelCandidate& kernel, uint32_t nKernelTime, bool fMineWitnessTx=true);
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fProofOfStake, bool& fPoSCancel, CWallet* pwallet, const CStakeKernelCandidate* pkernel=nullptr, uint32_t nKernelTime=0);
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -204,6 +213,14 @@ private:
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
-void MintStake(boost::thread_group& threadGroup, CWallet* pwallet);
+/** Start a proof-of-stake minter for pwallet, woken up through scheduler when its kernels are due */
+void MintStake(boost::thread_group& threadGroup, CScheduler& scheduler, CWallet* pwallet);
+
+/** Start nThreads proof-of-work miner threads paying to coinbaseScript (nThreads < 0: one per core), or stop them */
+void GenerateTalers(bool fGenerate, int nThreads, const CChainParams& chainparams, std::shared_ptr<CReserveScript> coinbaseScript);
+/** Number of running proof-of-work miner threads */
+int GetMinerThreads();
+/** Recent hash rate of the proof-of-work miner, summed over all threads */
+double GetHashesPerSec();
 
 #endif // BITCOIN_MINER_H
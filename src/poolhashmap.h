@@ -0,0 +1,380 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POOLHASHMAP_H
+#define BITCOIN_POOLHASHMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with open addressing over a flat table of pointers to elements
+ *  allocated from a pool.
+ *
+ *  The table holds one pointer and one control byte per slot: EMPTY,
+ *  DELETED, or the low 7 bits of the hash of the key in the slot. An element
+ *  is found by linear probing from the slot its hash designates, comparing
+ *  only the keys whose control byte matches. Erased slots become DELETED
+ *  tombstones, so that erasing never moves other elements and an iterator
+ *  stays valid when another element is erased, as with std::unordered_map.
+ *  Tombstones are purged when the table is rehashed.
+ *
+ *  Elements are constructed in chunks of nodes the map allocates, and never
+ *  move: pointers and references to elements stay valid until they are
+ *  erased, even when the table is rehashed (which invalidates iterators).
+ *  Erased nodes are reused by later insertions. clear() destroys the
+ *  elements and frees every chunk and the table at once, rather than
+ *  freeing one node per element.
+ */
+template <typename Key, typename T, typename Hash>
+class PoolHashMap
+{
+public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<const Key, T> value_type;
+    typedef Hash hasher;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type& reference;
+    typedef const value_type& const_reference;
+
+private:
+    static const uint8_t EMPTY = 0x80;
+    static const uint8_t DELETED = 0xfe;
+    static const size_t NOT_FOUND = (size_t)-1;
+    static const size_t MIN_CAPACITY = 16;
+    static const size_t MIN_CHUNK_NODES = 16;
+    static const size_t MAX_CHUNK_NODES = 4096;
+
+    union Node {
+        Node* next;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+    };
+
+    Hash m_hash;
+    uint8_t* m_ctrl;        //!< capacity control bytes, or nullptr
+    value_type** m_slots;   //!< capacity slots, or nullptr
+    size_t m_capacity;      //!< 0 or a power of two, at least MIN_CAPACITY
+    size_t m_size;
+    size_t m_used;          //!< slots that are not EMPTY: elements and tombstones
+
+    std::vector<std::pair<Node*, size_t> > m_chunks;
+    Node* m_free;           //!< list of erased nodes
+    Node* m_bump;           //!< next never used node of the last chunk
+    Node* m_bump_end;
+    size_t m_pool_bytes;
+
+    static bool IsFull(uint8_t ctrl) { return !(ctrl & 0x80); }
+    static uint8_t Fingerprint(size_t hash) { return hash & 0x7f; }
+    size_t Home(size_t hash) const { return (hash >> 7) & (m_capacity - 1); }
+
+    /** At most 3/4 of the slots are used, which keeps probe sequences short */
+    static size_t MaxLoad(size_t capacity) { return capacity - capacity / 4; }
+
+    template <typename... Args>
+    value_type* NewNode(Args&&... args)
+    {
+        Node* node;
+        if (m_free) {
+            node = m_free;
+            m_free = node->next;
+        } else {
+            if (m_bump == m_bump_end) {
+                const size_t nNodes = std::min(size_t(MIN_CHUNK_NODES) << std::min(m_chunks.size(), size_t(16)), size_t(MAX_CHUNK_NODES));
+                m_chunks.reserve(m_chunks.size() + 1);
+                m_bump = static_cast<Node*>(::operator new(nNodes * sizeof(Node)));
+                m_bump_end = m_bump + nNodes;
+                m_chunks.emplace_back(m_bump, nNodes);
+                m_pool_bytes += nNodes * sizeof(Node);
+            }
+            node = m_bump++;
+        }
+        try {
+            return new (&node->storage) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            node->next = m_free;
+            m_free = node;
+            throw;
+        }
+    }
+
+    void DeleteNode(value_type* p)
+    {
+        p->~value_type();
+        Node* node = reinterpret_cast<Node*>(p);
+        node->next = m_free;
+        m_free = node;
+    }
+
+    /** Slot holding key, or NOT_FOUND. If not found and pInsert is given, set it to the slot key would be inserted in. */
+    size_t FindSlot(const Key& key, size_t hash, size_t* pInsert = nullptr) const
+    {
+        if (m_capacity == 0)
+            return NOT_FOUND;
+        const uint8_t fingerprint = Fingerprint(hash);
+        size_t deleted = NOT_FOUND;
+        for (size_t i = Home(hash); ; i = (i + 1) & (m_capacity - 1)) {
+            const uint8_t ctrl = m_ctrl[i];
+            if (ctrl == fingerprint && m_slots[i]->first == key)
+                return i;
+            if (ctrl == EMPTY) {
+                if (pInsert)
+                    *pInsert = deleted != NOT_FOUND ? deleted : i;
+                return NOT_FOUND;
+            }
+            if (ctrl == DELETED && deleted == NOT_FOUND)
+                deleted = i;
+        }
+    }
+
+    void Rehash(size_t capacity)
+    {
+        uint8_t* ctrl = m_ctrl;
+        value_type** slots = m_slots;
+        const size_t nOldCapacity = m_capacity;
+
+        m_ctrl = new uint8_t[capacity];
+        memset(m_ctrl, EMPTY, capacity);
+        m_slots = new value_type*[capacity];
+        m_capacity = capacity;
+        for (size_t i = 0; i < nOldCapacity; i++) {
+            if (!IsFull(ctrl[i]))
+                continue;
+            size_t j = Home(m_hash(slots[i]->first));
+            while (m_ctrl[j] != EMPTY)
+                j = (j + 1) & (m_capacity - 1);
+            m_ctrl[j] = ctrl[i];
+            m_slots[j] = slots[i];
+        }
+        m_used = m_size;
+
+        delete[] ctrl;
+        delete[] slots;
+    }
+
+    template <typename Map, typename Value>
+    class iterator_base
+    {
+        Map* m_map;
+        size_t m_pos;
+
+        void SkipEmpty()
+        {
+            while (m_pos < m_map->m_capacity && !IsFull(m_map->m_ctrl[m_pos]))
+                m_pos++;
+        }
+
+        friend class PoolHashMap;
+        template <typename, typename> friend class iterator_base;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename PoolHashMap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef Value* pointer;
+        typedef Value& reference;
+
+        iterator_base() : m_map(nullptr), m_pos(0) {}
+        iterator_base(Map* map, size_t pos) : m_map(map), m_pos(pos) { SkipEmpty(); }
+        template <typename OtherMap, typename OtherValue>
+        iterator_base(const iterator_base<OtherMap, OtherValue>& other) : m_map(other.m_map), m_pos(other.m_pos) {}
+
+        reference operator*() const { return *m_map->m_slots[m_pos]; }
+        pointer operator->() const { return m_map->m_slots[m_pos]; }
+        iterator_base& operator++() { m_pos++; SkipEmpty(); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++*this; return copy; }
+        template <typename OtherMap, typename OtherValue>
+        bool operator==(const iterator_base<OtherMap, OtherValue>& other) const { return m_pos == other.m_pos; }
+        template <typename OtherMap, typename OtherValue>
+        bool operator!=(const iterator_base<OtherMap, OtherValue>& other) const { return m_pos != other.m_pos; }
+    };
+
+public:
+    typedef iterator_base<PoolHashMap, value_type> iterator;
+    typedef iterator_base<const PoolHashMap, const value_type> const_iterator;
+
+    explicit PoolHashMap(const Hash& hash = Hash()) :
+        m_hash(hash), m_ctrl(nullptr), m_slots(nullptr), m_capacity(0), m_size(0), m_used(0),
+        m_free(nullptr), m_bump(nullptr), m_bump_end(nullptr), m_pool_bytes(0) {}
+
+    PoolHashMap(const PoolHashMap&) = delete;
+    PoolHashMap& operator=(const PoolHashMap&) = delete;
+
+    PoolHashMap(PoolHashMap&& other) noexcept : PoolHashMap(other.m_hash) { swap(other); }
+
+    PoolHashMap& operator=(PoolHashMap&& other) noexcept
+    {
+        PoolHashMap tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    ~PoolHashMap() { clear(); }
+
+    void swap(PoolHashMap& other) noexcept
+    {
+        using std::swap;
+        swap(m_hash, other.m_hash);
+        swap(m_ctrl, other.m_ctrl);
+        swap(m_slots, other.m_slots);
+        swap(m_capacity, other.m_capacity);
+        swap(m_size, other.m_size);
+        swap(m_used, other.m_used);
+        m_chunks.swap(other.m_chunks);
+        swap(m_free, other.m_free);
+        swap(m_bump, other.m_bump);
+        swap(m_bump_end, other.m_bump_end);
+        swap(m_pool_bytes, other.m_pool_bytes);
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    /** Number of slots */
+    size_t bucket_count() const { return m_capacity; }
+
+    /** Bytes allocated on the heap: the table and the chunks of nodes, erased nodes included */
+    size_t memory_usage() const { return m_capacity * (sizeof(uint8_t) + sizeof(value_type*)) + m_pool_bytes; }
+
+    /** Destroy every element and free all the memory of the map */
+    void clear()
+    {
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (IsFull(m_ctrl[i]))
+                m_slots[i]->~value_type();
+        }
+        delete[] m_ctrl;
+        delete[] m_slots;
+        m_ctrl = nullptr;
+        m_slots = nullptr;
+        m_capacity = 0;
+        m_size = 0;
+        m_used = 0;
+
+        for (const std::pair<Node*, size_t>& chunk : m_chunks)
+            ::operator delete(chunk.first);
+        m_chunks.clear();
+        m_free = nullptr;
+        m_bump = nullptr;
+        m_bump_end = nullptr;
+        m_pool_bytes = 0;
+    }
+
+    /** Make room for n elements without rehashing */
+    void reserve(size_t n)
+    {
+        size_t capacity = std::max(m_capacity, size_t(MIN_CAPACITY));
+        while (MaxLoad(capacity) < n)
+            capacity *= 2;
+        if (capacity != m_capacity)
+            Rehash(capacity);
+    }
+
+    iterator find(const Key& key)
+    {
+        const size_t i = FindSlot(key, m_hash(key));
+        return i == NOT_FOUND ? end() : iterator(this, i);
+    }
+
+    const_iterator find(const Key& key) const
+    {
+        const size_t i = FindSlot(key, m_hash(key));
+        return i == NOT_FOUND ? end() : const_iterator(this, i);
+    }
+
+    size_t count(const Key& key) const { return FindSlot(key, m_hash(key)) != NOT_FOUND; }
+
+    T& at(const Key& key)
+    {
+        const size_t i = FindSlot(key, m_hash(key));
+        if (i == NOT_FOUND)
+            throw std::out_of_range("PoolHashMap::at");
+        return m_slots[i]->second;
+    }
+
+    const T& at(const Key& key) const
+    {
+        const size_t i = FindSlot(key, m_hash(key));
+        if (i == NOT_FOUND)
+            throw std::out_of_range("PoolHashMap::at");
+        return m_slots[i]->second;
+    }
+
+    T& operator[](const Key& key) { return emplace(key).first->second; }
+
+    /** Insert an element with key and a T constructed from args, unless key is already in the map */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(const Key& key, Args&&... args)
+    {
+        const size_t hash = m_hash(key);
+        size_t i = NOT_FOUND;
+        const size_t found = FindSlot(key, hash, &i);
+        if (found != NOT_FOUND)
+            return std::make_pair(iterator(this, found), false);
+        if (m_capacity == 0 || (m_ctrl[i] == EMPTY && m_used + 1 > MaxLoad(m_capacity))) {
+            // Double the table, or only purge its tombstones if they take
+            // most of the room
+            Rehash(m_capacity == 0 ? MIN_CAPACITY : m_size + 1 > MaxLoad(m_capacity) / 2 ? 2 * m_capacity : m_capacity);
+            FindSlot(key, hash, &i);
+        }
+        value_type* p = NewNode(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        if (m_ctrl[i] == EMPTY)
+            m_used++;
+        m_ctrl[i] = Fingerprint(hash);
+        m_slots[i] = p;
+        m_size++;
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) { return emplace(value.first, value.second); }
+
+    template <typename P>
+    std::pair<iterator, bool> insert(P&& value) { return emplace(value.first, std::forward<P>(value).second); }
+
+    /** Erase the element at pos. Other iterators, pointers and references stay valid. Returns the iterator following pos. */
+    iterator erase(const_iterator pos)
+    {
+        const size_t i = pos.m_pos;
+        assert(IsFull(m_ctrl[i]));
+        DeleteNode(m_slots[i]);
+        // No probe sequence goes past an EMPTY slot, so the slot can be
+        // EMPTY rather than a tombstone if the next one is
+        if (m_ctrl[(i + 1) & (m_capacity - 1)] == EMPTY) {
+            m_ctrl[i] = EMPTY;
+            m_used--;
+        } else {
+            m_ctrl[i] = DELETED;
+        }
+        m_size--;
+        return iterator(this, i + 1);
+    }
+
+    size_t erase(const Key& key)
+    {
+        const size_t i = FindSlot(key, m_hash(key));
+        if (i == NOT_FOUND)
+            return 0;
+        erase(const_iterator(this, i));
+        return 1;
+    }
+};
+
+#endif // BITCOIN_POOLHASHMAP_H
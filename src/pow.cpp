@@ -14,18 +14,28 @@
 const CBlockIndex *GetLastBlockIndex(const CBlockIndex *pindex, const Consensus::Params &params, bool fProofOfStake) {
     const int32_t TLRHeight = params.TLRHeight;
 
-    if (fProofOfStake) {
-        while (pindex && pindex->pprev && !pindex->IsProofOfStake()) {
-            if (pindex->nHeight <= TLRHeight)
+    if (!pindex || !pindex->pprev || pindex->IsProofOfStake() == fProofOfStake)
+        return pindex;
+
+    // Jump to the closest block of the requested type. The predecessor
+    // pointers are only missing when there is no such block or when
+    // BuildSkip() was not called, in which case walk back as usual.
+    const CBlockIndex *pindexLast = fProofOfStake ? pindex->pprevPoS : pindex->pprevPoW;
+    if (!pindexLast) {
+        while (pindex->pprev && pindex->IsProofOfStake() != fProofOfStake) {
+            if (fProofOfStake && pindex->nHeight <= TLRHeight)
                 return nullptr;
             pindex = pindex->pprev;
         }
-    } else {
-        while (pindex && pindex->pprev && pindex->IsProofOfStake())
-            pindex = pindex->pprev;
+        return pindex;
     }
 
-    return pindex;
+    // The walk stops at blocks of other types at or below TLRHeight when
+    // looking for a proof-of-stake block
+    if (fProofOfStake && pindexLast->nHeight + 1 <= TLRHeight)
+        return nullptr;
+
+    return pindexLast;
 }
 
 uint32_t GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlockHeader *pblock, const Consensus::Params &params,
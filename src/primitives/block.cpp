@@ -38,6 +38,20 @@ uint256 CBlockHeader::GetPoWHash(int nHeight, const Consensus::Params& params) c
     return thash;
 }
 
+static_assert(POW_SCRATCHPAD_SIZE >= SCRYPT_SCRATCHPAD_SIZE && POW_SCRATCHPAD_SIZE >= LYRA2Z_SCRATCHPAD_SIZE, "POW_SCRATCHPAD_SIZE too small");
+
+uint256 CBlockHeader::GetPoWHash(int nHeight, const Consensus::Params& params, char* scratchpad) const
+{
+    uint256 thash;
+
+    if (nHeight >= params.nLyra2ZHeight)
+        lyra2z_hash_sp(BEGIN(nVersion), BEGIN(thash), scratchpad);
+    else
+        scrypt_1024_1_1_256_sp(BEGIN(nVersion), BEGIN(thash), scratchpad);
+
+    return thash;
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
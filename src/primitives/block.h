@@ -23,6 +23,9 @@ enum
     BLOCK_NEW_FORMAT = (1 << 31), // postfork block format
 };
 
+/** Size of the scratchpad CBlockHeader::GetPoWHash needs: the larger of scrypt's and Lyra2Z's */
+static const size_t POW_SCRATCHPAD_SIZE = 131072 + 63;
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -89,6 +92,8 @@ public:
     uint256 GetHash() const;
 
     uint256 GetPoWHash(int nHeight, const Consensus::Params& params) const;
+    /** Same as above, hashing in a caller-provided scratchpad of at least POW_SCRATCHPAD_SIZE bytes */
+    uint256 GetPoWHash(int nHeight, const Consensus::Params& params, char* scratchpad) const;
 
     int64_t GetBlockTime() const
     {
@@ -10,6 +10,7 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <consensus/params.h>
 #include <validation.h>
@@ -25,6 +26,8 @@
 #include <util.h>
 #include <utilstrencodings.h>
 #include <hash.h>
+#include <kernel.h>
+#include <utxosnapshot.h>
 #include <validationinterface.h>
 #include <warnings.h>
 #include <miner.h>
@@ -834,13 +837,14 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nBogoSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     uint64_t nDiskSize;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
 };
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, CCoinsSetStats& setstats, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
     assert(!outputs.empty());
     ss << hash;
@@ -850,6 +854,7 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
         ss << VARINT(output.first + 1);
         ss << output.second.out.scriptPubKey;
         ss << VARINT(output.second.out.nValue);
+        setstats.AddCoin(COutPoint(hash, output.first), output.second);
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
         stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
@@ -858,8 +863,8 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
     ss << VARINT(0);
 }
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Calculate statistics about the unspent transaction output set, and the running statistics it would have
+static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, CCoinsSetStats &setstats)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
@@ -871,6 +876,7 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
+    setstats.hashBlock = stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
@@ -879,7 +885,7 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, ss, setstats, prevkey, outputs);
                 outputs.clear();
             }
             prevkey = key.hash;
@@ -890,9 +896,10 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, ss, setstats, prevkey, outputs);
     }
     stats.hashSerialized = ss.GetHash();
+    stats.hashMuHash = setstats.GetHash();
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
@@ -948,43 +955,78 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "With the default hash_type the set is scanned in full, which may take some time.\n"
+            "With hash_type \"muhash\" the statistics kept up to date as blocks are connected are returned at once.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"hash_serialized_2\") Which UTXO set hash to return: \"hash_serialized_2\" or \"muhash\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (not with hash_type \"muhash\")\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (not with hash_type \"muhash\")\n"
+            "  \"muhash\": \"hash\",      (string) The rolling hash of the set, which does not depend on the order of the outputs\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    const std::string hash_type = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
+    if (hash_type != "muhash" && hash_type != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type: " + hash_type);
+    const bool fScan = hash_type == "hash_serialized_2";
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("disk_size", stats.nDiskSize));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    std::unique_ptr<CCoinsSetStats> setstats;
+    if (!fScan) {
+        LOCK(cs_main);
+        if (pcoinsStats) {
+            setstats.reset(new CCoinsSetStats(*pcoinsStats));
+            stats.hashBlock = setstats->hashBlock;
+            stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+            stats.nTransactionOutputs = setstats->nTransactionOutputs;
+            stats.nBogoSize = setstats->nBogoSize;
+            stats.nTotalAmount = setstats->nTotalAmount;
+            stats.nDiskSize = pcoinsdbview->EstimateSize();
+        }
+    }
+    if (setstats) {
+        // Finalizing takes a modular inversion, so it is done outside of cs_main
+        stats.hashMuHash = setstats->GetHash();
     } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        // Scan the coins, which also gives the running statistics to a node that does not have them yet
+        setstats.reset(new CCoinsSetStats());
+        FlushStateToDisk();
+        if (!GetUTXOStats(pcoinsdbview.get(), stats, *setstats))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        LOCK(cs_main);
+        if (!pcoinsStats && setstats->hashBlock == pcoinsTip->GetBestBlock())
+            pcoinsStats = std::move(setstats);
     }
+
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    if (fScan)
+        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+    if (fScan)
+        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+    ret.push_back(Pair("disk_size", stats.nDiskSize));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     return ret;
 }
 
@@ -1637,6 +1679,166 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static void WriteSnapshotTx(CSnapshotChunkWriter& writer, CCoinsSetStats& setstats, const CBlockIndex* pindexBase, const uint256& hash, std::map<uint32_t, Coin>& outputs)
+{
+    CSnapshotTx tx;
+    tx.txid = hash;
+    // Stake kernels that spend the coins find the transaction by its offset in its block
+    const int nHeight = outputs.begin()->second.nHeight;
+    if (!GetStakeTxOffset(pindexBase->GetAncestor(nHeight), hash, tx.nTxOffset))
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Cannot find transaction %s in block %d", hash.ToString(), nHeight));
+    for (auto& output : outputs) {
+        setstats.AddCoin(COutPoint(hash, output.first), output.second);
+        tx.vCoins.emplace_back(output.first, std::move(output.second));
+    }
+    writer << tx;
+}
+
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set of the tip to a file, which a new node can be started from\n"
+            "with loadtxoutset or -loadsnapshot instead of connecting every block. Loading it takes the base_hash\n"
+            "and muhash this returns.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, either absolute or relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,     (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hash\",    (string) The hash of the block the coins are of\n"
+            "  \"base_height\": n,       (numeric) The height of that block\n"
+            "  \"path\": \"path\",         (string) The absolute path of the file\n"
+            "  \"muhash\": \"hash\"        (string) The hash of the coins, as gettxoutsetinfo returns it\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    // The file only gets its name once it is complete
+    const fs::path temppath = path.string() + ".incomplete";
+    CAutoFile fileout(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open " + temppath.string() + " for writing");
+
+    const CBlockIndex* pindexBase;
+    CCoinsSetStats setstats;
+    uint64_t nCoins = 0;
+    try {
+        std::unique_ptr<CCoinsViewCursor> pcursor;
+        {
+            LOCK(cs_main);
+            // With the coins flushed, the cursor sees the set of the tip, and keeps seeing it
+            FlushStateToDisk();
+            pcursor.reset(pcoinsdbview->Cursor());
+            pindexBase = chainActive.Tip();
+            if (pindexBase->nHeight == 0 || pcursor->GetBestBlock() != pindexBase->GetBlockHash())
+                throw JSONRPCError(RPC_MISC_ERROR, "The UTXO set has no blocks to dump");
+
+            fileout << CSnapshotHeader(Params().MessageStart(), pindexBase->GetBlockHash(), pindexBase->nHeight);
+            CSnapshotChunkWriter blocks(fileout);
+            for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++)
+                blocks << CSnapshotBlock(*chainActive[nHeight]);
+            blocks.Finish();
+        }
+
+        CSnapshotChunkWriter coins(fileout);
+        uint256 prevkey;
+        std::map<uint32_t, Coin> outputs;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            if (!outputs.empty() && key.hash != prevkey) {
+                WriteSnapshotTx(coins, setstats, pindexBase, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            nCoins++;
+            pcursor->Next();
+        }
+        if (!outputs.empty())
+            WriteSnapshotTx(coins, setstats, pindexBase, prevkey, outputs);
+        coins.Finish();
+
+        CSnapshotFooter footer;
+        footer.nCoins = nCoins;
+        footer.hashMuHash = setstats.GetHash();
+        fileout << footer;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(temppath, path))
+            throw JSONRPCError(RPC_MISC_ERROR, "Cannot rename " + temppath.string() + " to " + path.string());
+    } catch (...) {
+        fileout.fclose();
+        fs::remove(temppath);
+        throw;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", nCoins));
+    ret.push_back(Pair("base_hash", pindexBase->GetBlockHash().GetHex()));
+    ret.push_back(Pair("base_height", pindexBase->nHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("muhash", setstats.GetHash().GetHex()));
+    return ret;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 3)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" \"base_hash\" \"muhash\"\n"
+            "\nMakes the block of a file written by dumptxoutset the tip, with its unspent transaction output set.\n"
+            "The node must run with -prune and must not have any blocks yet. The file is checked in full first,\n"
+            "but the coins in it cannot prove themselves: they must be of the block and have the muhash that\n"
+            "dumptxoutset returned on a node you trust.\n"
+            "\nArguments:\n"
+            "1. \"path\"         (string, required) The file to load, either absolute or relative to the data directory\n"
+            "2. \"base_hash\"    (string, required) The hash of the block the coins must be of\n"
+            "3. \"muhash\"       (string, required) The muhash the coins must have\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,      (numeric) The number of coins loaded\n"
+            "  \"base_hash\": \"hash\",    (string) The hash of the block the coins are of\n"
+            "  \"base_height\": n,       (numeric) The height of that block\n"
+            "  \"muhash\": \"hash\"        (string) The hash of the coins, as gettxoutsetinfo returns it\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"d8c8e1bb3a4c8bd7f7d1f0bc7a4e0e1b8c8a2f4bd2c4f0a9ae6a3dfbd1e7c2a5\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"d8c8e1bb3a4c8bd7f7d1f0bc7a4e0e1b8c8a2f4bd2c4f0a9ae6a3dfbd1e7c2a5\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const uint256 hashBlock = ParseHashV(request.params[1], "base_hash");
+    const uint256 hashMuHash = ParseHashV(request.params[2], "muhash");
+    CCoinsSetStats setstats;
+    std::string strError;
+    if (!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, setstats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = mapBlockIndex.find(setstats.hashBlock)->second->nHeight;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_loaded", setstats.nTransactionOutputs));
+    ret.push_back(Pair("base_hash", setstats.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", nHeight));
+    ret.push_back(Pair("muhash", setstats.GetHash().GetHex()));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1655,10 +1857,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path","base_hash","muhash"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
 
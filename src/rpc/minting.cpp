@@ -4,6 +4,7 @@
 #include <chainparams.h>
 #include <validation.h>
 #include <rpc/blockchain.h>
+#include <rpc/minting.h>
 #include <wallet/rpcwallet.h>
 #include <base58.h>
 #include <miner.h>
@@ -12,39 +13,61 @@
 #include <wallet/wallet.h>
 #include <core_io.h>
 
+#include <algorithm>
+#include <cmath>
+
 const int DAY = 24 * 60 * 60;
 
-double CalcMintingProbability(uint32_t nBits, int timeOffset, CAmount nValue, int64_t nTime) {
-    int64_t nTimeWeight = std::min((GetAdjustedTime() - nTime) + timeOffset, Params().GetConsensus().nStakeMaxAge) - Params().GetConsensus().nStakeMinAge;
-    arith_uint256 bnCoinDayWeight = arith_uint256(static_cast<uint64_t >(nValue)) * nTimeWeight / COIN / DAY;
+/**
+ * Sum over the days i = 1..nDays of the coin day weight factor (the coin age
+ * counted for staking) of a coin nAge seconds old i days from now. The factor
+ * is 0 up to the min age, then grows by a day a day up to the max age and
+ * stays constant after, so the sum is an arithmetic series.
+ */
+double SumStakeAges(int64_t nAge, int64_t nDays)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // Number of the days whose age is below nLimit
+    auto days_below = [&](int64_t nLimit) {
+        if (nLimit - nAge <= 0)
+            return (int64_t)0;
+        return std::min(nDays, (nLimit - nAge - 1) / DAY);
+    };
+    const int64_t nImmature = days_below(params.nStakeMinAge + 1);
+    const int64_t nGrowing = days_below(params.nStakeMaxAge);
+
+    double sum = (double)(nGrowing - nImmature) * (nAge - params.nStakeMinAge);
+    sum += (double)DAY * (nGrowing * (nGrowing + 1) - nImmature * (nImmature + 1)) / 2;
+    sum += (double)(nDays - nGrowing) * (params.nStakeMaxAge - params.nStakeMinAge);
+    return sum;
+}
 
+/**
+ * Probability that a coin of nValue, nAge seconds old, stakes within the
+ * given number of minutes at difficulty nBits, one kernel a second, with the
+ * coin age of each day taken at its end. Each kernel meets the target with
+ * probability p = weight * target / 2^256, so the chance of none meeting it
+ * is exp(sum of log(1 - p)); p is tiny enough for log(1 - p) to be -p, which
+ * gives the exponent in closed form.
+ */
+void CalcMintingProbabilities(uint32_t nBits, int minutes, const std::vector<CAmount>& vValue, const std::vector<int64_t>& vAge, std::vector<double>& vProb)
+{
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
+    const double fTargetPerCoinSecond = bnTargetPerCoinDay.getdouble() / (~arith_uint256(0)).getdouble() / COIN / DAY;
 
-    const double targetLimit = (~arith_uint256(0)).getdouble();
-    return (bnCoinDayWeight * bnTargetPerCoinDay).getdouble() / targetLimit;
-}
+    const int64_t nDays = minutes / (60 * 24); // Number of full days
+    const int64_t nSeconds = 60 * (minutes % (60 * 24)); // Number of seconds in the last day
 
-double CalculateMintingProbabilityWithinPeriod(uint32_t nBits, int minutes, CAmount nValue, int64_t nTime)
-{
-    double prob = 1;
-    double p;
-    int d = minutes / (60 * 24); // Number of full days
-    int m = minutes % (60 * 24); // Number of minutes in the last day
-    int timeOffset = DAY;
-
-    // Probabilities for the first d days
-    for(int i = 0; i < d; i++, timeOffset += DAY) {
-        p = pow(1 - CalcMintingProbability(nBits, timeOffset, nValue, nTime), DAY);
-        prob *= p;
+    vProb.resize(vValue.size());
+    for (size_t i = 0; i < vValue.size(); i++) {
+        const double fAgeSeconds = DAY * SumStakeAges(vAge[i], nDays) + nSeconds * (SumStakeAges(vAge[i], nDays + 1) - SumStakeAges(vAge[i], nDays));
+        vProb[i] = vValue[i] * fAgeSeconds * fTargetPerCoinSecond;
+    }
+    for (size_t i = 0; i < vProb.size(); i++) {
+        vProb[i] = -std::expm1(-vProb[i]);
     }
-
-    // Probability for the m minutes of the last day
-    p = pow(1 - CalcMintingProbability(nBits, timeOffset, nValue, nTime), 60 * m);
-    prob *= p;
-
-    prob = 1 - prob;
-    return prob;
 }
 
 
@@ -62,7 +85,9 @@ UniValue listminting(const JSONRPCRequest& request)
                 "2. skip           (numeric, optional, default=0) The number of outputs to skip\n"
                 "3. minweight      (numeric, optional, default=0) Min output weight\n"
                 "4. maxweight      (numeric, optional, default=0) Max output weight (0 - unlimited)\n"
-                "Return all mintable outputs and provide details for each of them.");
+                "Return the mintable outputs with a coin-day-weight between minweight and maxweight, heaviest first,\n"
+                "and provide details for each of them. count and skip page through these outputs.\n"
+                "The outputs and their weights are refreshed at most once a minute, unless the wallet or the chain changes.");
 
     int64_t nCount = 0;
     if (!request.params[0].isNull()) {
@@ -94,78 +119,74 @@ UniValue listminting(const JSONRPCRequest& request)
         nMaxWeight = maxWeight;
     }
 
-    LOCK2(cs_main, pwallet->cs_wallet);
-    const CBlockIndex *p = GetLastBlockIndex(chainActive.Tip(), Params().GetConsensus(), true);
-    uint32_t nBits = (p == nullptr) ? UintToArith256(Params().GetConsensus().nInitialHashTargetPoS).GetCompact() : p->nBits;
-
-    UniValue ret(UniValue::VARR);
-
-    int64_t minAge = Params().GetConsensus().nStakeMinAge / DAY;
-
-    std::vector<COutput> vCoins;
-    pwallet->AvailableCoins(vCoins, true, nullptr, 0, 0, MAX_MONEY, MAX_MONEY, 0, 1);
-
-    for (auto &out: vCoins) {
-        if (nSkip != 0) {
-            --nSkip;
-            continue;
-        }
-
-        if (nCount != 0 && ret.size() >= (size_t)nCount) {
-            break;
-        }
-
-        if (nCount != 0 && ret.size() >= (size_t)nCount) {
-            break;
-        }
-
-        const CBlockIndex *pindex = nullptr;
-        out.tx->GetDepthInMainChain(pindex);
+    uint32_t nBits;
+    {
+        LOCK(cs_main);
+        const CBlockIndex *p = GetLastBlockIndex(chainActive.Tip(), Params().GetConsensus(), true);
+        nBits = (p == nullptr) ? UintToArith256(Params().GetConsensus().nInitialHashTargetPoS).GetCompact() : p->nBits;
+    }
 
-        if (!pindex)
-            continue;
+    const std::shared_ptr<const CMintingIndex> index = pwallet->GetMintingIndex();
+    const std::vector<CMintableCoin>& vCoins = index->vCoins;
 
-        uint64_t nTime = pindex->nTime;
-        CAmount nValue = out.tx->tx->vout[out.i].nValue;
+    // The outputs within the weight range, then the page asked for
+    auto first = vCoins.begin();
+    if (nMaxWeight != 0) {
+        first = std::lower_bound(vCoins.begin(), vCoins.end(), nMaxWeight, [](const CMintableCoin& coin, uint64_t nWeight) {
+            return (uint64_t)coin.nWeight > nWeight;
+        });
+    }
+    auto last = std::lower_bound(first, vCoins.end(), nMinWeight, [](const CMintableCoin& coin, uint64_t nWeight) {
+        return (uint64_t)coin.nWeight >= nWeight;
+    });
+    first += std::min<int64_t>(nSkip, last - first);
+    if (nCount != 0 && nCount < last - first)
+        last = first + nCount;
+
+    std::vector<CAmount> vValue;
+    std::vector<int64_t> vAge;
+    for (auto it = first; it != last; ++it) {
+        vValue.push_back(it->nValue);
+        vAge.push_back(index->nTime - it->nTime);
+    }
+    std::vector<double> vProb10min, vProb24h, vProb30d, vProb90d;
+    CalcMintingProbabilities(nBits, 10, vValue, vAge, vProb10min);
+    CalcMintingProbabilities(nBits, 60*24, vValue, vAge, vProb24h);
+    CalcMintingProbabilities(nBits, 60*24*30, vValue, vAge, vProb30d);
+    CalcMintingProbabilities(nBits, 60*24*90, vValue, vAge, vProb90d);
 
-        int64_t nDayWeight = (std::min((GetAdjustedTime() - (uint32_t)nTime), Params().GetConsensus().nStakeMaxAge) - Params().GetConsensus().nStakeMinAge) / DAY;
-        int64_t coinAge = std::max(nValue * nDayWeight / COIN, (int64_t)0);
+    UniValue ret(UniValue::VARR);
 
-        if (coinAge < nMinWeight) {
-            continue;
-        }
+    int64_t minAge = Params().GetConsensus().nStakeMinAge / DAY;
 
-        if (nMaxWeight != 0 && coinAge > nMaxWeight) {
-            continue;
-        }
+    for (size_t i = 0; i < vValue.size(); i++) {
+        const CMintableCoin& coin = first[i];
 
         CTxDestination address;
-        const CScript& scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
-        ExtractDestination(scriptPubKey, address);
+        ExtractDestination(coin.scriptPubKey, address);
 
         std::string status = "immature";
         int64_t attempts = 0;
-        if (((GetAdjustedTime() - nTime) / DAY) >= minAge) {
+        if ((vAge[i] / DAY) >= minAge) {
             status = "mature";
-            attempts = GetAdjustedTime() - nTime - Params().GetConsensus().nStakeMinAge;
+            attempts = vAge[i] - Params().GetConsensus().nStakeMinAge;
         }
 
         UniValue obj(UniValue::VOBJ);
         obj.push_back(Pair("address",                   EncodeDestination(address)));
-        obj.push_back(Pair("txid",                      out.tx->GetHash().GetHex()));
-        obj.push_back(Pair("vout",                      out.i));
-        obj.push_back(Pair("time",                      nTime));
-        obj.push_back(Pair("amount",                    ValueFromAmount(nValue)));
+        obj.push_back(Pair("txid",                      coin.outpoint.hash.GetHex()));
+        obj.push_back(Pair("vout",                      (int)coin.outpoint.n));
+        obj.push_back(Pair("time",                      coin.nTime));
+        obj.push_back(Pair("amount",                    ValueFromAmount(coin.nValue)));
         obj.push_back(Pair("status",                    status));
-        obj.push_back(Pair("age-in-day",                ((GetAdjustedTime() - nTime) / DAY)));
-        obj.push_back(Pair("coin-day-weight",           coinAge));
-        obj.push_back(Pair("minting-probability-10min", CalculateMintingProbabilityWithinPeriod(nBits, 10, nValue, nTime)));
-        obj.push_back(Pair("minting-probability-24h",   CalculateMintingProbabilityWithinPeriod(nBits, 60*24, nValue, nTime)));
-        obj.push_back(Pair("minting-probability-30d",   CalculateMintingProbabilityWithinPeriod(nBits, 60*24*30, nValue, nTime)));
-        obj.push_back(Pair("minting-probability-90d",   CalculateMintingProbabilityWithinPeriod(nBits, 60*24*90, nValue, nTime)));
+        obj.push_back(Pair("age-in-day",                vAge[i] / DAY));
+        obj.push_back(Pair("coin-day-weight",           coin.nWeight));
+        obj.push_back(Pair("minting-probability-10min", vProb10min[i]));
+        obj.push_back(Pair("minting-probability-24h",   vProb24h[i]));
+        obj.push_back(Pair("minting-probability-30d",   vProb30d[i]));
+        obj.push_back(Pair("minting-probability-90d",   vProb90d[i]));
         obj.push_back(Pair("attempts",                  attempts));
         ret.push_back(obj);
-
     }
 
     return ret;
@@ -0,0 +1,19 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_MINTING_H
+#define BITCOIN_RPC_MINTING_H
+
+#include <amount.h>
+
+#include <stdint.h>
+#include <vector>
+
+/** Sum of the coin ages counted for staking of a coin nAge seconds old at the end of each of the next nDays days */
+double SumStakeAges(int64_t nAge, int64_t nDays);
+
+/** Probabilities that the coins of vValue and vAge stake within the given number of minutes at difficulty nBits */
+void CalcMintingProbabilities(uint32_t nBits, int minutes, const std::vector<CAmount>& vValue, const std::vector<int64_t>& vAge, std::vector<double>& vProb);
+
+#endif
@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <limits>
 #include <cmath>
+#include <algorithm>
 #include <uint256.h>
 #include <arith_uint256.h>
 #include <string>
@@ -366,6 +367,19 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK(R2L / MaxL == ZeroL);
     BOOST_CHECK(MaxL / R2L == 1);
     BOOST_CHECK_THROW(R2L / ZeroL, uint_error);
+
+    // Divisors of up to 32 bits take a word by word path
+    BOOST_CHECK(R1L / 0x10 == (R1L >> 4));
+    BOOST_CHECK((MaxL / 0xffffffff).ToString() == "0000000100000001000000010000000100000001000000010000000100000001");
+    BOOST_CHECK((R2L / 0xECD75171).ToString() == (R2L / arith_uint256("ECD75171")).ToString());
+    for (int i = 0; i < 1000; i++) {
+        const arith_uint256 n = UintToArith256(InsecureRand256()) >> InsecureRandRange(256);
+        const uint32_t d = std::max<uint32_t>(1, InsecureRand32() >> InsecureRandRange(32));
+        const arith_uint256 q = n / d;
+        const arith_uint256 r = n - q * d;
+        BOOST_CHECK(q * d <= n);
+        BOOST_CHECK(r < d);
+    }
 }
 
 
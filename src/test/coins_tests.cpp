@@ -3,13 +3,18 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <coins.h>
+#include <chainparams.h>
+#include <coinstats.h>
 #include <script/standard.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
+#include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <primitives/block.h>
 
 #include <vector>
 #include <map>
@@ -855,4 +860,278 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_db_background_write)
+{
+    ClearDatadirCache();
+    fs::path pathTemp = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(pathTemp);
+    gArgs.ForceSetArg("-datadir", pathTemp.string());
+    {
+        CCoinsViewDB db(1 << 20, true);
+        const COutPoint outpointOld(InsecureRand256(), 0);
+        const COutPoint outpointNew(InsecureRand256(), 1);
+        const uint256 hashOld = InsecureRand256();
+        const uint256 hashNew = InsecureRand256();
+
+        CCoinsViewCache cache(&db);
+        cache.AddCoin(outpointOld, Coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, 0, false), false);
+        cache.SetBestBlock(hashOld);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!db.IsWriting());
+
+        // Spend the old coin and add a new one, then hand them over to be written in the background
+        BOOST_CHECK(cache.SpendCoin(outpointOld));
+        cache.AddCoin(outpointNew, Coin(CTxOut(VALUE2, CScript() << OP_TRUE), 2, 0, false), false);
+        cache.SetBestBlock(hashNew);
+        const size_t nUsage = cache.DynamicMemoryUsage();
+        CCoinsMap mapCoins;
+        cache.Detach(mapCoins);
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+        BOOST_CHECK(cache.GetBestBlock() == hashNew);
+        BOOST_CHECK(db.BatchWriteAsync(mapCoins, hashNew, nUsage));
+        BOOST_CHECK(mapCoins.empty());
+
+        // Whether or not the write is done, the view reflects it
+        Coin coin;
+        BOOST_CHECK(!db.GetCoin(outpointOld, coin));
+        BOOST_CHECK(!db.HaveCoin(outpointOld));
+        BOOST_CHECK(db.GetCoin(outpointNew, coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, VALUE2);
+        BOOST_CHECK(db.GetBestBlock() == hashNew);
+        BOOST_CHECK(cache.AccessCoin(outpointNew).out.nValue == VALUE2);
+        BOOST_CHECK(db.GetPendingUsage() == 0 || db.GetPendingUsage() == nUsage);
+
+        BOOST_CHECK(db.Sync());
+        BOOST_CHECK(!db.IsWriting());
+        BOOST_CHECK(!db.HasWriteFailed());
+        BOOST_CHECK_EQUAL(db.GetPendingUsage(), 0);
+        BOOST_CHECK(db.GetBestBlock() == hashNew);
+        BOOST_CHECK(db.GetHeadBlocks().empty());
+
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        BOOST_CHECK(pcursor->GetBestBlock() == hashNew);
+        COutPoint key;
+        BOOST_CHECK(pcursor->Valid() && pcursor->GetKey(key) && key == outpointNew);
+        pcursor->Next();
+        BOOST_CHECK(!pcursor->Valid());
+    }
+    gArgs.ForceSetArg("-datadir", "");
+    ClearDatadirCache();
+    fs::remove_all(pathTemp);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_staged)
+{
+    CCoinsView dummy;
+    CCoinsViewCache base(&dummy);
+    const COutPoint outpoint(InsecureRand256(), 1);
+    const COutPoint outpointBase(InsecureRand256(), 0);
+    base.AddCoin(outpointBase, Coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, 0, false), false);
+
+    // Staged coins are served ahead of the backing view, base coins behind them
+    CCoinsViewStaged staged(&base);
+    staged.Stage(outpoint, Coin(CTxOut(VALUE2, CScript() << OP_TRUE), 2, 0, false));
+    BOOST_CHECK_EQUAL(staged.GetStagedCount(), 1);
+    BOOST_CHECK(staged.HaveCoin(outpoint));
+    BOOST_CHECK(!base.HaveCoin(outpoint));
+
+    CCoinsViewCache view(&staged);
+    BOOST_CHECK_EQUAL(view.AccessCoin(outpoint).out.nValue, VALUE2);
+    BOOST_CHECK_EQUAL(view.AccessCoin(outpointBase).out.nValue, VALUE1);
+    BOOST_CHECK_EQUAL(staged.GetStagedCount(), 0);
+
+    // Spending both through the view writes through to the base
+    BOOST_CHECK(view.SpendCoin(outpoint));
+    BOOST_CHECK(view.SpendCoin(outpointBase));
+    BOOST_CHECK(view.Flush());
+    BOOST_CHECK(!base.HaveCoin(outpoint));
+    BOOST_CHECK(!base.HaveCoin(outpointBase));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_staged_spent_in_cache)
+{
+    // A coin that is on disk, and that an earlier block spent in the tip cache
+    // without the spend having been flushed yet
+    CCoinsViewDB db(1 << 20, true);
+    const COutPoint outpointSpent(InsecureRand256(), 0);
+    const COutPoint outpointDisk(InsecureRand256(), 0);
+    {
+        CCoinsViewCache cache(&db);
+        cache.AddCoin(outpointSpent, Coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, 0, false), false);
+        cache.AddCoin(outpointDisk, Coin(CTxOut(VALUE2, CScript() << OP_TRUE), 1, 0, false), false);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsViewCache tip(&db);
+    BOOST_CHECK(tip.SpendCoin(outpointSpent));
+    BOOST_CHECK(!tip.HaveCoinInCache(outpointSpent));
+    BOOST_CHECK(tip.HaveEntryInCache(outpointSpent));
+    BOOST_CHECK(!tip.HaveEntryInCache(outpointDisk));
+
+    // Stage both as read from disk, as if the prefetch had not skipped the spent one
+    CCoinsViewStaged staged(&tip);
+    for (const COutPoint& outpoint : {outpointSpent, outpointDisk}) {
+        Coin coin;
+        BOOST_CHECK(db.GetCoin(outpoint, coin));
+        staged.Stage(outpoint, std::move(coin));
+    }
+    BOOST_CHECK(!staged.HaveCoin(outpointSpent));
+    BOOST_CHECK(staged.HaveCoin(outpointDisk));
+
+    // A block that spends the coin again must not find it
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = outpointSpent;
+    spend.vout.emplace_back(VALUE1, CScript() << OP_TRUE);
+    CCoinsViewCache view(&staged);
+    CValidationState state;
+    CAmount txfee;
+    BOOST_CHECK(!Consensus::CheckTxInputs(CTransaction(spend), state, view, 2, 0, txfee));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-missingorspent");
+    BOOST_CHECK(view.AccessCoin(outpointSpent).IsSpent());
+
+    // while a coin only on disk is served from the stage
+    spend.vin[0].prevout = outpointDisk;
+    spend.vout[0].nValue = VALUE2;
+    CValidationState stateDisk;
+    BOOST_CHECK(Consensus::CheckTxInputs(CTransaction(spend), stateDisk, view, 2, 0, txfee));
+    BOOST_CHECK_EQUAL(staged.GetStagedCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(coins_set_stats)
+{
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    std::map<COutPoint, Coin> utxos;
+    CCoinsSetStats stats;
+    stats.hashBlock = InsecureRand256();
+    for (int i = 0; i < 10; i++) {
+        const COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+        Coin coin(CTxOut(InsecureRandRange(MAX_MONEY), CScript() << ToByteVector(InsecureRand256())), 1 + i, InsecureRand32(), i == 0);
+        view.AddCoin(outpoint, Coin(coin), false);
+        stats.AddCoin(outpoint, coin);
+        utxos.emplace(outpoint, std::move(coin));
+    }
+    const CCoinsSetStats statsBefore = stats;
+
+    // A block with an unspendable output, which spends two of the coins and
+    // then an output it creates itself
+    CBlock block;
+    block.hashPrevBlock = stats.hashBlock;
+    block.nTime = InsecureRand32();
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.emplace_back(VALUE1, CScript() << OP_TRUE);
+    coinbase.vout.emplace_back(0, CScript() << OP_RETURN);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CMutableTransaction spend;
+    spend.vin.emplace_back(utxos.begin()->first);
+    spend.vin.emplace_back(utxos.rbegin()->first);
+    spend.vout.emplace_back(VALUE2, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(spend));
+    CMutableTransaction spend2;
+    spend2.vin.emplace_back(block.vtx[1]->GetHash(), 0);
+    spend2.vout.emplace_back(VALUE3, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(spend2));
+
+    CBlockUndo blockundo;
+    CTxUndo undoDummy;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i > 0)
+            blockundo.vtxundo.push_back(CTxUndo());
+        UpdateCoins(*block.vtx[i], view, i == 0 ? undoDummy : blockundo.vtxundo.back(), 100, block.nTime);
+    }
+    const uint256 hashBlock = block.GetHash();
+    stats.ConnectBlock(block, blockundo, 100, hashBlock);
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+
+    // The statistics are those of the set the block left behind
+    utxos.erase(utxos.begin());
+    utxos.erase(std::prev(utxos.end()));
+    utxos.emplace(COutPoint(block.vtx[0]->GetHash(), 0), view.AccessCoin(COutPoint(block.vtx[0]->GetHash(), 0)));
+    utxos.emplace(COutPoint(block.vtx[2]->GetHash(), 0), view.AccessCoin(COutPoint(block.vtx[2]->GetHash(), 0)));
+    CCoinsSetStats expected;
+    CAmount nTotalAmount = 0;
+    for (auto it = utxos.rbegin(); it != utxos.rend(); ++it) {
+        BOOST_CHECK(view.HaveCoin(it->first));
+        expected.AddCoin(it->first, it->second);
+        nTotalAmount += it->second.out.nValue;
+    }
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, utxos.size());
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, nTotalAmount);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, expected.nBogoSize);
+    const uint256 hash = stats.GetHash();
+    BOOST_CHECK(hash == expected.GetHash());
+
+    // They survive serialization, and taking the block back out restores them
+    CDataStream ss(SER_DISK, 0);
+    ss << stats;
+    CCoinsSetStats stats2;
+    ss >> stats2;
+    BOOST_CHECK(stats2.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats2.nBogoSize, stats.nBogoSize);
+    stats2.RemoveCoin(COutPoint(block.vtx[0]->GetHash(), 0), view.AccessCoin(COutPoint(block.vtx[0]->GetHash(), 0)));
+    stats2.RemoveCoin(COutPoint(block.vtx[2]->GetHash(), 0), view.AccessCoin(COutPoint(block.vtx[2]->GetHash(), 0)));
+    for (size_t j = 0; j < spend.vin.size(); j++)
+        stats2.AddCoin(spend.vin[j].prevout, blockundo.vtxundo[0].vprevout[j]);
+    BOOST_CHECK_EQUAL(stats2.nTransactionOutputs, statsBefore.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats2.nTotalAmount, statsBefore.nTotalAmount);
+    BOOST_CHECK(stats2.GetHash() == statsBefore.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(coins_set_stats_flushed)
+{
+    // Blocks around the end of the legacy format, each of which spends the
+    // coin of the one before after it was written to and read back from the
+    // database: the running statistics must match a scan of the database
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsSetStats stats;
+    const int nTLRHeight = Params().GetConsensus().TLRHeight;
+    COutPoint prevout;
+    for (int nHeight : {10, 11, nTLRHeight, nTLRHeight + 1}) {
+        CCoinsViewCache view(&db);
+        CBlock block;
+        block.hashPrevBlock = stats.hashBlock;
+        block.nTime = InsecureRand32() | 1;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        coinbase.vout.emplace_back(VALUE1, CScript() << OP_TRUE);
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        if (!prevout.IsNull()) {
+            CMutableTransaction spend;
+            spend.vin.emplace_back(prevout);
+            spend.vout.emplace_back(VALUE2, CScript() << OP_TRUE);
+            block.vtx.push_back(MakeTransactionRef(spend));
+        }
+
+        CBlockUndo blockundo;
+        CTxUndo undoDummy;
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            if (i > 0)
+                blockundo.vtxundo.push_back(CTxUndo());
+            UpdateCoins(*block.vtx[i], view, i == 0 ? undoDummy : blockundo.vtxundo.back(), nHeight, block.nTime);
+        }
+        stats.ConnectBlock(block, blockundo, nHeight, block.GetHash());
+        view.SetBestBlock(block.GetHash());
+        BOOST_CHECK(view.Flush());
+        prevout = COutPoint(block.vtx[0]->GetHash(), 0);
+
+        CCoinsSetStats scan;
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            Coin coin;
+            BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+            scan.AddCoin(key, coin);
+        }
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, scan.nTransactionOutputs);
+        BOOST_CHECK_EQUAL(stats.nTotalAmount, scan.nTotalAmount);
+        BOOST_CHECK(stats.GetHash() == scan.GetHash());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
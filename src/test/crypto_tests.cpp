@@ -4,13 +4,18 @@
 
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
+#include <crypto/common.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
+#include <crypto/Lyra2Z/Lyra2Z.h>
+#include <hash.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -268,6 +273,25 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_short_tests) {
+    // SHA256DShort hashes 8 and 4 messages at a time where it can, so
+    // compare it with the one-at-a-time path for every length and count
+    std::vector<unsigned char> in(55 * 20);
+    for (unsigned char& c : in) {
+        c = InsecureRandBits(8);
+    }
+    for (size_t len = 0; len <= 55; len++) {
+        for (size_t blocks = 0; blocks <= 20; blocks++) {
+            std::vector<unsigned char> out(32 * blocks);
+            SHA256DShort(out.data(), in.data(), len, blocks);
+            for (size_t i = 0; i < blocks; i++) {
+                uint256 expected = Hash(in.begin() + i * len, in.begin() + (i + 1) * len);
+                BOOST_CHECK(memcmp(out.data() + 32 * i, expected.begin(), 32) == 0);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -524,6 +548,157 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+void TestLyra2Z(const std::string &hexin, const std::string &hexout) {
+    std::vector<unsigned char> in = ParseHex(hexin);
+    std::vector<unsigned char> out = ParseHex(hexout);
+    BOOST_CHECK(in.size() == 80);
+    std::vector<unsigned char> hash(32);
+    lyra2z_hash((const char*)in.data(), (char*)hash.data());
+    BOOST_CHECK(hash == out);
+    // Reusing one scratchpad must not leak state between hashes, whatever its alignment.
+    std::vector<char> scratchpad(LYRA2Z_SCRATCHPAD_SIZE + 1);
+    for (int i = 0; i < 2; i++) {
+        std::fill(hash.begin(), hash.end(), 0);
+        lyra2z_hash_sp((const char*)in.data(), (char*)hash.data(), scratchpad.data() + i);
+        BOOST_CHECK(hash == out);
+    }
+}
+
+static void TestLyra2ZVectors() {
+    TestLyra2Z("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+               "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+               "404142434445464748494a4b4c4d4e4f",
+               "6b0ded5afb3b27cf0e601243ffd9b37ee65331a2d46c7add2a6a826958ab1c0b");
+    TestLyra2Z(std::string(160, '0'),
+               "9b63bf262ec6f678d73e101f57dadcfe07b6d1f01c2b6ebfbc84ed3fa2be947d");
+    TestLyra2Z(std::string(160, 'f'),
+               "672f604737cfc635f20976a86cf955b67a1a00ee40acff5dcfd5d52aada70b24");
+}
+
+BOOST_AUTO_TEST_CASE(lyra2z_testvectors) {
+    TestLyra2ZVectors();
+}
+
+BOOST_AUTO_TEST_CASE(lyra2z_sponge_implementations) {
+    std::vector<std::vector<char>> inputs(20, std::vector<char>(80));
+    std::vector<std::vector<char>> expected;
+    BOOST_REQUIRE(lyra2z_select("standard"));
+    for (std::vector<char>& in : inputs) {
+        for (char& c : in)
+            c = InsecureRandBits(8);
+        expected.emplace_back(32);
+        lyra2z_hash(in.data(), expected.back().data());
+    }
+
+    // Every sponge this CPU runs must agree with the scalar one
+    for (const char* name : {"standard", "avx2", "avx512"}) {
+        if (!lyra2z_select(name))
+            continue;
+        BOOST_TEST_MESSAGE("Lyra2Z sponge " << name);
+        TestLyra2ZVectors();
+        for (size_t i = 0; i < inputs.size(); i++) {
+            std::vector<char> hash(32);
+            lyra2z_hash(inputs[i].data(), hash.data());
+            BOOST_CHECK(hash == expected[i]);
+        }
+    }
+    lyra2z_autodetect();
+}
+
+static MuHash3072 FromInt(unsigned char i) {
+    unsigned char tmp[32] = {i, 0};
+    MuHash3072 ret;
+    ret.Insert(tmp, 32);
+    return ret;
+}
+
+static uint256 Finalized(const MuHash3072& muhash) {
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // The order elements are added in, and removing them again, do not change the hash
+    uint256 res;
+    int table[4];
+    for (int i = 0; i < 4; ++i) {
+        table[i] = InsecureRandBits(3);
+    }
+    for (int order = 0; order < 4; ++order) {
+        MuHash3072 acc;
+        for (int i = 0; i < 4; ++i) {
+            int t = table[i ^ order];
+            if (t & 4) {
+                acc /= FromInt(t & 3);
+            } else {
+                acc *= FromInt(t & 3);
+            }
+        }
+        uint256 out = Finalized(acc);
+        if (order == 0) {
+            res = out;
+        } else {
+            BOOST_CHECK(res == out);
+        }
+    }
+
+    MuHash3072 x = FromInt(InsecureRandBits(4)); // x=X
+    MuHash3072 y = FromInt(InsecureRandBits(4)); // x=X, y=Y
+    MuHash3072 z;                                // x=X, y=Y, z=1
+    z *= x;                                      // x=X, y=Y, z=X
+    z *= y;                                      // x=X, y=Y, z=X*Y
+    y *= x;                                      // x=X, y=Y*X, z=X*Y
+    z /= y;                                      // x=X, y=Y*X, z=1
+    BOOST_CHECK(Finalized(z) == Finalized(MuHash3072()));
+
+    // Insert and Remove take the same elements as the set hashes
+    const unsigned char data[] = {1, 2, 3};
+    MuHash3072 acc;
+    acc.Insert(data, sizeof(data)).Insert(data, 1);
+    acc.Remove(data, sizeof(data));
+    BOOST_CHECK(Finalized(acc) == Finalized(MuHash3072().Insert(data, 1)));
+
+    // Serialization keeps the numerator and denominator apart
+    CDataStream ss(SER_DISK, 0);
+    ss << acc;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 acc2;
+    ss >> acc2;
+    acc2.Remove(data, 1);
+    BOOST_CHECK(Finalized(acc2) == Finalized(MuHash3072()));
+
+    // Same vector as other implementations of this MuHash
+    MuHash3072 acc3 = FromInt(0);
+    acc3 *= FromInt(1);
+    acc3 /= FromInt(2);
+    BOOST_CHECK_EQUAL(Finalized(acc3).GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // Numbers at the top of the range: p - 1 is its own inverse, and 2^3072 - 1 is reduced
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    memset(bytes, 0xff, sizeof(bytes));
+    WriteLE32(bytes, 0xffffffff - 1103717);
+    Num3072 minus_one(bytes);
+    Num3072 num = minus_one;
+    num.Multiply(minus_one);
+    unsigned char out[Num3072::BYTE_SIZE], one[Num3072::BYTE_SIZE];
+    Num3072().ToBytes(one);
+    num.ToBytes(out);
+    BOOST_CHECK(memcmp(out, one, sizeof(out)) == 0);
+    num = minus_one;
+    num.Divide(minus_one);
+    num.ToBytes(out);
+    BOOST_CHECK(memcmp(out, one, sizeof(out)) == 0);
+    memset(bytes, 0xff, sizeof(bytes));
+    num = Num3072(bytes);
+    num.Divide(Num3072());
+    num.ToBytes(out);
+    memset(bytes, 0, sizeof(bytes));
+    WriteLE32(bytes, 1103717 - 1);
+    BOOST_CHECK(memcmp(out, bytes, sizeof(out)) == 0);
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
@@ -0,0 +1,532 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <kernel.h>
+#include <keystore.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, BasicTestingSetup)
+
+// Build a chain with jittered block times whose stake modifiers are flagged
+// on the blocks ComputeNextStakeModifier would generate them on.
+static void BuildStakeChain(std::vector<CBlockIndex>& vIndex)
+{
+    const int64_t nInterval = Params().GetConsensus().nStakeModifierInterval;
+    int64_t nModifierTime = 0;
+
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockIndex& block = vIndex[i];
+        block.nHeight = i;
+        block.pprev = i ? &vIndex[i - 1] : nullptr;
+        block.nTime = 1530000000 + i * 140 + InsecureRandRange(600);
+        if (i == 0 || (vIndex[i - 1].GetBlockTime() / nInterval > nModifierTime / nInterval &&
+                       block.GetBlockTime() / nInterval > nModifierTime / nInterval)) {
+            block.SetStakeModifier(InsecureRand32(), true);
+            nModifierTime = block.GetBlockTime();
+        } else {
+            block.SetStakeModifier(vIndex[i - 1].nStakeModifier, false);
+        }
+    }
+}
+
+// The walk GetKernelStakeModifier used to do
+static const CBlockIndex* FindByWalk(const CBlockIndex* pindex, int64_t nTime)
+{
+    for (; pindex; pindex = pindex->pprev) {
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() <= nTime)
+            return pindex;
+    }
+    return nullptr;
+}
+
+static void CheckFind(const CStakeModifierIndex& index, const CBlockIndex* pindexTip, int64_t nTime)
+{
+    const CBlockIndex* pindexExpected = FindByWalk(pindexTip, nTime);
+    CStakeModifierIndex::Entry entry;
+    BOOST_CHECK_EQUAL(index.Find(nTime, pindexTip->nHeight, entry), pindexExpected != nullptr);
+    if (pindexExpected) {
+        BOOST_CHECK_EQUAL(entry.nHeight, pindexExpected->nHeight);
+        BOOST_CHECK_EQUAL(entry.nTime, pindexExpected->GetBlockTime());
+        BOOST_CHECK_EQUAL(entry.nStakeModifier, pindexExpected->nStakeModifier);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index_find)
+{
+    std::vector<CBlockIndex> vIndex(5000);
+    BuildStakeChain(vIndex);
+
+    CStakeModifierIndex index;
+    index.Rebuild(&vIndex.back());
+
+    const int64_t nTimeFirst = vIndex.front().GetBlockTime();
+    const int64_t nTimeLast = vIndex.back().GetBlockTime();
+    CheckFind(index, &vIndex.back(), nTimeFirst - 1);
+    CheckFind(index, &vIndex.back(), nTimeLast + 1);
+    for (int i = 0; i < 1000; i++) {
+        CheckFind(index, &vIndex.back(), nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index_connect_disconnect)
+{
+    std::vector<CBlockIndex> vIndex(3000);
+    BuildStakeChain(vIndex);
+
+    CStakeModifierIndex index;
+    for (const CBlockIndex& block : vIndex) {
+        index.Connect(&block);
+    }
+
+    const int64_t nTimeFirst = vIndex.front().GetBlockTime();
+    const int64_t nTimeLast = vIndex.back().GetBlockTime();
+    for (int i = 0; i < 200; i++) {
+        CheckFind(index, &vIndex.back(), nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+
+    // Unwind a few hundred blocks and reconnect them
+    for (int nHeight = vIndex.size() - 1; nHeight >= 2500; nHeight--) {
+        index.Disconnect(&vIndex[nHeight]);
+    }
+    for (int i = 0; i < 200; i++) {
+        CheckFind(index, &vIndex[2499], nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+    for (size_t nHeight = 2500; nHeight < vIndex.size(); nHeight++) {
+        index.Connect(&vIndex[nHeight]);
+    }
+    for (int i = 0; i < 200; i++) {
+        CheckFind(index, &vIndex.back(), nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+
+    // A block connected at a height that is already indexed replaces it
+    // and everything above
+    index.Connect(&vIndex[1000]);
+    for (int i = 0; i < 200; i++) {
+        CheckFind(index, &vIndex[1000], nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+
+    // Entries above the queried height are ignored
+    index.Rebuild(&vIndex.back());
+    for (int i = 0; i < 200; i++) {
+        CheckFind(index, &vIndex[InsecureRandRange(vIndex.size())], nTimeFirst + InsecureRandRange(nTimeLast - nTimeFirst));
+    }
+}
+
+// The search CreateCoinStake did before FindStakeKernel
+static bool FindStakeKernelByCheck(unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, uint32_t nTimeTx, unsigned int nSearchInterval, size_t& nCandidateRet, uint32_t& nTimeTxRet, uint256& hashProofOfStake)
+{
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        CBlock blockFrom;
+        blockFrom.nTime = vCandidates[i].nTimeBlockFrom;
+        blockFrom.SetNewFormatBlock();
+        const CTxOut txOutPrev(vCandidates[i].nValue, CScript());
+        for (unsigned int n = 0; n < nSearchInterval; n++) {
+            if (CheckStakeKernelHash(nBits, blockFrom, vCandidates[i].nTxPrevOffset, txOutPrev, vCandidates[i].prevout, nTimeTx - n, hashProofOfStake)) {
+                nCandidateRet = i;
+                nTimeTxRet = nTimeTx - n;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(find_stake_kernel)
+{
+    std::vector<CBlockIndex> vIndex(10000);
+    BuildStakeChain(vIndex);
+    chainActive.SetTip(&vIndex.back());
+    stakeModifierIndex.Rebuild(chainActive.Tip());
+
+    const uint32_t nTimeTx = vIndex.back().nTime;
+    int nFound = 0;
+    for (int i = 0; i < 20; i++) {
+        // Coins from the first few days of the chain, so that they are old
+        // enough to stake and the tip is recent enough to stake them
+        std::vector<CStakeKernelCandidate> vCandidates(InsecureRandRange(300));
+        for (CStakeKernelCandidate& candidate : vCandidates) {
+            candidate.nTimeBlockFrom = vIndex[InsecureRandRange(2000)].nTime;
+            candidate.nTxPrevOffset = 81 + InsecureRandRange(100000);
+            candidate.prevout = COutPoint(InsecureRand256(), InsecureRandRange(10));
+            candidate.nValue = (1 + InsecureRandRange(10000)) * COIN;
+        }
+        const unsigned int nBits = i % 2 ? 0x1d7fffff : 0x1a7fffff;
+        const unsigned int nSearchInterval = 1 + InsecureRandRange(60);
+
+        size_t nCandidate = 0, nCandidateExpected = 0;
+        uint32_t nTime = 0, nTimeExpected = 0;
+        uint256 hash, hashExpected;
+        const bool fFound = FindStakeKernel(chainActive.Tip(), nBits, vCandidates, nTimeTx, nSearchInterval, nCandidate, nTime, hash);
+        BOOST_CHECK_EQUAL(fFound, FindStakeKernelByCheck(nBits, vCandidates, nTimeTx, nSearchInterval, nCandidateExpected, nTimeExpected, hashExpected));
+        if (fFound) {
+            BOOST_CHECK_EQUAL(nCandidate, nCandidateExpected);
+            BOOST_CHECK_EQUAL(nTime, nTimeExpected);
+            BOOST_CHECK(hash == hashExpected);
+            nFound++;
+        }
+    }
+    BOOST_CHECK(nFound > 0);
+
+    chainActive.SetTip(nullptr);
+    stakeModifierIndex.Rebuild(nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_schedule)
+{
+    std::vector<CBlockIndex> vIndex(10000);
+    BuildStakeChain(vIndex);
+    chainActive.SetTip(&vIndex.back());
+    stakeModifierIndex.Rebuild(chainActive.Tip());
+
+    const uint32_t nTimeTx = vIndex.back().nTime;
+    int nHits = 0;
+    for (int i = 0; i < 10; i++) {
+        std::vector<CStakeKernelCandidate> vCandidates(InsecureRandRange(100));
+        for (CStakeKernelCandidate& candidate : vCandidates) {
+            candidate.nTimeBlockFrom = vIndex[InsecureRandRange(2000)].nTime;
+            candidate.nTxPrevOffset = 81 + InsecureRandRange(100000);
+            candidate.prevout = COutPoint(InsecureRand256(), InsecureRandRange(10));
+            candidate.nValue = (1 + InsecureRandRange(10000)) * COIN;
+        }
+        const unsigned int nBits = i % 2 ? 0x1d7fffff : 0x1a7fffff;
+        const unsigned int nSearchInterval = 1 + InsecureRandRange(300);
+
+        std::vector<CStakeKernelHit> vHits;
+        GetStakeKernelSchedule(chainActive.Tip(), nBits, vCandidates, nTimeTx, nSearchInterval, vHits);
+
+        // Every candidate's first kernel meeting the target, in time order
+        std::vector<CStakeKernelHit> vExpected;
+        for (size_t n = 0; n < vCandidates.size(); n++) {
+            CBlock blockFrom;
+            blockFrom.nTime = vCandidates[n].nTimeBlockFrom;
+            blockFrom.SetNewFormatBlock();
+            const CTxOut txOutPrev(vCandidates[n].nValue, CScript());
+            for (unsigned int t = 0; t < nSearchInterval; t++) {
+                uint256 hash;
+                if (CheckStakeKernelHash(nBits, blockFrom, vCandidates[n].nTxPrevOffset, txOutPrev, vCandidates[n].prevout, nTimeTx + t, hash)) {
+                    vExpected.push_back(CStakeKernelHit{n, nTimeTx + t, hash});
+                    break;
+                }
+            }
+        }
+        std::stable_sort(vExpected.begin(), vExpected.end(), [](const CStakeKernelHit& a, const CStakeKernelHit& b) {
+            return a.nTimeTx < b.nTimeTx;
+        });
+
+        BOOST_REQUIRE_EQUAL(vHits.size(), vExpected.size());
+        for (size_t n = 0; n < vHits.size(); n++) {
+            BOOST_CHECK_EQUAL(vHits[n].nCandidate, vExpected[n].nCandidate);
+            BOOST_CHECK_EQUAL(vHits[n].nTimeTx, vExpected[n].nTimeTx);
+            BOOST_CHECK(vHits[n].hashProofOfStake == vExpected[n].hashProofOfStake);
+        }
+        nHits += vHits.size();
+    }
+    BOOST_CHECK(nHits > 0);
+
+    chainActive.SetTip(nullptr);
+    stakeModifierIndex.Rebuild(nullptr);
+}
+
+// ComputeNextStakeModifier as it was before selection hashes were computed
+// once per candidate rather than once per candidate and round
+namespace reference {
+
+static int64_t GetStakeModifierSelectionIntervalSection(int nSection)
+{
+    return (Params().GetConsensus().nStakeModifierInterval * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1))));
+}
+
+static int64_t GetStakeModifierSelectionInterval()
+{
+    int64_t nSelectionInterval = 0;
+    for (int nSection=0; nSection<64; nSection++)
+        nSelectionInterval += GetStakeModifierSelectionIntervalSection(nSection);
+    return nSelectionInterval;
+}
+
+static bool SelectBlockFromCandidates(
+    std::vector<std::pair<int64_t, uint256> >& vSortedByTimestamp,
+    std::map<uint256, const CBlockIndex*>& mapSelectedBlocks,
+    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev,
+    const CBlockIndex** pindexSelected)
+{
+    bool fSelected = false;
+    arith_uint256 hashBest = 0;
+    *pindexSelected = (const CBlockIndex*) 0;
+    for (const std::pair<int64_t, uint256>& item : vSortedByTimestamp)
+    {
+        if (!mapBlockIndex.count(item.second))
+            return false;
+        const CBlockIndex* pindex = mapBlockIndex[item.second];
+        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+            break;
+        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+            continue;
+        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
+        CDataStream ss(SER_GETHASH, 0);
+        ss << hashProof << nStakeModifierPrev;
+        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
+        if (pindex->IsProofOfStake())
+            hashSelection >>= 32;
+        if (fSelected && hashSelection < hashBest)
+        {
+            hashBest = hashSelection;
+            *pindexSelected = (const CBlockIndex*) pindex;
+        }
+        else if (!fSelected)
+        {
+            fSelected = true;
+            hashBest = hashSelection;
+            *pindexSelected = (const CBlockIndex*) pindex;
+        }
+    }
+    return fSelected;
+}
+
+// Only called on blocks that generate a modifier on top of pindexCurrent->pprev
+static bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier)
+{
+    const CBlockIndex* pindexPrev = pindexCurrent->pprev;
+    const CBlockIndex* pindex = pindexPrev;
+    while (pindex->pprev && !pindex->GeneratedStakeModifier())
+        pindex = pindex->pprev;
+    nStakeModifier = pindex->nStakeModifier;
+
+    std::vector<std::pair<int64_t, uint256> > vSortedByTimestamp;
+    int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
+    int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / Params().GetConsensus().nStakeModifierInterval) * Params().GetConsensus().nStakeModifierInterval - nSelectionInterval;
+    pindex = pindexPrev;
+    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    {
+        vSortedByTimestamp.push_back(std::make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        pindex = pindex->pprev;
+    }
+    std::reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    std::sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+
+    uint64_t nStakeModifierNew = 0;
+    int64_t nSelectionIntervalStop = nSelectionIntervalStart;
+    std::map<uint256, const CBlockIndex*> mapSelectedBlocks;
+    for (int nRound=0; nRound<std::min(64, (int)vSortedByTimestamp.size()); nRound++)
+    {
+        nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
+        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+            return false;
+        nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
+        mapSelectedBlocks.insert(std::make_pair(pindex->GetBlockHash(), pindex));
+    }
+    nStakeModifier = nStakeModifierNew;
+    return true;
+}
+
+} // namespace reference
+
+BOOST_AUTO_TEST_CASE(compute_next_stake_modifier)
+{
+    // A chain of mixed proof-of-work and proof-of-stake blocks with jittered
+    // (not always increasing) block times, long enough for selection
+    // intervals to be full, and with modifiers computed as they would be
+    // when connecting it
+    std::vector<CBlockIndex> vIndex(8000);
+    std::vector<uint256> vHashes(vIndex.size());
+    int nGenerated = 0, nChecked = 0;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockIndex& block = vIndex[i];
+        vHashes[i] = InsecureRand256();
+        block.phashBlock = &vHashes[i];
+        block.pprev = i ? &vIndex[i - 1] : nullptr;
+        block.nHeight = i;
+        block.nTime = 1530000000 + i * 140 + InsecureRandRange(600);
+        if (InsecureRandBool()) {
+            block.SetProofOfStake();
+            block.hashProofOfStake = InsecureRand256();
+        }
+        block.SetStakeEntropyBit(InsecureRandBool());
+        mapBlockIndex[vHashes[i]] = &block;
+
+        uint64_t nStakeModifier;
+        bool fGeneratedStakeModifier;
+        BOOST_REQUIRE(ComputeNextStakeModifier(&block, nStakeModifier, fGeneratedStakeModifier));
+        block.SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+
+        // The reference implementation is slow, so only check a share of
+        // the modifiers against it
+        if (fGeneratedStakeModifier && i > 0 && nGenerated++ % 4 == 0) {
+            uint64_t nStakeModifierExpected;
+            BOOST_REQUIRE(reference::ComputeNextStakeModifier(&block, nStakeModifierExpected));
+            BOOST_CHECK_EQUAL(nStakeModifier, nStakeModifierExpected);
+            nChecked++;
+        }
+    }
+    BOOST_CHECK(nChecked >= 10);
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+BOOST_AUTO_TEST_CASE(stake_tx_origins)
+{
+    CBlock block;
+    block.nTime = 1530000000;
+    block.SetNewFormatBlock();
+    for (int i = 0; i < 300; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + InsecureRandRange(3));
+        for (CTxIn& txin : tx.vin) {
+            txin.prevout = COutPoint(InsecureRand256(), InsecureRandRange(10));
+            txin.scriptSig = CScript() << std::vector<unsigned char>(InsecureRandRange(100), 0);
+        }
+        tx.vout.resize(1 + InsecureRandRange(3));
+        for (CTxOut& txout : tx.vout) {
+            txout.nValue = InsecureRandRange(1000) * COIN;
+        }
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+
+    std::vector<std::pair<uint256, CStakeTxOrigin> > vOrigins;
+    GetStakeTxOrigins(block, 1234, vOrigins);
+    BOOST_CHECK_EQUAL(vOrigins.size(), block.vtx.size());
+
+    // Every offset points at its transaction in the block as it is stored on disk
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    for (size_t i = 0; i < vOrigins.size(); i++) {
+        BOOST_CHECK(vOrigins[i].first == block.vtx[i]->GetHash());
+        BOOST_CHECK_EQUAL(vOrigins[i].second.nHeight, 1234);
+        CDataStream ssTx(ssBlock.begin() + vOrigins[i].second.nTxOffset, ssBlock.end(), SER_DISK, CLIENT_VERSION);
+        CMutableTransaction tx;
+        ssTx >> tx;
+        BOOST_CHECK(tx.GetHash() == block.vtx[i]->GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coin_age)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> vIndex(3000);
+    std::vector<uint256> vHashes(vIndex.size());
+    BuildStakeChain(vIndex);
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vHashes[i] = InsecureRand256();
+        vIndex[i].phashBlock = &vHashes[i];
+        mapBlockIndex[vHashes[i]] = &vIndex[i];
+    }
+
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    view.SetBestBlock(vHashes.back());
+
+    const uint32_t nTime = vIndex.back().nTime + 600;
+    CMutableTransaction tx;
+    arith_uint256 bnCentSecond = 0;
+    for (int i = 0; i < 50; i++) {
+        const COutPoint prevout(InsecureRand256(), InsecureRandRange(10));
+        tx.vin.push_back(CTxIn(prevout));
+        // An input that is not in the view does not count
+        if (i % 10 == 0)
+            continue;
+        const int nHeight = InsecureRandRange(vIndex.size());
+        const CAmount nValue = (1 + InsecureRandRange(10000)) * COIN;
+        Coin coin(CTxOut(nValue, CScript()), nHeight, 0, false);
+        view.AddCoin(prevout, std::move(coin), false);
+        // Block times, not Coin::nTime (left at 0 above), make the age
+        const int64_t nTimeFrom = vIndex[nHeight].GetBlockTime();
+        if (nTimeFrom + params.nStakeMinAge <= nTime)
+            bnCentSecond += arith_uint256(nValue) * (nTime - nTimeFrom) / CENT;
+    }
+
+    uint64_t nCoinAge;
+    BOOST_CHECK(GetCoinAge(CTransaction(tx), view, nCoinAge, params, nTime));
+    BOOST_CHECK(nCoinAge > 0);
+    BOOST_CHECK_EQUAL(nCoinAge, (bnCentSecond * CENT / COIN / (24 * 60 * 60)).GetLow64());
+
+    // Spending a coin created after nTime is a timestamp violation
+    BOOST_CHECK(!GetCoinAge(CTransaction(tx), view, nCoinAge, params, vIndex[0].nTime));
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+static void TestBlockSignatureCheck()
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.emplace_back(0, CScript());
+    CMutableTransaction coinstake;
+    coinstake.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    coinstake.vout.emplace_back(0, CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG);
+    coinstake.vout.emplace_back(1000 * COIN, CScript() << OP_TRUE);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(coinstake));
+    block.SetProofOfStake();
+    block.SetNewFormatBlock();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    BOOST_REQUIRE(SignBlock(block, keystore));
+    CBlock blockTampered(block);
+    BOOST_CHECK(CheckBlockSignature(block));
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), false));
+
+    // The signature is not covered by the block hash: a copy of the block with
+    // a tampered one is refused when it is received, without the block being
+    // taken for invalid
+    blockTampered.vchBlockSig.back() ^= 1;
+    BOOST_CHECK(blockTampered.GetHash() == block.GetHash());
+    BOOST_CHECK(!CheckBlockSignature(blockTampered));
+    CValidationState stateTampered;
+    BOOST_CHECK(!CheckBlock(blockTampered, stateTampered, Params().GetConsensus(), false));
+    BOOST_CHECK_EQUAL(stateTampered.GetRejectReason(), "bad-blk-sign");
+    BOOST_CHECK(stateTampered.CorruptionPossible());
+    // and it is not remembered as checked
+    BOOST_CHECK(!blockTampered.fChecked);
+
+    block.nTime++;
+    BOOST_CHECK(!CheckBlockSignature(block));
+
+    // A proof-of-stake block without a coinstake has no signature to check
+    CBlock blockNoStake(block);
+    blockNoStake.vtx.resize(1);
+    BOOST_CHECK(!CheckBlockSignature(blockNoStake));
+}
+
+BOOST_AUTO_TEST_CASE(block_signature_check)
+{
+    const int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 0;
+    TestBlockSignatureCheck();
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
+// With script check threads, CheckBlock() verifies the signature on them
+BOOST_FIXTURE_TEST_CASE(block_signature_check_queued, TestingSetup)
+{
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    TestBlockSignatureCheck();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
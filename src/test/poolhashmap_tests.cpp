@@ -0,0 +1,174 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <poolhashmap.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(poolhashmap_tests, BasicTestingSetup)
+
+typedef PoolHashMap<COutPoint, uint64_t, SaltedOutpointHasher> TestMap;
+
+static COutPoint RandOutPoint()
+{
+    return COutPoint(InsecureRand256(), InsecureRandRange(4));
+}
+
+static void CheckEqual(const TestMap& map, const std::map<COutPoint, uint64_t>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t n = 0;
+    for (const auto& item : map) {
+        auto it = expected.find(item.first);
+        BOOST_CHECK(it != expected.end() && it->second == item.second);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, expected.size());
+    for (const auto& item : expected) {
+        auto it = map.find(item.first);
+        BOOST_CHECK(it != map.end() && it->second == item.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(poolhashmap_random_operations)
+{
+    TestMap map;
+    std::map<COutPoint, uint64_t> expected;
+    std::vector<COutPoint> vKeys;
+
+    for (int i = 0; i < 100000; i++) {
+        const int op = InsecureRandRange(10);
+        if (op < 5 || vKeys.empty()) {
+            // Insert a new key or overwrite an existing one
+            const COutPoint key = vKeys.empty() || InsecureRandBool() ? RandOutPoint() : vKeys[InsecureRandRange(vKeys.size())];
+            const uint64_t value = InsecureRand32();
+            if (!expected.count(key))
+                vKeys.push_back(key);
+            if (InsecureRandBool()) {
+                map[key] = value;
+            } else {
+                auto ret = map.emplace(key, value);
+                BOOST_CHECK_EQUAL(ret.second, !expected.count(key));
+                ret.first->second = value;
+            }
+            expected[key] = value;
+        } else if (op < 9) {
+            // Erase a key, by key or by iterator
+            const size_t n = InsecureRandRange(vKeys.size());
+            const COutPoint key = vKeys[n];
+            vKeys[n] = vKeys.back();
+            vKeys.pop_back();
+            if (InsecureRandBool()) {
+                BOOST_CHECK_EQUAL(map.erase(key), 1);
+            } else {
+                auto it = map.find(key);
+                BOOST_CHECK(it != map.end());
+                map.erase(it);
+            }
+            expected.erase(key);
+            BOOST_CHECK_EQUAL(map.erase(key), 0);
+        } else {
+            // Look up a key that is not there
+            BOOST_CHECK(map.find(RandOutPoint()) == map.end());
+            BOOST_CHECK_EQUAL(map.count(RandOutPoint()), 0);
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+        if (i % 10000 == 0)
+            CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+    BOOST_CHECK(map.size() <= map.bucket_count() * 3 / 4);
+
+    // Moves and swaps
+    TestMap moved(std::move(map));
+    CheckEqual(moved, expected);
+    BOOST_CHECK(map.empty());
+    TestMap other;
+    other[RandOutPoint()] = 1;
+    other.swap(moved);
+    CheckEqual(other, expected);
+    BOOST_CHECK_EQUAL(moved.size(), 1);
+    moved = std::move(other);
+    CheckEqual(moved, expected);
+
+    moved.clear();
+    BOOST_CHECK(moved.empty());
+    BOOST_CHECK(moved.begin() == moved.end());
+    BOOST_CHECK_EQUAL(moved.memory_usage(), 0);
+    for (const auto& item : expected)
+        BOOST_CHECK(moved.find(item.first) == moved.end());
+}
+
+BOOST_AUTO_TEST_CASE(poolhashmap_stable_references)
+{
+    // Elements never move, even when the table grows under them
+    TestMap map;
+    std::vector<std::pair<COutPoint, const uint64_t*> > vRefs;
+    for (uint64_t i = 0; i < 10000; i++) {
+        const COutPoint key = RandOutPoint();
+        auto ret = map.emplace(key, i);
+        if (ret.second)
+            vRefs.emplace_back(key, &ret.first->second);
+    }
+    BOOST_CHECK_EQUAL(map.size(), vRefs.size());
+    for (const auto& ref : vRefs)
+        BOOST_CHECK_EQUAL(&map.at(ref.first), ref.second);
+
+    // Erased nodes are reused rather than allocated again
+    const size_t nUsage = map.memory_usage();
+    for (size_t i = 0; i < vRefs.size(); i += 2)
+        map.erase(vRefs[i].first);
+    for (size_t i = 0; i < vRefs.size(); i += 2)
+        map[RandOutPoint()] = i;
+    BOOST_CHECK_EQUAL(map.memory_usage(), nUsage);
+    for (size_t i = 1; i < vRefs.size(); i += 2)
+        BOOST_CHECK_EQUAL(&map.at(vRefs[i].first), vRefs[i].second);
+    BOOST_CHECK_THROW(map.at(RandOutPoint()), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(poolhashmap_erase_while_iterating)
+{
+    // Erasing an element keeps the iteration going over all the others,
+    // as CCoinsViewCache::BatchWrite and CCoinsViewCache::Flush expect
+    PoolHashMap<COutPoint, std::shared_ptr<int>, SaltedOutpointHasher> map;
+    auto value = std::make_shared<int>(0);
+    std::map<COutPoint, int> expected;
+    for (int i = 0; i < 5000; i++) {
+        const COutPoint key = RandOutPoint();
+        map[key] = value;
+        expected[key] = 0;
+    }
+    BOOST_CHECK_EQUAL(value.use_count(), (long)(1 + map.size()));
+
+    size_t nVisited = 0;
+    for (auto it = map.begin(); it != map.end(); ) {
+        BOOST_CHECK_EQUAL(expected[it->first]++, 0);
+        nVisited++;
+        if (InsecureRandBool()) {
+            it = map.erase(it);
+        } else {
+            map.erase(it++);
+        }
+    }
+    BOOST_CHECK_EQUAL(nVisited, expected.size());
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(value.use_count(), 1);
+
+    // Tombstones left behind do not keep new keys from being found
+    for (const auto& item : expected) {
+        BOOST_CHECK(map.find(item.first) == map.end());
+        map[item.first] = value;
+    }
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    for (const auto& item : expected)
+        BOOST_CHECK(map.count(item.first));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -345,4 +345,40 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_setgenerate)
+{
+    const std::string strAddress = EncodeDestination(CKeyID(uint160()));
+    BOOST_CHECK_EQUAL(CallRPC("getgenerate").get_bool(), false);
+    BOOST_CHECK_EQUAL(CallRPC("gethashespersec").get_int64(), 0);
+
+    BOOST_CHECK_THROW(CallRPC("setgenerate"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("setgenerate true 1"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("setgenerate true 1 notanaddress"), std::runtime_error);
+    BOOST_CHECK_EQUAL(CallRPC("getgenerate").get_bool(), false);
+
+    // The miners wait for peers on this network, so they never find a block
+    BOOST_CHECK_NO_THROW(CallRPC("setgenerate true 2 " + strAddress));
+    BOOST_CHECK_EQUAL(CallRPC("getgenerate").get_bool(), true);
+    UniValue info = CallRPC("getmininginfo");
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "generate").get_bool(), true);
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "genproclimit").get_int(), 2);
+    BOOST_CHECK(CallRPC("gethashespersec").get_int64() >= 0);
+
+    // Restarting with another count replaces the threads
+    BOOST_CHECK_NO_THROW(CallRPC("setgenerate true 1 " + strAddress));
+    info = CallRPC("getmininginfo");
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "genproclimit").get_int(), 1);
+
+    // A limit of 0 turns generation off like false does
+    BOOST_CHECK_NO_THROW(CallRPC("setgenerate true 0"));
+    BOOST_CHECK_EQUAL(CallRPC("getgenerate").get_bool(), false);
+    BOOST_CHECK_EQUAL(CallRPC("gethashespersec").get_int64(), 0);
+    BOOST_CHECK_NO_THROW(CallRPC("setgenerate true 1 " + strAddress));
+    BOOST_CHECK_NO_THROW(CallRPC("setgenerate false"));
+    BOOST_CHECK_EQUAL(CallRPC("getgenerate").get_bool(), false);
+    info = CallRPC("getmininginfo");
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "generate").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "hashespersec").get_int64(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
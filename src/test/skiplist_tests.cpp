@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
 #include <util.h>
 #include <test/test_bitcoin.h>
 
@@ -177,4 +179,44 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_edge_test)
     BOOST_CHECK(!chain.FindEarliestAtLeast(int64_t(std::numeric_limits<unsigned int>::max()) + 1));
 }
 
+BOOST_AUTO_TEST_CASE(get_last_block_index_test)
+{
+    Consensus::Params params = Params().GetConsensus();
+    params.TLRHeight = 500;
+
+    // Two copies of a chain with proof-of-stake blocks from height 300 on,
+    // only one of which has its predecessor pointers built, so that
+    // GetLastBlockIndex() walks the other one back block by block
+    const int nBlocks = 3000;
+    std::vector<CBlockIndex> vBuilt(nBlocks), vWalked(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        const bool fProofOfStake = i >= 300 && InsecureRandRange(4) != 0;
+        for (std::vector<CBlockIndex>* pv : {&vBuilt, &vWalked}) {
+            CBlockIndex& block = (*pv)[i];
+            block.pprev = i ? &(*pv)[i - 1] : nullptr;
+            block.nHeight = i;
+            if (fProofOfStake)
+                block.SetProofOfStake();
+        }
+        vBuilt[i].BuildSkip();
+    }
+
+    for (int i = 0; i < nBlocks; i++) {
+        if (i > 0) {
+            const CBlockIndex* pindexPoW = vBuilt[i].pprevPoW;
+            BOOST_CHECK(pindexPoW && pindexPoW->IsProofOfWork() && pindexPoW->nHeight < i);
+            if (vBuilt[i].pprevPoS) {
+                BOOST_CHECK(vBuilt[i].pprevPoS->IsProofOfStake() && vBuilt[i].pprevPoS->nHeight < i);
+            }
+        }
+        for (bool fProofOfStake : {false, true}) {
+            const CBlockIndex* pindexBuilt = GetLastBlockIndex(&vBuilt[i], params, fProofOfStake);
+            const CBlockIndex* pindexWalked = GetLastBlockIndex(&vWalked[i], params, fProofOfStake);
+            BOOST_CHECK_EQUAL(pindexBuilt == nullptr, pindexWalked == nullptr);
+            if (pindexBuilt && pindexWalked)
+                BOOST_CHECK_EQUAL(pindexBuilt->nHeight, pindexWalked->nHeight);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <uint256hm.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(uint256hm_tests, BasicTestingSetup)
+
+template <typename T>
+static void CheckEqual(const uint256HashMap<T>& map, const std::map<uint256, T>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t n = 0;
+    for (const auto& item : map) {
+        auto it = expected.find(item.first);
+        BOOST_CHECK(it != expected.end() && it->second == item.second);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, expected.size());
+    for (const auto& item : expected) {
+        auto it = map.find(item.first);
+        BOOST_CHECK(it != map.end() && it->second == item.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(uint256hm_random_operations)
+{
+    uint256HashMap<uint64_t> map;
+    std::map<uint256, uint64_t> expected;
+    std::vector<uint256> vKeys;
+
+    for (int i = 0; i < 100000; i++) {
+        const int op = InsecureRandRange(10);
+        if (op < 5 || vKeys.empty()) {
+            // Insert a new key or overwrite an existing one
+            const uint256 key = vKeys.empty() || InsecureRandBool() ? InsecureRand256() : vKeys[InsecureRandRange(vKeys.size())];
+            const uint64_t value = InsecureRand32();
+            if (!expected.count(key))
+                vKeys.push_back(key);
+            if (InsecureRandBool()) {
+                map[key] = value;
+            } else {
+                auto ret = map.emplace(key, value);
+                BOOST_CHECK_EQUAL(ret.second, !expected.count(key));
+                ret.first->second = value;
+            }
+            expected[key] = value;
+        } else if (op < 9) {
+            // Erase a key, by key or by iterator
+            const size_t n = InsecureRandRange(vKeys.size());
+            const uint256 key = vKeys[n];
+            vKeys[n] = vKeys.back();
+            vKeys.pop_back();
+            if (InsecureRandBool()) {
+                BOOST_CHECK_EQUAL(map.erase(key), 1);
+            } else {
+                auto it = map.find(key);
+                BOOST_CHECK(it != map.end());
+                map.erase(it);
+            }
+            expected.erase(key);
+            BOOST_CHECK_EQUAL(map.erase(key), 0);
+        } else {
+            // Look up a key that is not there
+            BOOST_CHECK(map.find(InsecureRand256()) == map.end());
+            BOOST_CHECK_EQUAL(map.count(InsecureRand256()), 0);
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+        if (i % 10000 == 0)
+            CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+    BOOST_CHECK(map.size() <= map.bucket_count() * 3 / 4);
+
+    // Copies, moves and swaps
+    uint256HashMap<uint64_t> copy(map);
+    CheckEqual(copy, expected);
+    uint256HashMap<uint64_t> moved(std::move(copy));
+    CheckEqual(moved, expected);
+    BOOST_CHECK(copy.empty());
+    uint256HashMap<uint64_t> other;
+    other[InsecureRand256()] = 1;
+    other.swap(moved);
+    CheckEqual(other, expected);
+    BOOST_CHECK_EQUAL(moved.size(), 1);
+    moved = other;
+    CheckEqual(moved, expected);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    for (const auto& item : expected)
+        BOOST_CHECK(map.find(item.first) == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(uint256hm_erase_all)
+{
+    // Fill a small table to its maximum load, so that runs of used slots
+    // wrap around the end, then empty it in random order
+    uint256HashMap<std::shared_ptr<int> > map;
+    map.reserve(48);
+    const size_t nCapacity = map.bucket_count();
+    std::vector<uint256> vKeys;
+    auto value = std::make_shared<int>(0);
+    for (size_t i = 0; i < nCapacity * 3 / 4; i++) {
+        vKeys.push_back(InsecureRand256());
+        map[vKeys.back()] = value;
+    }
+    BOOST_CHECK_EQUAL(map.bucket_count(), nCapacity);
+    BOOST_CHECK_EQUAL(value.use_count(), (long)(1 + vKeys.size()));
+
+    while (!vKeys.empty()) {
+        const size_t n = InsecureRandRange(vKeys.size());
+        BOOST_CHECK_EQUAL(map.erase(vKeys[n]), 1);
+        vKeys[n] = vKeys.back();
+        vKeys.pop_back();
+        for (const uint256& key : vKeys)
+            BOOST_CHECK(map.count(key));
+        BOOST_CHECK_EQUAL(value.use_count(), (long)(1 + vKeys.size()));
+    }
+    BOOST_CHECK(map.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
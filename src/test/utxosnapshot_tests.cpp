@@ -0,0 +1,358 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <utxosnapshot.h>
+
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <coinstats.h>
+#include <fs.h>
+#include <kernel.h>
+#include <pow.h>
+#include <random.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <utilstrencodings.h>
+#include <validation.h>
+#include <versionbits.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, BasicTestingSetup)
+
+static CSnapshotTx RandomSnapshotTx(int nHeight = 100)
+{
+    CSnapshotTx tx;
+    tx.txid = InsecureRand256();
+    tx.nTxOffset = InsecureRandRange(1 << 20);
+    for (uint32_t n = 0; n < 1 + InsecureRandRange(4); n++) {
+        Coin coin;
+        coin.out.nValue = InsecureRandRange(1000000);
+        coin.out.scriptPubKey.assign(InsecureRandRange(4000), 0x51);
+        coin.nHeight = nHeight;
+        // Coins of legacy blocks are stored without their time
+        coin.nTime = Params().isLegacyBlock(coin.nHeight) ? 0 : InsecureRand32();
+        tx.vCoins.emplace_back(n * 3, std::move(coin));
+    }
+    return tx;
+}
+
+/** Write a header, a section of a few chunks and a footer, returning the records of the section */
+static std::vector<CSnapshotTx> WriteSnapshot(const fs::path& path)
+{
+    std::vector<CSnapshotTx> txs;
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    fileout << CSnapshotHeader(Params().MessageStart(), InsecureRand256(), 42);
+    CSnapshotChunkWriter writer(fileout);
+    size_t nSize = 0;
+    while (nSize < 3 * SNAPSHOT_CHUNK_SIZE) {
+        txs.push_back(RandomSnapshotTx());
+        writer << txs.back();
+        nSize += GetSerializeSize(txs.back(), SER_DISK, CLIENT_VERSION);
+    }
+    writer.Finish();
+    CSnapshotFooter footer;
+    footer.nCoins = txs.size();
+    fileout << footer;
+    return txs;
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_chunks_roundtrip)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    const std::vector<CSnapshotTx> txs = WriteSnapshot(path);
+
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    CSnapshotHeader header;
+    filein >> header;
+    BOOST_CHECK_EQUAL(header.nHeight, 42);
+    BOOST_CHECK(memcmp(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart)) == 0);
+
+    CSnapshotChunkReader reader(filein);
+    size_t i = 0;
+    while (reader.HaveMore()) {
+        CSnapshotTx tx;
+        reader >> tx;
+        BOOST_REQUIRE(i < txs.size());
+        BOOST_CHECK(tx.txid == txs[i].txid);
+        BOOST_CHECK_EQUAL(tx.nTxOffset, txs[i].nTxOffset);
+        BOOST_REQUIRE_EQUAL(tx.vCoins.size(), txs[i].vCoins.size());
+        for (size_t j = 0; j < tx.vCoins.size(); j++) {
+            BOOST_CHECK_EQUAL(tx.vCoins[j].first, txs[i].vCoins[j].first);
+            BOOST_CHECK(tx.vCoins[j].second.out == txs[i].vCoins[j].second.out);
+            BOOST_CHECK_EQUAL(tx.vCoins[j].second.nTime, txs[i].vCoins[j].second.nTime);
+        }
+        i++;
+    }
+    BOOST_CHECK_EQUAL(i, txs.size());
+    CSnapshotTx tx;
+    BOOST_CHECK_THROW(reader >> tx, std::ios_base::failure);
+
+    CSnapshotFooter footer;
+    filein >> footer;
+    BOOST_CHECK_EQUAL(footer.nCoins, txs.size());
+    filein.fclose();
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_chunks_corrupt)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    const std::vector<CSnapshotTx> txs = WriteSnapshot(path);
+
+    // Flip a byte in the second chunk
+    FILE* file = fsbridge::fopen(path, "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, SNAPSHOT_CHUNK_SIZE * 3 / 2, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, SNAPSHOT_CHUNK_SIZE * 3 / 2, SEEK_SET);
+    fputc(c ^ 1, file);
+    fclose(file);
+
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    CSnapshotHeader header;
+    filein >> header;
+    CSnapshotChunkReader reader(filein);
+    size_t i = 0;
+    BOOST_CHECK_THROW({
+        while (reader.HaveMore()) {
+            CSnapshotTx tx;
+            reader >> tx;
+            i++;
+        }
+    }, std::ios_base::failure);
+    BOOST_CHECK(i > 0 && i < txs.size());
+    filein.fclose();
+
+    // A file that is not a snapshot is refused by its header
+    file = fsbridge::fopen(path, "r+b");
+    fputc('x', file);
+    fclose(file);
+    CAutoFile filebad(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(filebad >> header, std::ios_base::failure);
+    filebad.fclose();
+    fs::remove(path);
+}
+
+/** Nonces of a testnet header chain on top of the genesis block, with the
+ *  headers WriteChainSnapshot makes up: at the minimum difficulty, which they
+ *  are as they are 20 minutes apart */
+static const uint32_t TESTNET_NONCES[] = {
+    3777381, 893424, 156220, 448638, 776345, 55281, 62258, 265023, 350038, 721,
+    558, 685, 94, 159, 61, 55, 305, 915, 63, 427,
+    248, 89, 315, 88, 6, 18, 341, 44, 66, 74,
+};
+
+/** Write a snapshot of nBlocks blocks on top of the genesis block and of the
+ *  coins of txs, in the order given, returning its block hash. Up to the
+ *  length of TESTNET_NONCES the headers are valid on testnet; the entry at
+ *  nBadEntry gets a wrong stake modifier checksum. A null hashMuHash stands for
+ *  the hash of the coins. */
+static uint256 WriteChainSnapshot(const fs::path& path, int nBlocks, const std::vector<CSnapshotTx>& txs, uint256 hashMuHash = uint256(), int nBadEntry = 0)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    // The index entries the blocks would get, to compute their stake fields the way connecting them does
+    std::vector<CBlockIndex> index(nBlocks + 1);
+    std::vector<uint256> hashes(nBlocks + 1);
+    index[0] = *chainActive.Genesis();
+    std::vector<CSnapshotBlock> records;
+    for (int nHeight = 1; nHeight <= nBlocks; nHeight++) {
+        CBlockIndex* pindexPrev = &index[nHeight - 1];
+        CBlockHeader block;
+        // Signalling segwit, which activates on testnet after two windows of 8 blocks
+        block.nVersion = VERSIONBITS_TOP_BITS | (1 << consensusParams.vDeployments[Consensus::DEPLOYMENT_SEGWIT].bit);
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.hashMerkleRoot = ArithToUint256(arith_uint256(nHeight));
+        block.nTime = pindexPrev->nTime + 20 * 60;
+        block.nBits = GetNextWorkRequired(pindexPrev, &block, consensusParams, false);
+        if (nHeight <= (int)ARRAYLEN(TESTNET_NONCES))
+            block.nNonce = TESTNET_NONCES[nHeight - 1];
+
+        CBlockIndex* pindex = &index[nHeight];
+        *pindex = CBlockIndex(block);
+        hashes[nHeight] = block.GetHash();
+        pindex->phashBlock = &hashes[nHeight];
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = nHeight;
+        uint64_t nStakeModifier;
+        bool fGeneratedStakeModifier;
+        BOOST_REQUIRE(ComputeNextStakeModifier(pindex, nStakeModifier, fGeneratedStakeModifier));
+        pindex->SetStakeEntropyBit(CBlock(block).GetStakeEntropyBit(nHeight));
+        pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+
+        CSnapshotBlock record;
+        record.nVersion = block.nVersion;
+        record.hashMerkleRoot = block.hashMerkleRoot;
+        record.nTime = block.nTime;
+        record.nBits = block.nBits;
+        record.nNonce = block.nNonce;
+        record.nTx = 1;
+        record.nFlags = pindex->nFlags;
+        record.nStakeModifier = pindex->nStakeModifier;
+        record.nStakeModifierChecksum = pindex->nStakeModifierChecksum ^ (nHeight == nBadEntry);
+        records.push_back(record);
+    }
+
+    CCoinsSetStats stats;
+    uint64_t nCoins = 0;
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    fileout << CSnapshotHeader(Params().MessageStart(), hashes.back(), nBlocks);
+    CSnapshotChunkWriter blocks(fileout);
+    for (const CSnapshotBlock& record : records)
+        blocks << record;
+    blocks.Finish();
+    CSnapshotChunkWriter coins(fileout);
+    for (const CSnapshotTx& tx : txs) {
+        coins << tx;
+        for (const std::pair<uint32_t, Coin>& output : tx.vCoins) {
+            stats.AddCoin(COutPoint(tx.txid, output.first), output.second);
+            nCoins++;
+        }
+    }
+    coins.Finish();
+    CSnapshotFooter footer;
+    footer.nCoins = nCoins;
+    footer.hashMuHash = hashMuHash.IsNull() ? stats.GetHash() : hashMuHash;
+    fileout << footer;
+    return hashes.back();
+}
+
+static uint256 SnapshotMuHash(const std::vector<CSnapshotTx>& txs)
+{
+    CCoinsSetStats stats;
+    for (const CSnapshotTx& tx : txs) {
+        for (const std::pair<uint32_t, Coin>& output : tx.vCoins)
+            stats.AddCoin(COutPoint(tx.txid, output.first), output.second);
+    }
+    return stats.GetHash();
+}
+
+static std::vector<CSnapshotTx> SortedSnapshotTxs(int nHeight)
+{
+    std::vector<CSnapshotTx> txs;
+    for (int i = 0; i < 10; i++)
+        txs.push_back(RandomSnapshotTx(1 + InsecureRandRange(nHeight)));
+    std::sort(txs.begin(), txs.end(), [](const CSnapshotTx& a, const CSnapshotTx& b) { return a.txid < b.txid; });
+    return txs;
+}
+
+BOOST_FIXTURE_TEST_CASE(snapshot_load_rejected, TestingSetup)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    const std::vector<CSnapshotTx> txs = SortedSnapshotTxs(2);
+    const uint256 hashMuHash = SnapshotMuHash(txs);
+    fPruneMode = true;
+
+    CCoinsSetStats stats;
+    std::string strError;
+    uint256 hashBlock = WriteChainSnapshot(path, 2, txs);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, InsecureRand256(), hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find("not of the expected block") != std::string::npos);
+
+    // The testnet headers do not have the proof of work of the main network
+    stats = CCoinsSetStats();
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find("invalid block header") != std::string::npos);
+
+    // The made up blocks are not those of the checkpoints
+    const int nCheckpoint = Params().Checkpoints().mapCheckpoints.begin()->first;
+    stats = CCoinsSetStats();
+    hashBlock = WriteChainSnapshot(path, nCheckpoint, txs);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find(strprintf("checkpoint at height %d", nCheckpoint)) != std::string::npos);
+
+    // A rejected snapshot leaves the node as it was
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+    BOOST_CHECK(!pcoinsStats);
+
+    fPruneMode = false;
+    fs::remove(path);
+}
+
+struct TestnetTestingSetup : public TestingSetup {
+    TestnetTestingSetup() : TestingSetup(CBaseChainParams::TESTNET) {}
+};
+
+BOOST_FIXTURE_TEST_CASE(snapshot_load, TestnetTestingSetup)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    const int nBlocks = ARRAYLEN(TESTNET_NONCES);
+    std::vector<CSnapshotTx> txs = SortedSnapshotTxs(nBlocks);
+    const uint256 hashMuHash = SnapshotMuHash(txs);
+    fPruneMode = true;
+
+    // Snapshots that are bad past their headers
+    CCoinsSetStats stats;
+    std::string strError;
+    uint256 hashBlock = WriteChainSnapshot(path, nBlocks, txs, InsecureRand256());
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find("do not match its hash") != std::string::npos);
+
+    stats = CCoinsSetStats();
+    BOOST_CHECK(WriteChainSnapshot(path, nBlocks, txs) == hashBlock);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, InsecureRand256(), stats, strError));
+    BOOST_CHECK(strError.find("not the expected") != std::string::npos);
+
+    std::swap(txs[3], txs[4]);
+    stats = CCoinsSetStats();
+    WriteChainSnapshot(path, nBlocks, txs);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find("out of order") != std::string::npos);
+    std::swap(txs[3], txs[4]);
+
+    stats = CCoinsSetStats();
+    WriteChainSnapshot(path, nBlocks, txs, uint256(), 20);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK(strError.find("invalid block index entry at height 20") != std::string::npos);
+
+    // The headers stay, as header sync would keep them, but without stake fields
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), (size_t)nBlocks + 1);
+    for (const BlockMap::value_type& entry : mapBlockIndex) {
+        if (entry.second->pprev) {
+            BOOST_CHECK_EQUAL(entry.second->nFlags, 0U);
+            BOOST_CHECK_EQUAL(entry.second->nStakeModifier, 0U);
+            BOOST_CHECK_EQUAL(entry.second->nStakeModifierChecksum, 0U);
+        }
+    }
+
+    stats = CCoinsSetStats();
+    WriteChainSnapshot(path, nBlocks, txs);
+    BOOST_CHECK(LoadUTXOSnapshot(Params(), path, hashBlock, hashMuHash, stats, strError));
+    BOOST_CHECK_EQUAL(chainActive.Height(), nBlocks);
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+
+    // The loaded coins are those a scan of the database finds, as gettxoutsetinfo would
+    CCoinsSetStats scan;
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        scan.AddCoin(key, coin);
+    }
+    BOOST_CHECK_EQUAL(scan.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK(scan.GetHash() == stats.GetHash());
+    BOOST_REQUIRE(pcoinsStats);
+    BOOST_CHECK(pcoinsStats->GetHash() == stats.GetHash());
+
+    // Blocks past the activation of segwit are taken as having their witness
+    // data, or they would be disconnected again on every start
+    BOOST_CHECK(IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus()));
+    for (int nHeight = 1; nHeight <= nBlocks; nHeight++)
+        BOOST_CHECK_EQUAL((bool)(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS), IsWitnessEnabled(chainActive[nHeight - 1], Params().GetConsensus()));
+    BOOST_CHECK(RewindBlockIndex(Params()));
+    BOOST_CHECK_EQUAL(chainActive.Height(), nBlocks);
+
+    pcoinsStats.reset();
+    fPruneMode = false;
+    fHavePruned = false;
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
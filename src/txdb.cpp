@@ -6,6 +6,7 @@
 #include <txdb.h>
 
 #include <chainparams.h>
+#include <coinstats.h>
 #include <hash.h>
 #include <random.h>
 #include <pow.h>
@@ -22,10 +23,12 @@ static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_STAKE_ORIGIN = 'o';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_COINS_STATS = 'S';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -54,25 +57,59 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), fWriteFailed(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    Sync();
+}
+
+std::shared_ptr<const CCoinsViewDB::PendingWrite> CCoinsViewDB::GetPendingWrite() const {
+    LOCK(cs_pending);
+    return pendingWrite;
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    // Coins still being written are newer than the database
+    std::shared_ptr<const PendingWrite> pending = GetPendingWrite();
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->mapCoins.find(outpoint);
+        if (it != pending->mapCoins.end()) {
+            if (it->second.coin.IsSpent())
+                return false;
+            coin = it->second.coin;
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    std::shared_ptr<const PendingWrite> pending = GetPendingWrite();
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->mapCoins.find(outpoint);
+        if (it != pending->mapCoins.end())
+            return !it->second.coin.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
-uint256 CCoinsViewDB::GetBestBlock() const {
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
+uint256 CCoinsViewDB::GetBestBlock() const {
+    std::shared_ptr<const PendingWrite> pending = GetPendingWrite();
+    if (pending)
+        return pending->hashBlock;
+    return ReadBestBlock();
+}
+
 std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     std::vector<uint256> vhashHeadBlocks;
     if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
@@ -82,6 +119,80 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    LOCK(cs_write);
+    if (!Sync())
+        return false;
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    // The entries are dropped all at once, which frees the memory of the map
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteSnapshotCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal) {
+    LOCK(cs_write);
+    if (!Sync())
+        return false;
+    bool ret = WriteCoins(mapCoins, hashBlock, fFinal);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock, size_t nUsage) {
+    LOCK(cs_write);
+    if (!Sync())
+        return false;
+    std::shared_ptr<PendingWrite> pending = std::make_shared<PendingWrite>();
+    pending->mapCoins.swap(mapCoins);
+    pending->hashBlock = hashBlock;
+    pending->nUsage = nUsage;
+    {
+        LOCK(cs_pending);
+        pendingWrite = pending;
+    }
+    threadWrite = std::thread(&CCoinsViewDB::ThreadWrite, this, std::move(pending));
+    return true;
+}
+
+void CCoinsViewDB::ThreadWrite(std::shared_ptr<const PendingWrite> pending) {
+    RenameThread("taler-coinsflush");
+    int64_t nStart = GetTimeMicros();
+    bool fOk = false;
+    try {
+        fOk = WriteCoins(pending->mapCoins, pending->hashBlock);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (!fOk) {
+        // Keep serving the coins, which are not (all) on disk
+        fWriteFailed = true;
+        return;
+    }
+    LogPrint(BCLog::COINDB, "Background write of %u coins took %.2fs\n", (unsigned int)pending->mapCoins.size(), (GetTimeMicros() - nStart) * 0.000001);
+    LOCK(cs_pending);
+    pendingWrite.reset();
+}
+
+bool CCoinsViewDB::Sync() const {
+    LOCK(cs_write);
+    if (threadWrite.joinable())
+        threadWrite.join();
+    return !fWriteFailed;
+}
+
+bool CCoinsViewDB::IsWriting() const {
+    return GetPendingWrite() != nullptr;
+}
+
+bool CCoinsViewDB::HasWriteFailed() const {
+    return fWriteFailed;
+}
+
+size_t CCoinsViewDB::GetPendingUsage() const {
+    std::shared_ptr<const PendingWrite> pending = GetPendingWrite();
+    return pending ? pending->nUsage : 0;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -89,7 +200,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip = ReadBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -106,7 +217,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -116,8 +227,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -133,8 +242,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     }
 
     // In the last batch, mark the database as consistent with hashBlock again.
-    batch.Erase(DB_HEAD_BLOCKS);
-    batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (fFinal) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -142,6 +253,14 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::ReadStats(CCoinsSetStats &stats) const {
+    return db.Read(DB_COINS_STATS, stats);
+}
+
+bool CCoinsViewDB::WriteStats(const CCoinsSetStats &stats) {
+    return db.Write(DB_COINS_STATS, stats);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -172,6 +291,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Iterate over the database once it holds every coin handed over
+    Sync();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -247,6 +368,17 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadStakeTxOrigin(const uint256 &txid, CStakeTxOrigin &origin) {
+    return Read(std::make_pair(DB_STAKE_ORIGIN, txid), origin);
+}
+
+bool CBlockTreeDB::WriteStakeTxOrigins(const std::vector<std::pair<uint256, CStakeTxOrigin> >&vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CStakeTxOrigin> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(std::make_pair(DB_STAKE_ORIGIN, it->first), it->second);
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -9,13 +9,18 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <sync.h>
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 class CBlockIndex;
+class CCoinsSetStats;
 class CCoinsViewDBCursor;
 class uint256;
 
@@ -63,13 +68,64 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** Where a transaction sits in the active chain, as far as the stake kernel
+ *  of a coinstake spending one of its outputs is concerned: the height of its
+ *  block and its offset from the start of the block, header included. */
+struct CStakeTxOrigin
+{
+    int nHeight;
+    unsigned int nTxOffset;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(VARINT(nTxOffset));
+    }
+
+    CStakeTxOrigin(int nHeightIn, unsigned int nTxOffsetIn) : nHeight(nHeightIn), nTxOffset(nTxOffsetIn) {}
+
+    CStakeTxOrigin() : nHeight(0), nTxOffset(0) {}
+};
+
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * Besides BatchWrite, which writes synchronously, coins can be handed over to be
+ * written on a background thread with BatchWriteAsync. Until they are on disk, the
+ * view serves lookups from them and reports their best block, so that it always
+ * reflects the last batch handed over. At most one write is in progress at a time.
+ */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /** Coins handed over to BatchWriteAsync and the best block they lead to */
+    struct PendingWrite {
+        CCoinsMap mapCoins;
+        uint256 hashBlock;
+        size_t nUsage;
+    };
+
+    //! Held while a background write is started or waited for
+    mutable CCriticalSection cs_write;
+    mutable std::thread threadWrite;
+    //! Set by threadWrite when a background write failed
+    std::atomic<bool> fWriteFailed;
+    //! Guards pendingWrite, which is set until the coins it holds are on disk
+    mutable CCriticalSection cs_pending;
+    std::shared_ptr<const PendingWrite> pendingWrite;
+
+    std::shared_ptr<const PendingWrite> GetPendingWrite() const;
+    uint256 ReadBestBlock() const;
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal = true);
+    void ThreadWrite(std::shared_ptr<const PendingWrite> pending);
+
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -78,6 +134,33 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Take the coins in mapCoins, leaving it empty, and write them on a background
+     * thread once the write in progress, if any, is done. nUsage is the memory they
+     * take, reported by GetPendingUsage until they are written. Returns false if an
+     * earlier background write failed.
+     */
+    bool BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock, size_t nUsage);
+    //! Wait for the background write in progress, if any. Returns false if it failed.
+    bool Sync() const;
+    //! Whether a background write is in progress (or failed)
+    bool IsWriting() const;
+    //! Whether a background write failed, leaving coins that are not on disk
+    bool HasWriteFailed() const;
+    //! Memory taken by the coins of the background write in progress
+    size_t GetPendingUsage() const;
+
+    /**
+     * Write the coins of a UTXO snapshot of block hashBlock, in as many calls as it takes.
+     * Until the call with fFinal, the database stays marked as in transition to hashBlock,
+     * so that a load that is interrupted is not taken for the whole set.
+     */
+    bool WriteSnapshotCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal);
+
+    //! Read the running UTXO set statistics last written, which may be for another block than the coins
+    bool ReadStats(CCoinsSetStats &stats) const;
+    bool WriteStats(const CCoinsSetStats &stats);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -121,6 +204,8 @@ public:
     bool ReadReindexing(bool &fReindexing);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    bool ReadStakeTxOrigin(const uint256 &txid, CStakeTxOrigin &origin);
+    bool WriteStakeTxOrigins(const std::vector<std::pair<uint256, CStakeTxOrigin> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
@@ -1,148 +1,442 @@
-/*
- * HashMap container for uint256 index -> value
- * Part of EmerCoin project.
- *
- */
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#ifndef EMC_UINT256HM_H
-#define EMC_UINT256HM_H
+#ifndef BITCOIN_UINT256HM_H
+#define BITCOIN_UINT256HM_H
 
-#include "uint256.h"
+#include <hash.h>
 #include <random.h>
-#include <arith_uint256.h>
-#include <util.h>
+#include <uint256.h>
 
-// Container - debug version
-template<class DATA>
-  class uint256HashMap {
-public:
-    struct Data {
-	Data() : next(-1) {}
-	int32_t  next; // -1 = EMPTY; -2 = END
-    arith_uint256  key;
-	DATA     value;
-    };
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
 
-   uint256HashMap() : m_head(-2), m_mask(0), m_allowed(0), m_randseed((uint32_t)GetRand(1 << 30)), m_data(NULL) {};
-  ~uint256HashMap() { Set(0); };
-
-  void Set(uint32_t size) {
-    // delete data if exist and needed
-    if(size == 0) {
-      delete [] m_data;
-      m_data = NULL;
-      m_head = -2;
-      return;
-    }
-    // Ignore 2nd Set()
-    if(m_data)
-      return;
-
-    // compute size 2^n
-    size += size >> 2; // Add 1/4 reserved 
-    if((int32_t)size < 0)
-	m_mask = 0x80000000;
-    else
-        for(m_mask = 8; m_mask < size; m_mask <<= 1);
-
-    LogPrintf("uint256HashMap:Set(%u/%u) data=%u sz=%u\n", size, m_mask, (unsigned)sizeof(struct Data), (unsigned)(m_mask * sizeof(struct Data)));
-    // allocate memory
-    m_data = new Data[m_mask];
-    // set allowed counter - Max population is 7/8
-    m_allowed = m_mask - (m_mask >> 3);
-    // set real mask
-    m_mask--;
-  } // Init
-
-  uint32_t size() const {
-      uint32_t x = m_mask + 1;
-      x -= x >> 3; // orig allowed
-      return x - m_allowed;
-  }
-
-  void clear() { // cleanup hashtable, no delete memory
-      if(m_head == -2)
-	  return;
-      for(uint32_t i = 0; i <= m_mask; i++)
-	  m_data[i].next = -1; // mark as free
-      uint32_t x = m_mask + 1;
-      m_allowed = x - (x >> 3);
-      m_head = -2;
-  }
-
-   Data *Search(const arith_uint256 &key) const {
-     Data *rc = Lookup(key);
-     return rc->next == -1? NULL : rc;
-   } // Search
-
-   Data *First() const {
-       return m_head < 0? NULL : m_data + m_head;
-   }
-
-   Data *Next(Data *cur) const {
-     // return cur->next < 0? NULL : m_data + cur->next;
-     return (uint32_t)cur->next >= (uint32_t)-2? NULL : 
-	 m_data + (cur->next & 0x7fffffff);
-   } // Next
-
-   // Mark for delete at next rehash
-   void MarkDel(Data *cur) {
-       cur->next |= 0x80000000;
-   }
-
-   Data *Insert(const arith_uint256 &key, DATA &value) {
-       if(m_allowed == 0) {
-	 // rehash to 2xN table
-         uint256HashMap<DATA> rehashed;
-	 rehashed.Set(m_mask << 1);
-	 Data *p;
-	 for(p = First(); p != NULL; p = Next(p))
-	   if(p->next >= -2)
-	     rehashed.Insert(p->key, p->value);
-         p = m_data;
-	 m_data    = rehashed.m_data;
-	 m_allowed = rehashed.m_allowed;
-	 m_mask    = rehashed.m_mask;
-	 m_head    = rehashed.m_head;
-	 m_randseed = rehashed.m_randseed;
-	 rehashed.m_data = p; // release current buffer
-       } // reahsh
-
-       Data *p = Lookup(key);
-       if(p->next == -1) { // empty cell
-         m_allowed--;
-	 p->next = m_head;
-	 m_head = p - m_data;
-	 p->key = key;
-       }
-       if(p->next != -2)
-         p->next &= 0x7fffffff; // Clear MarkDel, if exist
-       p->value = value;
-       return p;
-   }
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** Hash map from uint256 keys (transaction and block hashes) to T, with open
+ *  addressing.
+ *
+ *  Elements are stored in a single array of slots. A parallel array holds one
+ *  control byte per slot: EMPTY, or the low 7 bits of the hash of the key in
+ *  the slot. An element lives in the first free slot at or after the slot its
+ *  hash designates (its home), so a lookup compares the control bytes of 16
+ *  slots at a time, with SSE2 where available, from the home slot on until it
+ *  finds the key or an empty slot, and only compares the keys whose control
+ *  byte matches. The control bytes of the first slots are mirrored after the
+ *  last one, so that a group can be read past the end of the table without
+ *  wrapping. Erasing an element moves the elements that follow it back
+ *  towards their home slots instead of leaving a tombstone, so lookups never
+ *  get slower with churn.
+ *
+ *  Keys are hashed with SipHash and a per-map random key, so that they can
+ *  come from the network.
+ *
+ *  Unlike std::unordered_map, insertion and erasure move other elements:
+ *  they invalidate every iterator, pointer and reference into the map.
+ */
+template <typename T, typename Allocator = std::allocator<std::pair<const uint256, T> > >
+class uint256HashMap
+{
+public:
+    typedef uint256 key_type;
+    typedef T mapped_type;
+    typedef std::pair<const uint256, T> value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef Allocator allocator_type;
+    typedef value_type& reference;
+    typedef const value_type& const_reference;
 
 private:
+    typedef std::allocator_traits<Allocator> alloc_traits;
+    typedef typename alloc_traits::template rebind_alloc<value_type> slot_allocator;
+    typedef typename alloc_traits::template rebind_alloc<uint8_t> ctrl_allocator;
+    typedef std::allocator_traits<slot_allocator> slot_traits;
+    typedef std::allocator_traits<ctrl_allocator> ctrl_traits;
+
+    static const size_t GROUP_SIZE = 16;
+    static const uint8_t EMPTY = 0x80;
+    static const size_t NOT_FOUND = (size_t)-1;
+
+    slot_allocator m_alloc;
+    uint8_t* m_ctrl;       //!< capacity + GROUP_SIZE - 1 control bytes, or nullptr
+    value_type* m_slots;   //!< capacity slots, or nullptr
+    size_t m_capacity;     //!< 0 or a power of two, at least GROUP_SIZE
+    size_t m_size;
+    uint64_t m_k0, m_k1;   //!< SipHash key
 
-  // Return pointer to the found cell, or to an empty cell
-  Data *Lookup(const arith_uint256 &key) const {
-      const uint32_t *p = ((base_uint<256>*)&key)->GetDataPtr();
-      // Lowest part left; if changed, need modify indexes
-      uint32_t pos  = p[0];
-      uint32_t step = (p[1] ^ (p[2] + m_randseed)) | 1; // odd step
-      Data *rc;
-      do {
-	pos = (pos + step) & m_mask;
-	rc = m_data + pos;
-      } while((pos >= 0x7ffffffe) || (rc->next != -1 && memcmp(p, ((base_uint<256>*)&(rc->key))->GetDataPtr(), 256 / 8)));
-      return rc;
-  } // Lookup
-
-  int32_t   m_head;
-  uint32_t  m_mask;
-  uint32_t  m_allowed;
-  uint32_t  m_randseed;
-  Data     *m_data;
-
-}; // uint256HashMap
+    static int FirstBit(uint32_t x)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctz(x);
+#else
+        int n = 0;
+        while (!(x & 1)) {
+            x >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
 
+    /** Bit i is set if the control byte of slot pos + i is b */
+    static uint32_t MatchGroup(const uint8_t* group, uint8_t b)
+    {
+#if defined(__SSE2__)
+        const __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            if (group[i] == b)
+                mask |= 1 << i;
+        }
+        return mask;
 #endif
+    }
+
+    uint64_t Hash(const uint256& key) const { return SipHashUint256(m_k0, m_k1, key); }
+    size_t Home(uint64_t hash) const { return (hash >> 7) & (m_capacity - 1); }
+    static uint8_t Fingerprint(uint64_t hash) { return hash & 0x7f; }
+
+    void SetCtrl(size_t i, uint8_t b)
+    {
+        m_ctrl[i] = b;
+        if (i < GROUP_SIZE - 1)
+            m_ctrl[m_capacity + i] = b;
+    }
+
+    /** Slot holding key, or NOT_FOUND. If not found and pEmpty is given, set it to the slot key would be inserted in. */
+    size_t FindSlot(const uint256& key, uint64_t hash, size_t* pEmpty = nullptr) const
+    {
+        if (m_capacity == 0)
+            return NOT_FOUND;
+        const uint8_t fingerprint = Fingerprint(hash);
+        size_t pos = Home(hash);
+        while (true) {
+            const uint8_t* group = m_ctrl + pos;
+            for (uint32_t match = MatchGroup(group, fingerprint); match; match &= match - 1) {
+                const size_t i = (pos + FirstBit(match)) & (m_capacity - 1);
+                if (m_slots[i].first == key)
+                    return i;
+            }
+            const uint32_t empty = MatchGroup(group, EMPTY);
+            if (empty) {
+                if (pEmpty)
+                    *pEmpty = (pos + FirstBit(empty)) & (m_capacity - 1);
+                return NOT_FOUND;
+            }
+            pos = (pos + GROUP_SIZE) & (m_capacity - 1);
+        }
+    }
+
+    /** First empty slot at or after the home slot of hash */
+    size_t FindEmpty(uint64_t hash) const
+    {
+        size_t pos = Home(hash);
+        while (true) {
+            const uint32_t empty = MatchGroup(m_ctrl + pos, EMPTY);
+            if (empty)
+                return (pos + FirstBit(empty)) & (m_capacity - 1);
+            pos = (pos + GROUP_SIZE) & (m_capacity - 1);
+        }
+    }
+
+    /** At most 3/4 of the slots are used, which keeps runs of used slots short */
+    static size_t MaxLoad(size_t capacity) { return capacity - capacity / 4; }
+
+    void Allocate(size_t capacity)
+    {
+        ctrl_allocator ctrl_alloc(m_alloc);
+        m_ctrl = ctrl_traits::allocate(ctrl_alloc, capacity + GROUP_SIZE - 1);
+        memset(m_ctrl, EMPTY, capacity + GROUP_SIZE - 1);
+        m_slots = slot_traits::allocate(m_alloc, capacity);
+        m_capacity = capacity;
+    }
+
+    void Deallocate()
+    {
+        if (m_capacity == 0)
+            return;
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (m_ctrl[i] != EMPTY)
+                slot_traits::destroy(m_alloc, m_slots + i);
+        }
+        ctrl_allocator ctrl_alloc(m_alloc);
+        ctrl_traits::deallocate(ctrl_alloc, m_ctrl, m_capacity + GROUP_SIZE - 1);
+        slot_traits::deallocate(m_alloc, m_slots, m_capacity);
+        m_ctrl = nullptr;
+        m_slots = nullptr;
+        m_capacity = 0;
+    }
+
+    void Rehash(size_t capacity)
+    {
+        uint8_t* ctrl = m_ctrl;
+        value_type* slots = m_slots;
+        const size_t nOldCapacity = m_capacity;
+
+        Allocate(capacity);
+        for (size_t i = 0; i < nOldCapacity; i++) {
+            if (ctrl[i] == EMPTY)
+                continue;
+            const uint64_t hash = Hash(slots[i].first);
+            const size_t j = FindEmpty(hash);
+            slot_traits::construct(m_alloc, m_slots + j, std::move(slots[i]));
+            slot_traits::destroy(m_alloc, slots + i);
+            SetCtrl(j, Fingerprint(hash));
+        }
+
+        if (nOldCapacity) {
+            ctrl_allocator ctrl_alloc(m_alloc);
+            ctrl_traits::deallocate(ctrl_alloc, ctrl, nOldCapacity + GROUP_SIZE - 1);
+            slot_traits::deallocate(m_alloc, slots, nOldCapacity);
+        }
+    }
+
+    /** Make room for one more element. Returns whether the table was rehashed. */
+    bool Grow()
+    {
+        if (m_size + 1 <= MaxLoad(m_capacity))
+            return false;
+        Rehash(m_capacity ? 2 * m_capacity : GROUP_SIZE);
+        return true;
+    }
+
+    template <typename... Args>
+    std::pair<size_t, bool> EmplaceSlot(const uint256& key, Args&&... args)
+    {
+        const uint64_t hash = Hash(key);
+        size_t i = NOT_FOUND;
+        const size_t found = FindSlot(key, hash, &i);
+        if (found != NOT_FOUND)
+            return std::make_pair(found, false);
+        if (Grow())
+            i = FindEmpty(hash);
+        slot_traits::construct(m_alloc, m_slots + i, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        SetCtrl(i, Fingerprint(hash));
+        m_size++;
+        return std::make_pair(i, true);
+    }
+
+    void EraseSlot(size_t hole)
+    {
+        const size_t mask = m_capacity - 1;
+        slot_traits::destroy(m_alloc, m_slots + hole);
+        // Move back every element of the run that follows the hole whose home
+        // is not between the hole and itself
+        for (size_t j = (hole + 1) & mask; m_ctrl[j] != EMPTY; j = (j + 1) & mask) {
+            const size_t home = Home(Hash(m_slots[j].first));
+            if (((j - home) & mask) < ((j - hole) & mask))
+                continue;
+            slot_traits::construct(m_alloc, m_slots + hole, std::move(m_slots[j]));
+            slot_traits::destroy(m_alloc, m_slots + j);
+            SetCtrl(hole, m_ctrl[j]);
+            hole = j;
+        }
+        SetCtrl(hole, EMPTY);
+        m_size--;
+    }
+
+    template <typename Map, typename Value>
+    class iterator_base
+    {
+        Map* m_map;
+        size_t m_pos;
+
+        void SkipEmpty()
+        {
+            while (m_pos < m_map->m_capacity && m_map->m_ctrl[m_pos] == EMPTY)
+                m_pos++;
+        }
+
+        friend class uint256HashMap;
+        template <typename, typename> friend class iterator_base;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename uint256HashMap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef Value* pointer;
+        typedef Value& reference;
+
+        iterator_base() : m_map(nullptr), m_pos(0) {}
+        iterator_base(Map* map, size_t pos) : m_map(map), m_pos(pos) { SkipEmpty(); }
+        template <typename OtherMap, typename OtherValue>
+        iterator_base(const iterator_base<OtherMap, OtherValue>& other) : m_map(other.m_map), m_pos(other.m_pos) {}
+
+        reference operator*() const { return m_map->m_slots[m_pos]; }
+        pointer operator->() const { return &m_map->m_slots[m_pos]; }
+        iterator_base& operator++() { m_pos++; SkipEmpty(); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++*this; return copy; }
+        template <typename OtherMap, typename OtherValue>
+        bool operator==(const iterator_base<OtherMap, OtherValue>& other) const { return m_pos == other.m_pos; }
+        template <typename OtherMap, typename OtherValue>
+        bool operator!=(const iterator_base<OtherMap, OtherValue>& other) const { return m_pos != other.m_pos; }
+    };
+
+public:
+    typedef iterator_base<uint256HashMap, value_type> iterator;
+    typedef iterator_base<const uint256HashMap, const value_type> const_iterator;
+
+    explicit uint256HashMap(const Allocator& alloc = Allocator()) :
+        m_alloc(alloc), m_ctrl(nullptr), m_slots(nullptr), m_capacity(0), m_size(0),
+        m_k0(GetRand(std::numeric_limits<uint64_t>::max())), m_k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    uint256HashMap(const uint256HashMap& other) :
+        m_alloc(slot_traits::select_on_container_copy_construction(other.m_alloc)),
+        m_ctrl(nullptr), m_slots(nullptr), m_capacity(0), m_size(0), m_k0(other.m_k0), m_k1(other.m_k1)
+    {
+        if (other.m_capacity == 0)
+            return;
+        Allocate(other.m_capacity);
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (other.m_ctrl[i] != EMPTY)
+                slot_traits::construct(m_alloc, m_slots + i, other.m_slots[i]);
+        }
+        memcpy(m_ctrl, other.m_ctrl, m_capacity + GROUP_SIZE - 1);
+        m_size = other.m_size;
+    }
+
+    uint256HashMap(uint256HashMap&& other) noexcept :
+        m_alloc(std::move(other.m_alloc)), m_ctrl(other.m_ctrl), m_slots(other.m_slots),
+        m_capacity(other.m_capacity), m_size(other.m_size), m_k0(other.m_k0), m_k1(other.m_k1)
+    {
+        other.m_ctrl = nullptr;
+        other.m_slots = nullptr;
+        other.m_capacity = 0;
+        other.m_size = 0;
+    }
+
+    uint256HashMap& operator=(uint256HashMap other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~uint256HashMap() { Deallocate(); }
+
+    void swap(uint256HashMap& other)
+    {
+        using std::swap;
+        swap(m_alloc, other.m_alloc);
+        swap(m_ctrl, other.m_ctrl);
+        swap(m_slots, other.m_slots);
+        swap(m_capacity, other.m_capacity);
+        swap(m_size, other.m_size);
+        swap(m_k0, other.m_k0);
+        swap(m_k1, other.m_k1);
+    }
+
+    allocator_type get_allocator() const { return allocator_type(m_alloc); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    /** Number of slots */
+    size_t bucket_count() const { return m_capacity; }
+
+    /** Bytes allocated on the heap, control bytes included */
+    size_t memory_usage() const { return m_capacity ? m_capacity * sizeof(value_type) + m_capacity + GROUP_SIZE - 1 : 0; }
+
+    void clear()
+    {
+        if (m_size == 0)
+            return;
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (m_ctrl[i] != EMPTY)
+                slot_traits::destroy(m_alloc, m_slots + i);
+        }
+        memset(m_ctrl, EMPTY, m_capacity + GROUP_SIZE - 1);
+        m_size = 0;
+    }
+
+    /** Make room for n elements without rehashing */
+    void reserve(size_t n)
+    {
+        size_t capacity = m_capacity ? m_capacity : GROUP_SIZE;
+        while (MaxLoad(capacity) < n)
+            capacity *= 2;
+        if (capacity != m_capacity)
+            Rehash(capacity);
+    }
+
+    iterator find(const uint256& key)
+    {
+        const size_t i = FindSlot(key, Hash(key));
+        return i == NOT_FOUND ? end() : iterator(this, i);
+    }
+
+    const_iterator find(const uint256& key) const
+    {
+        const size_t i = FindSlot(key, Hash(key));
+        return i == NOT_FOUND ? end() : const_iterator(this, i);
+    }
+
+    size_t count(const uint256& key) const { return FindSlot(key, Hash(key)) != NOT_FOUND; }
+
+    T& at(const uint256& key)
+    {
+        const size_t i = FindSlot(key, Hash(key));
+        if (i == NOT_FOUND)
+            throw std::out_of_range("uint256HashMap::at");
+        return m_slots[i].second;
+    }
+
+    const T& at(const uint256& key) const
+    {
+        const size_t i = FindSlot(key, Hash(key));
+        if (i == NOT_FOUND)
+            throw std::out_of_range("uint256HashMap::at");
+        return m_slots[i].second;
+    }
+
+    T& operator[](const uint256& key)
+    {
+        const size_t i = EmplaceSlot(key).first;
+        return m_slots[i].second;
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(const uint256& key, Args&&... args)
+    {
+        const std::pair<size_t, bool> ret = EmplaceSlot(key, std::forward<Args>(args)...);
+        return std::make_pair(iterator(this, ret.first), ret.second);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) { return emplace(value.first, value.second); }
+
+    template <typename P>
+    std::pair<iterator, bool> insert(P&& value) { return emplace(value.first, std::forward<P>(value).second); }
+
+    /** Erase the element at pos. Other elements may move: pos and every other iterator are invalidated. */
+    void erase(const_iterator pos) { EraseSlot(pos.m_pos); }
+
+    size_t erase(const uint256& key)
+    {
+        const size_t i = FindSlot(key, Hash(key));
+        if (i == NOT_FOUND)
+            return 0;
+        EraseSlot(i);
+        return 1;
+    }
+};
+
+#endif // BITCOIN_UINT256HM_H
@@ -0,0 +1,42 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <utxosnapshot.h>
+
+#include <hash.h>
+
+void CSnapshotChunkWriter::Flush()
+{
+    if (payload.empty())
+        return;
+    WriteCompactSize(file, payload.size());
+    file.write(payload.data(), payload.size());
+    file << Hash(payload.begin(), payload.end());
+    payload.clear();
+}
+
+void CSnapshotChunkWriter::Finish()
+{
+    Flush();
+    WriteCompactSize(file, 0);
+}
+
+bool CSnapshotChunkReader::HaveMore()
+{
+    while (payload.empty() && !fEnd) {
+        const uint64_t nSize = ReadCompactSize(file);
+        if (nSize == 0) {
+            fEnd = true;
+            break;
+        }
+        payload.clear();
+        payload.resize(nSize);
+        file.read(payload.data(), nSize);
+        uint256 hash;
+        file >> hash;
+        if (hash != Hash(payload.begin(), payload.end()))
+            throw std::ios_base::failure("UTXO snapshot chunk checksum mismatch");
+    }
+    return !payload.empty();
+}
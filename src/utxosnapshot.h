@@ -0,0 +1,253 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include <chain.h>
+#include <coins.h>
+#include <primitives/block.h>
+#include <protocol.h>
+#include <serialize.h>
+#include <streams.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ios>
+#include <utility>
+#include <vector>
+
+/**
+ * A UTXO snapshot lets a node start from the coins of a block, instead of
+ * connecting every block up to it. The file holds, in order:
+ *
+ * - a CSnapshotHeader
+ * - the block index entries of heights 1 to nHeight, as CSnapshotBlock, with
+ *   the proof-of-stake fields that connecting the blocks would have computed
+ * - the coins, grouped by transaction, each group with the offset of its
+ *   transaction in its block that stake kernels after the snapshot hash in
+ * - a CSnapshotFooter
+ *
+ * The block entries and the coins are written in chunks of about
+ * SNAPSHOT_CHUNK_SIZE bytes, which are read back one at a time. A chunk is its
+ * payload size, the payload and its double SHA256; an empty one ends the
+ * section. The footer has the MuHash of the coins. The headers are checked as
+ * header sync checks them and the stake modifiers are computed again, but the
+ * coins cannot be checked without the blocks: a snapshot is only loaded when
+ * its block hash and MuHash are those given by the user, from a trusted node.
+ */
+
+static const unsigned char SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+static const uint16_t SNAPSHOT_VERSION = 1;
+static const size_t SNAPSHOT_CHUNK_SIZE = 1 << 20;
+
+class CSnapshotHeader
+{
+public:
+    uint16_t nVersion;
+    CMessageHeader::MessageStartChars pchMessageStart;
+    uint256 hashBlock;
+    int nHeight;
+
+    CSnapshotHeader() : nVersion(SNAPSHOT_VERSION), nHeight(0) { memset(pchMessageStart, 0, sizeof(pchMessageStart)); }
+    CSnapshotHeader(const CMessageHeader::MessageStartChars& pchMessageStartIn, const uint256& hashBlockIn, int nHeightIn) :
+        nVersion(SNAPSHOT_VERSION), hashBlock(hashBlockIn), nHeight(nHeightIn)
+    {
+        memcpy(pchMessageStart, pchMessageStartIn, sizeof(pchMessageStart));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s.write((const char*)SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        ::Serialize(s, nVersion);
+        s.write((const char*)pchMessageStart, sizeof(pchMessageStart));
+        ::Serialize(s, hashBlock);
+        ::Serialize(s, nHeight);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+        s.read((char*)magic, sizeof(magic));
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+            throw std::ios_base::failure("not a UTXO snapshot");
+        ::Unserialize(s, nVersion);
+        if (nVersion != SNAPSHOT_VERSION)
+            throw std::ios_base::failure("unsupported UTXO snapshot version");
+        s.read((char*)pchMessageStart, sizeof(pchMessageStart));
+        ::Unserialize(s, hashBlock);
+        ::Unserialize(s, nHeight);
+    }
+};
+
+/** A block index entry of a snapshot. Its parent is the entry before it. */
+class CSnapshotBlock
+{
+public:
+    int32_t nVersion;
+    uint256 hashMerkleRoot;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+    unsigned int nTx;
+    uint32_t nFlags;
+    uint64_t nStakeModifier;
+    uint32_t nStakeModifierChecksum;
+    uint256 hashProofOfStake;
+    COutPoint outStakeReward;
+
+    CSnapshotBlock() : nVersion(0), nTime(0), nBits(0), nNonce(0), nTx(0), nFlags(0), nStakeModifier(0), nStakeModifierChecksum(0) {}
+
+    explicit CSnapshotBlock(const CBlockIndex& index) :
+        nVersion(index.nVersion), hashMerkleRoot(index.hashMerkleRoot), nTime(index.nTime), nBits(index.nBits),
+        nNonce(index.nNonce), nTx(index.nTx), nFlags(index.nFlags), nStakeModifier(index.nStakeModifier),
+        nStakeModifierChecksum(index.nStakeModifierChecksum), hashProofOfStake(index.hashProofOfStake),
+        outStakeReward(index.outStakeReward) {}
+
+    //! The header of the block, whose parent is hashPrevBlock
+    CBlockHeader GetBlockHeader(const uint256& hashPrevBlock) const
+    {
+        CBlockHeader block;
+        block.nVersion = nVersion;
+        block.hashPrevBlock = hashPrevBlock;
+        block.hashMerkleRoot = hashMerkleRoot;
+        block.nTime = nTime;
+        block.nBits = nBits;
+        block.nNonce = nNonce;
+        block.nFlags = nFlags & (BLOCK_PROOF_OF_STAKE | BLOCK_NEW_FORMAT);
+        return block;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nVersion);
+        READWRITE(hashMerkleRoot);
+        READWRITE(nTime);
+        READWRITE(nBits);
+        READWRITE(nNonce);
+        READWRITE(VARINT(nTx));
+        READWRITE(nFlags);
+        READWRITE(nStakeModifier);
+        READWRITE(nStakeModifierChecksum);
+        if (nFlags & BLOCK_PROOF_OF_STAKE) {
+            READWRITE(hashProofOfStake);
+            READWRITE(outStakeReward);
+        }
+    }
+};
+
+/** The coins of a transaction in a snapshot */
+class CSnapshotTx
+{
+public:
+    uint256 txid;
+    //! Offset of the transaction in its block, see CStakeTxOrigin
+    unsigned int nTxOffset;
+    std::vector<std::pair<uint32_t, Coin> > vCoins;
+
+    CSnapshotTx() : nTxOffset(0) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ::Serialize(s, txid);
+        ::Serialize(s, VARINT(nTxOffset));
+        WriteCompactSize(s, vCoins.size());
+        for (const auto& coin : vCoins) {
+            ::Serialize(s, VARINT(coin.first));
+            ::Serialize(s, coin.second);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        ::Unserialize(s, txid);
+        ::Unserialize(s, VARINT(nTxOffset));
+        // Grow the vector as coins are read, rather than trusting the count up front
+        const uint64_t nCoins = ReadCompactSize(s);
+        vCoins.clear();
+        for (uint64_t i = 0; i < nCoins; i++) {
+            vCoins.emplace_back();
+            ::Unserialize(s, VARINT(vCoins.back().first));
+            ::Unserialize(s, vCoins.back().second);
+        }
+    }
+};
+
+class CSnapshotFooter
+{
+public:
+    uint64_t nCoins;
+    uint256 hashMuHash;
+
+    CSnapshotFooter() : nCoins(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nCoins);
+        READWRITE(hashMuHash);
+    }
+};
+
+/** Collects records into chunks, and writes each to a file once it is large enough */
+class CSnapshotChunkWriter
+{
+private:
+    CAutoFile& file;
+    CDataStream payload;
+
+public:
+    explicit CSnapshotChunkWriter(CAutoFile& fileIn) : file(fileIn), payload(SER_DISK, fileIn.GetVersion()) {}
+
+    //! Add a record to the chunk, and write the chunk out if it is full. Records do not span chunks.
+    template <typename T>
+    CSnapshotChunkWriter& operator<<(const T& obj)
+    {
+        payload << obj;
+        if (payload.size() >= SNAPSHOT_CHUNK_SIZE)
+            Flush();
+        return *this;
+    }
+
+    //! Write out the chunk so far, if any
+    void Flush();
+    //! Write out the chunk so far, and the empty chunk that ends the section
+    void Finish();
+};
+
+/** Reads the chunks of a section back one at a time, checking each */
+class CSnapshotChunkReader
+{
+private:
+    CAutoFile& file;
+    CDataStream payload;
+    bool fEnd;
+
+public:
+    explicit CSnapshotChunkReader(CAutoFile& fileIn) : file(fileIn), payload(SER_DISK, fileIn.GetVersion()), fEnd(false) {}
+
+    //! Whether there are records left in the section, reading the next chunk if needed. Throws
+    //! std::ios_base::failure if the file is truncated or a chunk does not match its checksum.
+    bool HaveMore();
+
+    template <typename T>
+    CSnapshotChunkReader& operator>>(T& obj)
+    {
+        if (!HaveMore())
+            throw std::ios_base::failure("UTXO snapshot section ended early");
+        payload >> obj;
+        return *this;
+    }
+};
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
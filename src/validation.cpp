@@ -10,6 +10,7 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinstats.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
@@ -40,6 +41,7 @@
 #include <util.h>
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
+#include <utxosnapshot.h>
 #include <validationinterface.h>
 #include <warnings.h>
 #include <wallet/wallet.h>
@@ -158,13 +160,13 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, int nPoWValidHeight = -1);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsSetStats* pstats = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, CCoinsSetStats* pstats = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -177,6 +179,7 @@ public:
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
     bool LoadGenesisBlock(const CChainParams& chainparams);
+    bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CCoinsSetStats& stats, std::string& strError);
 
     void PruneBlockIndexCandidates();
 
@@ -187,6 +190,7 @@ private:
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
+    bool ReadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, bool fApply, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CSnapshotHeader& header, CCoinsSetStats& stats, std::string& strError);
     /** Create a new block index entry for a given block hash */
     CBlockIndex * InsertBlockIndex(const uint256& hash);
     void CheckBlockIndex(const Consensus::Params& consensusParams);
@@ -219,6 +223,7 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+bool fBackgroundFlush = DEFAULT_BACKGROUND_FLUSH;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -282,6 +287,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
+std::unique_ptr<CCoinsSetStats> pcoinsStats;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
 enum FlushStateMode {
@@ -1110,6 +1116,37 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
+static CuckooCache::cache<uint256, SignatureCacheHasher> powCache;
+static uint256 powCacheNonce(GetRandHash());
+static CCriticalSection cs_powCache;
+
+void InitPoWCache() {
+    size_t nElems = powCache.setup_bytes(POW_CACHE_SIZE);
+    LogPrintf("Using %zu MiB for proof-of-work cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nElems);
+}
+
+bool CheckHeaderPoW(const CBlockHeader& block, int nHeight, const Consensus::Params& consensusParams)
+{
+    // The block hash commits to the whole header, and the height selects the hash function
+    uint256 hashCacheEntry;
+    uint256 hashBlock = block.GetHash();
+    CSHA256().Write(powCacheNonce.begin(), 32).Write(hashBlock.begin(), 32).Write((unsigned char*)&nHeight, sizeof(nHeight)).Finalize(hashCacheEntry.begin());
+    {
+        LOCK(cs_powCache);
+        if (powCache.contains(hashCacheEntry, false))
+            return true;
+    }
+
+    // Only valid PoW is cached: an invalid header costs its sender a DoS score, not us a second hash
+    if (!CheckProofOfWork(block.GetPoWHash(nHeight, consensusParams), nHeight, block.nBits, consensusParams))
+        return false;
+
+    LOCK(cs_powCache);
+    powCache.insert(hashCacheEntry);
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
@@ -1135,7 +1172,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     }
 
     // Check the header
-    if (block.IsProofOfWork() && !CheckProofOfWork(block.GetPoWHash(nHeight, consensusParams), nHeight, block.nBits, consensusParams))
+    if (block.IsProofOfWork() && !CheckHeaderPoW(block, nHeight, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
@@ -1390,6 +1427,8 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight, u
 }
 
 bool CScriptCheck::operator()() {
+    if (pblock)
+        return CheckBlockSignature(*pblock);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
     return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
@@ -1627,8 +1666,9 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 }
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+ *  When FAILED is returned, view is left in an indeterminate state.
+ *  pstats, if given, is updated along, but is only meaningful when OK is returned. */
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsSetStats* pstats)
 {
     bool fClean = true;
 
@@ -1658,6 +1698,8 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 bool is_spent = view.SpendCoin(out, &coin);
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
+                } else if (pstats) {
+                    pstats->RemoveCoin(out, coin);
                 }
             }
         }
@@ -1674,6 +1716,8 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (pstats)
+                    pstats->AddCoin(out, view.AccessCoin(out));
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1681,6 +1725,8 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
 
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (pstats)
+        pstats->hashBlock = pindex->pprev->GetBlockHash();
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -1729,6 +1775,34 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
+void GetStakeTxOrigins(const CBlock& block, int nHeight, std::vector<std::pair<uint256, CStakeTxOrigin> >& vOrigins)
+{
+    CStakeTxOrigin origin(nHeight, CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block.vtx.size()));
+    vOrigins.clear();
+    vOrigins.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx)
+    {
+        vOrigins.push_back(std::make_pair(tx->GetHash(), origin));
+        origin.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+// Unlike the transaction index, the stake origin index is kept whatever
+// -txindex is, as CheckProofOfStake() reads it. Entries of disconnected blocks
+// are left in place: they are keyed by txid and overwritten whenever the
+// transaction is connected again, and CheckProofOfStake() only trusts an entry
+// whose height matches the kernel coin.
+static bool WriteStakeTxOriginsForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
+{
+    std::vector<std::pair<uint256, CStakeTxOrigin> > vOrigins;
+    GetStakeTxOrigins(block, pindex->nHeight, vOrigins);
+    if (!pblocktree->WriteStakeTxOrigins(vOrigins)) {
+        return AbortNode(state, "Failed to write stake origin index");
+    }
+
+    return true;
+}
+
 static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
 {
     if (!fTxIndex) return true;
@@ -1823,7 +1897,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 }
 
 // these checks can only be done when all previous block have been added.
-bool PoSContextualBlockChecks(const CBlock& block, CValidationState& state, CBlockIndex* pindex, bool fJustCheck)
+bool PoSContextualBlockChecks(const CBlock& block, CValidationState& state, CBlockIndex* pindex, const CCoinsViewCache& view, bool fJustCheck)
 {
     uint256 hashProofOfStake;
     if (block.IsProofOfStake()) {
@@ -1835,8 +1909,9 @@ bool PoSContextualBlockChecks(const CBlock& block, CValidationState& state, CBlo
             return error("ConnectBlock() : Incorrent PoS block");
         }
 
-        // pos: verify hash target and signature of coinstake tx
-        if (!CheckProofOfStake(state, block.vtx[1], block.nBits, hashProofOfStake, block.GetBlockTime())) {
+        // pos: verify hash target of coinstake tx; its signature is checked
+        // with the other scripts of the block in ConnectBlock()
+        if (!CheckProofOfStake(state, pindex->pprev, view, block.vtx[1], block.nBits, hashProofOfStake, block.GetBlockTime())) {
             LogPrintf("WARNING: %s: check proof-of-stake failed for block %s\n", __func__, block.GetHash().ToString());
             return false; // do not error here as we expect this during initial block download
         }
@@ -1890,6 +1965,11 @@ bool PoSContextualBlockChecks(const CBlock& block, CValidationState& state, CBlo
     pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
     pindex->nStakeModifierChecksum = nStakeModifierChecksum;
 
+    // index the modifier if the block extends the active chain (and not
+    // when CVerifyDB reconnects blocks below the tip)
+    if (pindex->pprev == chainActive.Tip())
+        stakeModifierIndex.Connect(pindex);
+
     return true;
 }
 
@@ -1906,7 +1986,7 @@ static int64_t nBlocksTotal = 0;
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CCoinsSetStats* pstats)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1915,7 +1995,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
            (*pindex->phashBlock == block.GetHash()));
     int64_t nTimeStart = GetTimeMicros();
 
-    if (!PoSContextualBlockChecks(block, state, pindex, fJustCheck))
+    if (!PoSContextualBlockChecks(block, state, pindex, view, fJustCheck))
         return false;
 
     // Check it again in case a previous version let a bad block in
@@ -1931,7 +2011,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
     // re-enforce that rule here (at least until we make it impossible for
     // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, !fJustCheck))
+    // The block signature is not checked again: CheckBlock() checked it when
+    // the block was received, before it was stored.
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, false))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -1943,6 +2025,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
         if (!fJustCheck)
             view.SetBestBlock(pindex->GetBlockHash());
+        if (pstats)
+            pstats->hashBlock = pindex->GetBlockHash();
         return true;
     }
 
@@ -2149,9 +2233,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
+    if (!WriteStakeTxOriginsForBlock(block, state, pindex))
+        return false;
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (pstats)
+        pstats->ConnectBlock(block, blockundo, pindex->nHeight, pindex->GetBlockHash());
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
@@ -2170,49 +2259,37 @@ bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache& view, uint64_t& n
     if (tx.IsCoinBase())
        return true;
 
+    // Coins of the view are as of its best block, so the block each of them
+    // was created in is the ancestor of that block at the coin's height.
+    // Coin::nTime is not used: it is not kept in undo data, so coins restored
+    // by a disconnected block have lost it.
+    BlockMap::const_iterator mi = mapBlockIndex.find(view.GetBestBlock());
+    if (mi == mapBlockIndex.end())
+        return error("%s() : best block of the coins view not found", __func__);
+    const CBlockIndex* pindexBest = mi->second;
+
     for (const CTxIn& txin : tx.vin)
     {
-        // First try finding the previous transaction in database
         const COutPoint &prevout = txin.prevout;
-        Coin coin;
-        if (!view.GetCoin(prevout, coin))
+        const Coin& coin = view.AccessCoin(prevout);
+        if (coin.IsSpent())
             continue;  // previous transaction not in main chain
 
-        // Transaction index is required to get to block header
-        if (!fTxIndex)
-            return false;  // Transaction index not available
+        const CBlockIndex* pindexFrom = pindexBest->GetAncestor(coin.nHeight);
+        if (!pindexFrom)
+            return error("%s() : block of %s not found", __func__, prevout.hash.ToString());
+        const int64_t nTimeFrom = pindexFrom->GetBlockTime();
 
-        CDiskTxPos postx;
-        CTransactionRef txPrev;
-        if (pblocktree->ReadTxIndex(prevout.hash, postx))
-        {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            CBlockHeader header;
-            try {
-                file >> header;
-
-                if (nTime < header.GetBlockTime())
-                    return false;  // timestamp violation
+        if (nTime < nTimeFrom)
+            return false;  // timestamp violation
 
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txPrev;
-            } catch (std::exception &e) {
-                return error("%s() : deserialize or I/O error in GetCoinAge()", __PRETTY_FUNCTION__);
-            }
+        if (nTimeFrom + params.nStakeMinAge > nTime)
+            continue; // only count coins meeting min age requirement
 
-            if (txPrev->GetHash() != prevout.hash)
-                return error("%s() : txid mismatch in GetCoinAge()", __PRETTY_FUNCTION__);
+        int64_t nValueIn = coin.out.nValue;
+        bnCentSecond += arith_uint256(nValueIn) * (nTime - nTimeFrom) / CENT;
 
-            if (header.GetBlockTime() + params.nStakeMinAge > nTime)
-                continue; // only count coins meeting min age requirement
-
-            int64_t nValueIn = txPrev->vout[txin.prevout.n].nValue;
-            bnCentSecond += arith_uint256(nValueIn) * (nTime - header.GetBlockTime()) / CENT;
-
-            LogPrint(BCLog::COINAGE, "coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, nTime - header.GetBlockTime(), bnCentSecond.ToString());
-        }
-        else
-            return error("%s() : tx missing in tx index in GetCoinAge()", __PRETTY_FUNCTION__);
+        LogPrint(BCLog::COINAGE, "coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, nTime - nTimeFrom, bnCentSecond.ToString());
     }
 
     arith_uint256 bnCoinDay = bnCentSecond * CENT / COIN / (24 * 60 * 60);
@@ -2238,6 +2315,10 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     bool fDoFullFlush = false;
     int64_t nNow = 0;
     try {
+    // The chainstate on disk is behind the chain since a background write failed,
+    // which no later flush in the background would notice until the cache fills up
+    if (pcoinsdbview->HasWriteFailed())
+        return AbortNode(state, "Failed to write to coin database");
     {
         LOCK(cs_LastBlockFile);
         if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
@@ -2269,14 +2350,20 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
         int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // Coins handed over to a background write still take memory until they are on disk.
+        // While they are written, only a full cache makes us wait for them.
+        int64_t nPendingSize = pcoinsdbview->GetPendingUsage();
+        bool fWriting = pcoinsdbview->IsWriting();
+        // A background flush starts at half of the limit, leaving the other half for the cache to fill meanwhile.
+        int64_t nLargeSize = fBackgroundFlush ? nTotalSpace / 2 : std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
-        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && !fWriting && cacheSize > nLargeSize;
         // The cache is over the limit, we have to write now.
-        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nTotalSpace;
+        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize + nPendingSize > nTotalSpace;
         // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
         bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
-        bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
+        bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && !fWriting && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
         fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
@@ -2319,7 +2406,20 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Callers of FLUSH_STATE_ALWAYS and pruning need it on disk when we return;
+            // otherwise it is written in the background while validation goes on. That
+            // waits for the previous background write, if still in progress.
+            if (fBackgroundFlush && mode != FLUSH_STATE_ALWAYS && !fFlushForPrune) {
+                const uint256 hashBlock = pcoinsTip->GetBestBlock();
+                CCoinsMap mapCoins;
+                pcoinsTip->Detach(mapCoins);
+                if (!pcoinsdbview->BatchWriteAsync(mapCoins, hashBlock, cacheSize))
+                    return AbortNode(state, "Failed to write to coin database");
+            } else if (!pcoinsTip->Flush()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+            // The running UTXO set statistics are kept with the coins they describe
+            if (pcoinsStats && !pcoinsdbview->WriteStats(*pcoinsStats))
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
@@ -2434,10 +2534,16 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     {
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        // The statistics are updated on a copy, so that a failed disconnect leaves them alone
+        std::unique_ptr<CCoinsSetStats> stats;
+        if (pcoinsStats)
+            stats.reset(new CCoinsSetStats(*pcoinsStats));
+        if (DisconnectBlock(block, pindexDelete, view, stats.get()) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        if (stats)
+            pcoinsStats = std::move(stats);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -2459,6 +2565,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     }
 
     chainActive.SetTip(pindexDelete->pprev);
+    stakeModifierIndex.Disconnect(pindexDelete);
 
     UpdateTip(pindexDelete->pprev, chainparams);
     // Let wallets know transactions went from 1-confirmed to
@@ -2467,8 +2574,96 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     return true;
 }
 
+/**
+ * Closure representing the read of one coin from the coins database. Writes the coin
+ * to *pcoin and whether it was found to *pfFound; a read error counts as not found,
+ * and is hit again (and handled) when the coin is looked up as usual.
+ */
+class CCoinPrefetch
+{
+private:
+    const CCoinsView *pview;
+    const COutPoint *poutpoint;
+    Coin *pcoin;
+    char *pfFound;
+
+public:
+    CCoinPrefetch(): pview(nullptr), poutpoint(nullptr), pcoin(nullptr), pfFound(nullptr) {}
+    CCoinPrefetch(const CCoinsView& viewIn, const COutPoint& outpointIn, Coin& coinIn, char* pfFoundIn) :
+        pview(&viewIn), poutpoint(&outpointIn), pcoin(&coinIn), pfFound(pfFoundIn) { }
+
+    bool operator()() {
+        try {
+            *pfFound = pview->GetCoin(*poutpoint, *pcoin);
+        } catch (const std::runtime_error&) {
+            *pfFound = false;
+        }
+        return true;
+    }
+
+    void swap(CCoinPrefetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(poutpoint, check.poutpoint);
+        std::swap(pcoin, check.pcoin);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
+static CCheckQueue<CCoinPrefetch> prefetchqueue(8);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("taler-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by block that have no entry in the coins tip cache and are not
+ * created by the block itself from the coins database on the prefetch threads, and stage them in
+ * staged. Anything not staged is looked up as usual by ConnectBlock.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewStaged& staged)
+{
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0)
+        return;
+
+    std::set<uint256> setBlockTxids;
+    for (const CTransactionRef& tx : block.vtx)
+        setBlockTxids.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutPoints;
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            // A spent entry in the tip cache must not be read past, to the coin it spends on disk
+            if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveEntryInCache(txin.prevout))
+                vOutPoints.push_back(txin.prevout);
+        }
+    }
+    if (vOutPoints.empty())
+        return;
+
+    // Not std::vector<bool>, so that the prefetch threads write to distinct bytes
+    std::vector<Coin> vCoins(vOutPoints.size());
+    std::vector<char> vFound(vOutPoints.size(), 0);
+    std::vector<CCoinPrefetch> vChecks;
+    vChecks.reserve(vOutPoints.size());
+    for (size_t i = 0; i < vOutPoints.size(); i++)
+        vChecks.emplace_back(*pcoinsdbview, vOutPoints[i], vCoins[i], &vFound[i]);
+    CCheckQueueControl<CCoinPrefetch> control(&prefetchqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (vFound[i])
+            staged.Stage(vOutPoints[i], std::move(vCoins[i]));
+    }
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
@@ -2564,8 +2759,13 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
-        CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        // Coins staged here are only read, by view; its writes pass through to pcoinsTip
+        CCoinsViewStaged staged(pcoinsTip.get());
+        PrefetchBlockInputs(blockConnecting, staged);
+        int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+        LogPrint(BCLog::BENCH, "  - Prefetch %u inputs: %.2fms [%.2fs]\n", (unsigned)staged.GetStagedCount(), (nTimePrefetched - nTime2) * MILLI, nTimePrefetch * MICRO);
+        CCoinsViewCache view(&staged);
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, pcoinsStats.get());
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3175,7 +3375,12 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+/**
+ * nPoWValidHeight is the height at which the proof of work of block is already known to
+ * be valid (see CheckHeadersPoW), or -1. The check is only skipped if the block's actual
+ * height matches, since the hash function depends on it.
+ */
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, int nPoWValidHeight = -1)
 {
     int nHeight = 0;
     auto mi = mapBlockIndex.find(block.hashPrevBlock);
@@ -3185,7 +3390,7 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     }
 
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !block.IsProofOfStake() && !CheckProofOfWork(block.GetPoWHash(nHeight, consensusParams), nHeight, block.nBits, consensusParams))
+    if (fCheckPOW && nHeight != nPoWValidHeight && !block.IsProofOfStake() && !CheckHeaderPoW(block, nHeight, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
@@ -3203,6 +3408,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
+    // pos: the block signature is verified on the script check threads, if
+    // there are any, while the rest of the block is checked here
+    const bool fQueueSign = fCheckSign && nScriptCheckThreads && block.IsProofOfStake();
+    CCheckQueueControl<CScriptCheck> control(fQueueSign ? &scriptcheckqueue : nullptr);
+    if (fQueueSign) {
+        std::vector<CScriptCheck> vChecks;
+        vChecks.emplace_back(block);
+        control.Add(vChecks);
+    }
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -3253,13 +3468,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
 
+    // pos: check block signature. The signature is not covered by the block
+    // hash, so like a bad merkle root, a bad one may be a corrupted or tampered
+    // copy of a valid block, which must not be marked invalid for it.
+    if (fCheckSign && !(fQueueSign ? control.Wait() : CheckBlockSignature(block)))
+        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sign", true, "bad block signature");
+
     if (fCheckPOW && fCheckMerkleRoot)
         block.fChecked = true;
 
-    // pos: check block signature
-    if (fCheckSign && !CheckBlockSignature(block))
-        return state.DoS(100, false, REJECT_INVALID, "bad-blk-sign", false, "bad block signature");
-
     return true;
 }
 
@@ -3462,7 +3679,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, int nPoWValidHeight)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3481,7 +3698,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !block.IsProofOfStake()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !block.IsProofOfStake(), nPoWValidHeight))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3524,15 +3741,128 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
+/**
+ * Closure representing the proof-of-work check of one header. Writes the result to
+ * *pfValid, so the caller learns it for every header checked, and fails the batch on
+ * an invalid one, which makes the queue skip the checks that have not started yet.
+ */
+class CPoWCheck
+{
+private:
+    const CBlockHeader *pheader;
+    int nHeight;
+    const Consensus::Params *pparams;
+    char *pfValid;
+
+public:
+    CPoWCheck(): pheader(nullptr), nHeight(0), pparams(nullptr), pfValid(nullptr) {}
+    CPoWCheck(const CBlockHeader& headerIn, int nHeightIn, const Consensus::Params& paramsIn, char* pfValidIn) :
+        pheader(&headerIn), nHeight(nHeightIn), pparams(&paramsIn), pfValid(pfValidIn) { }
+
+    bool operator()() {
+        *pfValid = CheckHeaderPoW(*pheader, nHeight, *pparams);
+        return *pfValid;
+    }
+
+    void swap(CPoWCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(nHeight, check.nHeight);
+        std::swap(pparams, check.pparams);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+static CCheckQueue<CPoWCheck> powcheckqueue(16);
+
+void ThreadPoWCheck() {
+    RenameThread("taler-powcheck");
+    powcheckqueue.Thread();
+}
+
+/**
+ * Compute the proof of work of a batch of headers on the PoW check threads, holding
+ * cs_main only to look up where the batch connects. On return vPoWValidHeight[i] is the
+ * height at which the PoW of headers[i] was found valid, or -1 if it was not checked
+ * (proof of stake, already known, unknown parent, after an invalid one) or is invalid;
+ * AcceptBlockHeader checks those headers itself as usual, and stops at the first
+ * invalid one.
+ */
+static void CheckHeadersPoW(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams, std::vector<int>& vPoWValidHeight)
+{
+    vPoWValidHeight.assign(headers.size(), -1);
+    if (headers.size() < 2 || nScriptCheckThreads == 0)
+        return;
+
+    std::vector<uint256> vHash;
+    vHash.reserve(headers.size());
+    for (const CBlockHeader& header : headers)
+        vHash.push_back(header.GetHash());
+
+    // Height of each header if it connects to the block index, directly or through its predecessor in the batch
+    std::vector<int> vHeight(headers.size(), -1);
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (i > 0 && headers[i].hashPrevBlock == vHash[i - 1]) {
+                if (vHeight[i - 1] >= 0)
+                    vHeight[i] = vHeight[i - 1] + 1;
+            } else {
+                BlockMap::iterator mi = mapBlockIndex.find(headers[i].hashPrevBlock);
+                if (mi != mapBlockIndex.end())
+                    vHeight[i] = mi->second->nHeight + 1;
+            }
+        }
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (headers[i].IsProofOfStake() || mapBlockIndex.count(vHash[i]))
+                vHeight[i] = -1;
+        }
+    }
+
+    // Check the first header here, so that a batch that is bad from its start
+    // costs a single hash rather than one on every check thread
+    size_t nFirst = 0;
+    while (nFirst < headers.size() && vHeight[nFirst] < 0)
+        nFirst++;
+    if (nFirst == headers.size() || !CheckHeaderPoW(headers[nFirst], vHeight[nFirst], consensusParams))
+        return;
+    vPoWValidHeight[nFirst] = vHeight[nFirst];
+
+    // Not std::vector<bool>, so that the check threads write to distinct bytes
+    std::vector<char> vValid(headers.size(), 0);
+    std::vector<CPoWCheck> vChecks;
+    vChecks.reserve(headers.size() - nFirst);
+    // The queue hands out work from its back: add the checks last to first, so
+    // that they run about in order and the headers ahead of an invalid one are
+    // done when it stops the rest
+    for (size_t i = headers.size() - 1; i > nFirst; i--) {
+        if (vHeight[i] >= 0)
+            vChecks.emplace_back(headers[i], vHeight[i], consensusParams, &vValid[i]);
+    }
+    CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < headers.size(); i++) {
+        if (vValid[i])
+            vPoWValidHeight[i] = vHeight[i];
+    }
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // The PoW hashes are by far the most expensive part of accepting headers, and need no context but the height
+    std::vector<int> vPoWValidHeight;
+    CheckHeadersPoW(headers, chainparams.GetConsensus(), vPoWValidHeight);
+
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, vPoWValidHeight[i])) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3750,6 +4080,10 @@ bool CheckBlockSignature(const CBlock& block)
     if (block.GetHash() == Params().GetConsensus().hashGenesisBlock || !block.IsProofOfStake())
         return block.vchBlockSig.empty();
 
+    // It may be checked before the transactions of the block are
+    if (block.vtx.size() < 2 || block.vtx[1]->vout.empty())
+        return false;
+
     std::vector<valtype> vSolutions;
     txnouttype whichType;
     const CTxOut& txout = block.vtx[1]->vout[0];
@@ -4120,6 +4454,7 @@ bool LoadChainTip(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return false;
     chainActive.SetTip(it->second);
+    stakeModifierIndex.Rebuild(chainActive.Tip());
 
     g_chainstate.PruneBlockIndexCandidates();
 
@@ -4324,6 +4659,273 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view) {
     return g_chainstate.ReplayBlocks(params, view);
 }
 
+/**
+ * Accept the headers of a batch of UTXO snapshot block entries the way header
+ * sync does, then set the proof-of-stake fields of their index entries as
+ * connecting the blocks would, and check them against the entries. The proof
+ * hashes and stake reward outpoints need the blocks themselves, so they are
+ * taken from the entries, bound only by the stake modifiers and checksums.
+ */
+static bool AcceptSnapshotBlocks(const CChainParams& chainparams, const std::vector<CSnapshotBlock>& vRecords, const std::vector<CBlockHeader>& vHeaders, std::string& strError)
+{
+    CValidationState state;
+    if (!ProcessNewBlockHeaders(vHeaders, state, chainparams)) {
+        strError = strprintf("The UTXO snapshot has an invalid block header: %s", FormatStateMessage(state));
+        return false;
+    }
+    for (size_t i = 0; i < vRecords.size(); i++) {
+        const CSnapshotBlock& record = vRecords[i];
+        CBlockIndex* pindex = mapBlockIndex.at(vHeaders[i].GetHash());
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        bool fValid = record.nTx > 0 && (pindex->IsProofOfStake() || (record.hashProofOfStake.IsNull() && record.outStakeReward.IsNull()));
+        if (fValid) {
+            pindex->hashProofOfStake = record.hashProofOfStake;
+            fValid = ComputeNextStakeModifier(pindex, nStakeModifier, fGeneratedStakeModifier) &&
+                     pindex->SetStakeEntropyBit(CBlock(vHeaders[i]).GetStakeEntropyBit(pindex->nHeight));
+        }
+        if (fValid) {
+            pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+            pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+            pindex->outStakeReward = record.outStakeReward;
+            fValid = pindex->nFlags == record.nFlags && pindex->nStakeModifier == record.nStakeModifier &&
+                     pindex->nStakeModifierChecksum == record.nStakeModifierChecksum &&
+                     CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum);
+        }
+        if (!fValid) {
+            strError = strprintf("The UTXO snapshot has an invalid block index entry at height %d", pindex->nHeight);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CChainState::ReadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, bool fApply, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CSnapshotHeader& header, CCoinsSetStats& stats, std::string& strError)
+{
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("Cannot open UTXO snapshot %s", path.string());
+        return false;
+    }
+
+    try {
+        filein >> header;
+        if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart)) != 0) {
+            strError = "The UTXO snapshot is for another network";
+            return false;
+        }
+        if (header.hashBlock != hashExpectedBlock) {
+            strError = strprintf("The UTXO snapshot is of block %s, not of the expected block %s", header.hashBlock.ToString(), hashExpectedBlock.ToString());
+            return false;
+        }
+
+        // Block index entries, each the child of the one before, starting from the genesis block
+        const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+        CBlockIndex* pindexPrev = chainActive.Genesis();
+        uint256 hashPrev = pindexPrev->GetBlockHash();
+        int nHeight = 0;
+        std::vector<CSnapshotBlock> vRecords;
+        std::vector<CBlockHeader> vHeaders;
+        CSnapshotChunkReader blocks(filein);
+        bool fMore = true;
+        while (fMore) {
+            fMore = blocks.HaveMore();
+            if (!fApply && (!fMore || vRecords.size() == MAX_HEADERS_RESULTS)) {
+                // The check pass adds the headers to the block index, in batches
+                // so that their proof of work is checked in parallel
+                if (!AcceptSnapshotBlocks(chainparams, vRecords, vHeaders, strError))
+                    return false;
+                vRecords.clear();
+                vHeaders.clear();
+            }
+            if (!fMore)
+                break;
+            CSnapshotBlock record;
+            blocks >> record;
+            nHeight++;
+            const CBlockHeader block = record.GetBlockHeader(hashPrev);
+            const uint256 hash = block.GetHash();
+            if (fApply) {
+                CBlockIndex* pindex = mapBlockIndex.at(hash);
+                assert(pindex->pprev == pindexPrev);
+                pindex->nTx = record.nTx;
+                pindex->nChainTx = pindexPrev->nChainTx + record.nTx;
+                // As ReceivedBlockTransactions would for a block with its witness
+                // data, or RewindBlockIndex would disconnect it on every start
+                if (IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()))
+                    pindex->nStatus |= BLOCK_OPT_WITNESS;
+                pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+                setDirtyBlockIndex.insert(pindex);
+                pindexPrev = pindex;
+            } else {
+                MapCheckpoints::const_iterator itCheckpoint = checkpoints.find(nHeight);
+                if (itCheckpoint != checkpoints.end() && itCheckpoint->second != hash) {
+                    strError = strprintf("The UTXO snapshot does not match the checkpoint at height %d", nHeight);
+                    return false;
+                }
+                vRecords.push_back(record);
+                vHeaders.push_back(block);
+            }
+            hashPrev = hash;
+        }
+        if (nHeight == 0 || nHeight != header.nHeight || hashPrev != header.hashBlock) {
+            strError = "The block index entries of the UTXO snapshot do not lead to its block";
+            return false;
+        }
+
+        // Coins, in the order of the database, written out in batches the size of the coins cache
+        CCoinsMap mapCoins;
+        size_t nCoinsUsage = 0;
+        std::vector<std::pair<uint256, CStakeTxOrigin> > vOrigins;
+        uint64_t nCoins = 0;
+        uint256 txidPrev;
+        CSnapshotChunkReader coins(filein);
+        while (coins.HaveMore()) {
+            CSnapshotTx tx;
+            coins >> tx;
+            if (tx.vCoins.empty() || (nCoins > 0 && !(txidPrev < tx.txid))) {
+                strError = strprintf("The UTXO snapshot has coins out of order at %s", tx.txid.ToString());
+                return false;
+            }
+            txidPrev = tx.txid;
+            const int nCoinHeight = tx.vCoins.front().second.nHeight;
+            for (size_t i = 0; i < tx.vCoins.size(); i++) {
+                const COutPoint outpoint(tx.txid, tx.vCoins[i].first);
+                Coin& coin = tx.vCoins[i].second;
+                if (fApply) {
+                    nCoinsUsage += coin.DynamicMemoryUsage();
+                    CCoinsCacheEntry& entry = mapCoins[outpoint];
+                    entry.coin = std::move(coin);
+                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                } else {
+                    if ((i > 0 && tx.vCoins[i - 1].first >= outpoint.n) || coin.IsSpent() || coin.out.scriptPubKey.IsUnspendable() ||
+                        (int)coin.nHeight != nCoinHeight || coin.fCoinBase != tx.vCoins.front().second.fCoinBase || nCoinHeight > header.nHeight) {
+                        strError = strprintf("The UTXO snapshot has an invalid coin %s", outpoint.ToString());
+                        return false;
+                    }
+                    stats.AddCoin(outpoint, coin);
+                }
+                nCoins++;
+            }
+            if (fApply) {
+                vOrigins.emplace_back(tx.txid, CStakeTxOrigin(nCoinHeight, tx.nTxOffset));
+                if (nCoinsUsage + memusage::DynamicUsage(mapCoins) > nCoinCacheUsage) {
+                    if (!pblocktree->WriteStakeTxOrigins(vOrigins) || !pcoinsdbview->WriteSnapshotCoins(mapCoins, header.hashBlock, false)) {
+                        strError = "Failed to write the coins of the UTXO snapshot";
+                        return false;
+                    }
+                    vOrigins.clear();
+                    nCoinsUsage = 0;
+                }
+            }
+        }
+
+        CSnapshotFooter footer;
+        filein >> footer;
+        if (fApply) {
+            if (!pblocktree->WriteStakeTxOrigins(vOrigins) || !pcoinsdbview->WriteSnapshotCoins(mapCoins, header.hashBlock, true)) {
+                strError = "Failed to write the coins of the UTXO snapshot";
+                return false;
+            }
+        } else if (footer.nCoins != nCoins || footer.hashMuHash != stats.GetHash()) {
+            strError = "The coins of the UTXO snapshot do not match its hash";
+            return false;
+        } else if (stats.GetHash() != hashExpectedMuHash) {
+            strError = strprintf("The coins of the UTXO snapshot have muhash %s, not the expected %s", stats.GetHash().ToString(), hashExpectedMuHash.ToString());
+            return false;
+        }
+        stats.hashBlock = header.hashBlock;
+    } catch (const std::exception& e) {
+        strError = strprintf("Error reading UTXO snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool CChainState::LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CCoinsSetStats& stats, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+
+    if (!fPruneMode) {
+        strError = "Loading a UTXO snapshot requires -prune, as the blocks below it are never downloaded";
+        return false;
+    }
+    // The snapshot takes the place of every block up to it, so no block may
+    // have been processed yet besides the genesis block
+    bool fEmpty = chainActive.Height() == 0;
+    for (const BlockMap::value_type& entry : mapBlockIndex) {
+        if (entry.second->pprev && entry.second->nTx > 0)
+            fEmpty = false;
+    }
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS)) {
+        strError = FormatStateMessage(state);
+        return false;
+    }
+    if (fEmpty) {
+        std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+        fEmpty = !pcursor->Valid();
+    }
+    if (!fEmpty) {
+        strError = "A UTXO snapshot can only be loaded by a node that has no blocks yet";
+        return false;
+    }
+
+    // Check the whole file before any coins are written, so that a bad snapshot
+    // leaves the node as it was but for the valid headers in it
+    CSnapshotHeader header;
+    LogPrintf("Checking UTXO snapshot %s...\n", path.string());
+    if (!ReadUTXOSnapshot(chainparams, path, false, hashExpectedBlock, hashExpectedMuHash, header, stats, strError)) {
+        // Header-only entries have no proof-of-stake fields until their blocks are connected
+        for (const BlockMap::value_type& entry : mapBlockIndex) {
+            CBlockIndex* pindex = entry.second;
+            if (pindex->pprev && pindex->nTx == 0) {
+                pindex->nFlags &= BLOCK_PROOF_OF_STAKE | BLOCK_NEW_FORMAT;
+                pindex->nStakeModifier = 0;
+                pindex->hashProofOfStake.SetNull();
+                pindex->outStakeReward.SetNull();
+                pindex->nStakeModifierChecksum = 0;
+            }
+        }
+        return false;
+    }
+
+    LogPrintf("Loading UTXO snapshot of block %s at height %d, %u coins...\n", header.hashBlock.ToString(), header.nHeight, stats.nTransactionOutputs);
+    CCoinsSetStats statsUnused;
+    if (!ReadUTXOSnapshot(chainparams, path, true, hashExpectedBlock, hashExpectedMuHash, header, statsUnused, strError)) {
+        // The coins database is left marked as part way to the snapshot block
+        strError = strprintf("%s. The chainstate is incomplete; remove the blocks and chainstate directories and start again", strError);
+        AbortNode(strError);
+        return false;
+    }
+
+    // The blocks below the snapshot are never downloaded, just as if they had been pruned
+    fHavePruned = true;
+    pblocktree->WriteFlag("prunedblockfiles", true);
+
+    CBlockIndex* pindexBase = mapBlockIndex.at(header.hashBlock);
+    pcoinsTip->SetBestBlock(header.hashBlock);
+    chainActive.SetTip(pindexBase);
+    stakeModifierIndex.Rebuild(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    mempool.clear();
+    pcoinsStats.reset(new CCoinsSetStats(stats));
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS)) {
+        strError = FormatStateMessage(state);
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot: hashBestChain=%s height=%d muhash=%s\n", header.hashBlock.ToString(), header.nHeight, stats.GetHash().ToString());
+    return true;
+}
+
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CCoinsSetStats& stats, std::string& strError)
+{
+    LOCK(cs_main);
+    return g_chainstate.LoadUTXOSnapshot(chainparams, path, hashExpectedBlock, hashExpectedMuHash, stats, strError);
+}
+
 bool CChainState::RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
@@ -4441,6 +5043,7 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     chainActive.SetTip(nullptr);
+    stakeModifierIndex.Rebuild(nullptr);
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -4713,6 +5316,8 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == nullptr || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
+        assert(pindex->pprev == nullptr || pindex->pprevPoW == (pindex->pprev->IsProofOfWork() ? pindex->pprev : pindex->pprev->pprevPoW)); // pprevPoW must point to the closest proof-of-work predecessor.
+        assert(pindex->pprev == nullptr || pindex->pprevPoS == (pindex->pprev->IsProofOfStake() ? pindex->pprev : pindex->pprev->pprevPoS)); // pprevPoS must point to the closest proof-of-stake predecessor.
         assert(pindexFirstNotTreeValid == nullptr); // All mapBlockIndex entries must at least be TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == nullptr); // TREE valid implies all parents are TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == nullptr); // CHAIN valid implies all parents are CHAIN valid
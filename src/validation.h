@@ -34,6 +34,7 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
+class CCoinsSetStats;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
@@ -43,6 +44,7 @@ class CTxMemPool;
 class CValidationState;
 class CKeyStore;
 struct ChainTxData;
+struct CStakeTxOrigin;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
@@ -78,6 +80,8 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
+/** Size of the proof-of-work cache in bytes (32 bytes per entry) */
+static const unsigned int POW_CACHE_SIZE = 4 << 20;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
@@ -135,6 +139,8 @@ static const bool DEFAULT_TXINDEX = true;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -backgroundflush */
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -176,6 +182,8 @@ extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Whether the coins cache is written to the coin database in the background, rather than while holding cs_main */
+extern bool fBackgroundFlush;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -274,6 +282,10 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Run an instance of the block input prefetching thread */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -371,11 +383,15 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    const CBlock *pblock;
 
 public:
-    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(): ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), pblock(nullptr) {}
     CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+        m_tx_out(outIn), ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), pblock(nullptr) { }
+    /** pos: check of the signature of blockIn, queued by CheckBlock() while it checks the rest of the block */
+    explicit CScriptCheck(const CBlock& blockIn) :
+        ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(nullptr), pblock(&blockIn) { }
 
     bool operator()();
 
@@ -387,6 +403,7 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(pblock, check.pblock);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -395,11 +412,20 @@ public:
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
+/** Initializes the cache of headers with valid proof of work */
+void InitPoWCache();
+
+/** Check the proof of work of a header at height nHeight, hashing it only if it is not in the PoW cache */
+bool CheckHeaderPoW(const CBlockHeader& block, int nHeight, const Consensus::Params& consensusParams);
+
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 
+/** Stake origin index entries of the transactions of a block at height nHeight */
+void GetStakeTxOrigins(const CBlock& block, int nHeight, std::vector<std::pair<uint256, CStakeTxOrigin> >& vOrigins);
+
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
@@ -408,6 +434,13 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSign = true);
 
+/**
+ * Proof-of-stake checks of a block connected on top of its ancestors, with the
+ * UTXO set as of its parent in view: kernel and coinstake signature, and the
+ * next stake modifier, which is also written to pindex unless fJustCheck.
+ */
+bool PoSContextualBlockChecks(const CBlock& block, CValidationState& state, CBlockIndex* pindex, const CCoinsViewCache& view, bool fJustCheck);
+
 // pos: sign block or check signature
 bool SignBlock(CBlock& block, const CKeyStore& keystore);
 bool CheckBlockSignature(const CBlock& block);
@@ -435,6 +468,15 @@ public:
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
 
+/**
+ * Load a UTXO snapshot written by dumptxoutset into a node that has no blocks
+ * yet, and make its block the tip. The node must be pruned, as the blocks below
+ * the snapshot are never downloaded. The snapshot must be of the expected block
+ * and its coins must have the expected MuHash, both taken from a source the
+ * user trusts. On success stats holds the coins loaded.
+ */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpectedBlock, const uint256& hashExpectedMuHash, CCoinsSetStats& stats, std::string& strError);
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -456,6 +498,10 @@ extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
+/** Global variable that points to the running statistics of the UTXO set in
+ *  pcoinsTip, or null if they are not known for it yet (protected by cs_main) */
+extern std::unique_ptr<CCoinsSetStats> pcoinsStats;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -490,6 +536,8 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Coin age of the inputs of tx at nTime, in coin-days. Inputs are read from view
+ *  and their block times from the ancestors of its best block, without disk access. */
 bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache& view, uint64_t& nCoinAge, const Consensus::Params& params, uint32_t nTime);
 
 #endif // BITCOIN_VALIDATION_H
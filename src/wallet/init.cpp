@@ -33,6 +33,7 @@ std::string GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
+    strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Compute the proof-of-stake kernel schedule on <n> threads (0 = in the minter thread, default: %d)"), DEFAULT_STAKE_THREADS));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-walletrbf", strprintf(_("Send transactions with full-RBF opt-in enabled (RPC only, default: %u)"), DEFAULT_WALLET_RBF));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
@@ -323,8 +324,8 @@ void CloseWallets() {
     vpwallets.clear();
 }
 
-void StartMinting(boost::thread_group& threadGroup) {
+void StartMinting(boost::thread_group& threadGroup, CScheduler& scheduler) {
     for (CWalletRef pwallet : vpwallets) {
-        MintStake(threadGroup, pwallet);
+        MintStake(threadGroup, scheduler, pwallet);
     }
 }
@@ -44,6 +44,6 @@ void StopWallets();
 //! Close all wallets.
 void CloseWallets();
 
-void StartMinting(boost::thread_group& threadGroup);
+void StartMinting(boost::thread_group& threadGroup, CScheduler& scheduler);
 
 #endif // BITCOIN_WALLET_INIT_H
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Taler Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <amount.h>
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <rpc/minting.h>
+#include <test/test_bitcoin.h>
+
+#include <cmath>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(minting_tests, BasicTestingSetup)
+
+static const int64_t DAY = 24 * 60 * 60;
+
+/** The coin age a coin nAge seconds old counts for staking */
+static int64_t StakeAge(int64_t nAge)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    return std::max(std::min(nAge, params.nStakeMaxAge) - params.nStakeMinAge, (int64_t)0);
+}
+
+/**
+ * The probability listminting gave with a loop over the days for each coin:
+ * one kernel a second, each meeting the target with the coin age at the end
+ * of its day
+ */
+static double MintingProbabilityByDays(uint32_t nBits, int minutes, CAmount nValue, int64_t nAge)
+{
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    const double fTargetPerCoinSecond = bnTargetPerCoinDay.getdouble() / (~arith_uint256(0)).getdouble() / COIN / DAY;
+
+    double fLogNone = 0;
+    int64_t nOffset = DAY;
+    for (int i = 0; i < minutes / (60 * 24); i++, nOffset += DAY)
+        fLogNone += DAY * std::log1p(-nValue * StakeAge(nAge + nOffset) * fTargetPerCoinSecond);
+    fLogNone += 60 * (minutes % (60 * 24)) * std::log1p(-nValue * StakeAge(nAge + nOffset) * fTargetPerCoinSecond);
+    return -std::expm1(fLogNone);
+}
+
+static std::vector<int64_t> TestAges()
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<int64_t> vAge = {0, 1, DAY, params.nStakeMinAge - DAY, params.nStakeMinAge - 1, params.nStakeMinAge,
+        params.nStakeMinAge + 1, params.nStakeMinAge + DAY / 2, params.nStakeMaxAge - DAY - 1, params.nStakeMaxAge - 1,
+        params.nStakeMaxAge, params.nStakeMaxAge + 5 * DAY};
+    for (int i = 0; i < 20; i++)
+        vAge.push_back(InsecureRandRange(params.nStakeMaxAge + 10 * DAY));
+    return vAge;
+}
+
+BOOST_AUTO_TEST_CASE(sum_stake_ages)
+{
+    for (int64_t nAge : TestAges()) {
+        for (int64_t nDays : {0, 1, 2, 10, 30, 90, 91, 200}) {
+            int64_t nSum = 0;
+            for (int64_t i = 1; i <= nDays; i++)
+                nSum += StakeAge(nAge + i * DAY);
+            BOOST_CHECK_EQUAL(SumStakeAges(nAge, nDays), (double)nSum);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(minting_probabilities)
+{
+    std::vector<CAmount> vValue;
+    std::vector<int64_t> vAge;
+    for (int64_t nAge : TestAges()) {
+        for (CAmount nValue : {COIN / 10, COIN, 100 * COIN, 1000 * COIN}) {
+            vValue.push_back(nValue);
+            vAge.push_back(nAge);
+        }
+    }
+    const uint32_t nBitsInitial = UintToArith256(Params().GetConsensus().nInitialHashTargetPoS).GetCompact();
+    for (uint32_t nBits : {nBitsInitial, 0x1c00ffffU}) {
+        for (int minutes : {10, 60 * 24, 60 * 24 + 7, 60 * 24 * 30, 60 * 24 * 90}) {
+            std::vector<double> vProb;
+            CalcMintingProbabilities(nBits, minutes, vValue, vAge, vProb);
+            BOOST_REQUIRE_EQUAL(vProb.size(), vValue.size());
+            for (size_t i = 0; i < vValue.size(); i++) {
+                // The closed form takes log(1 - p) as -p, which is within p of it relatively
+                BOOST_CHECK_CLOSE(vProb[i], MintingProbabilityByDays(nBits, minutes, vValue[i], vAge[i]), 1e-2);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
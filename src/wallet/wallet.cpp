@@ -28,7 +28,6 @@
 #include <timedata.h>
 #include <txmempool.h>
 #include <txdb.h>
-#include <uint256hm.h>
 #include <util.h>
 #include <utilmoneystr.h>
 #include <validation.h>
@@ -870,6 +869,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        fMintingRescan = true;
     }
 }
 
@@ -970,6 +970,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    MarkMintingDirty(*wtx.tx);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1121,6 +1122,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            MarkMintingDirty(*wtx.tx);
             walletdb.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -1186,6 +1188,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
+            MarkMintingDirty(*wtx.tx);
             walletdb.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1260,6 +1263,10 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
         SyncTransaction(pblock->vtx[i], pindex, i);
         TransactionRemovedFromMempool(pblock->vtx[i]);
     }
+    AddStakeTxPos(*pblock, pindex);
+    // The transactions of the block were marked as they were synced; the
+    // coinbases of earlier blocks are a block closer to maturity
+    setMintingDirty.insert(setMintingImmature.begin(), setMintingImmature.end());
 
     m_last_block_processed = pindex;
 }
@@ -1269,7 +1276,11 @@ void CWallet::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) {
 
     for (const CTransactionRef& ptx : pblock->vtx) {
         SyncTransaction(ptx);
+        if (mapStakeTxPos.erase(ptx->GetHash()))
+            CWalletDB(*dbw).EraseStakeTxPos(ptx->GetHash());
     }
+    // Any coinbase may be immature again, and they are not tracked once mature
+    fMintingRescan = true;
 }
 
 
@@ -1700,6 +1711,7 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
                     AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
                 }
+                AddStakeTxPos(block, pindex);
             } else {
                 ret = pindex;
             }
@@ -3070,38 +3082,226 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
     return true;
 }
 
-uint256HashMap<std::pair<CBlockHeader*, unsigned int> >::Data* TryGetBlockOffset(uint256HashMap<std::pair<CBlockHeader*, unsigned int> >& cache, const uint256& tx_hash)
-{
-    uint256HashMap<std::pair<CBlockHeader*, unsigned int> >::Data *pbo = cache.Search(UintToArith256(tx_hash));
-    // Try Load, if missing or temporary removed
-    if (pbo == NULL || pbo->value.first == NULL) {
-        CDiskTxPos postx;
-        CBlockHeader *cbh = (CBlockHeader *)0x1; // default=Error
-        if(pblocktree->ReadTxIndex(tx_hash, postx)) {
-            // Read block header
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            cbh = new CBlockHeader;
-            try {
-                file >> *cbh;
-            } catch (std::exception &e) {
-                delete cbh;
-                cbh = (CBlockHeader *)0x1; // Error
-            }
-        } // ReadTxIndex()
+void CWallet::AddStakeTxPos(const CBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
 
-        if (pbo == NULL) {
-            std::pair<CBlockHeader*, unsigned int> bo(cbh, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE);
-            pbo = cache.Insert(UintToArith256(tx_hash), bo);
-        } else {
-            pbo->value.first = cbh;
+    // Offsets as the transaction index has them, after a header of fixed size
+    uint32_t nTxOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block.vtx.size());
+    std::unique_ptr<CWalletDB> walletdb;
+    for (const CTransactionRef& ptx : block.vtx) {
+        const uint256& hash = ptx->GetHash();
+        if (mapWallet.count(hash)) {
+            CStakeTxPos pos(pindex->GetBlockHash(), block, nTxOffset);
+            mapStakeTxPos[hash] = pos;
+            if (!walletdb)
+                walletdb.reset(new CWalletDB(*dbw));
+            walletdb->WriteStakeTxPos(hash, pos);
         }
+        nTxOffset += ::GetSerializeSize(*ptx, SER_DISK, CLIENT_VERSION);
     }
+}
 
-    // Don't work, if reaadErr=0x1, or temporary removed=NULL
-    if(pbo->value.first < (CBlock*)0x4)
-        return nullptr;
+void CWallet::LoadStakeTxPos(const uint256& hash, const CStakeTxPos& pos)
+{
+    mapStakeTxPos[hash] = pos;
+}
+
+bool CWallet::GetStakeTxPos(const CWalletTx& wtx, CStakeTxPos& pos)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    auto it = mapStakeTxPos.find(wtx.GetHash());
+    if (it == mapStakeTxPos.end() || it->second.hashBlock != wtx.hashBlock) {
+        // Not indexed yet, e.g. from before the index existed, or indexed
+        // in a block that has since been disconnected: index the block once
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+            return false;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second, Params().GetConsensus()))
+            return false;
+        AddStakeTxPos(block, mi->second);
+        it = mapStakeTxPos.find(wtx.GetHash());
+        if (it == mapStakeTxPos.end())
+            return false;
+    }
+    pos = it->second;
+    return true;
+}
+
+// pos: the coins that may be staked at nCoinStakeTime
+bool CWallet::SelectStakeCoins(uint32_t nCoinStakeTime, std::set<CInputCoin>& setCoins, CAmount& nBalance, CAmount& nReserveBalance) const
+{
+    AssertLockHeld(cs_wallet);
+
+    nBalance = GetBalance();
+    nReserveBalance = 0;
+
+    if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
+        return error("SelectStakeCoins : invalid reserve balance amount");
+
+    if (nBalance <= nReserveBalance)
+        return false;
+
+    CAmount nValueIn = 0;
+    std::vector<COutput> vCoins;
+    AvailableCoins(vCoins, true, nullptr, nCoinStakeTime);
+    if (!SelectCoins(vCoins, nBalance - nReserveBalance, setCoins, nValueIn))
+        return false;
+    return !setCoins.empty();
+}
+
+bool CWallet::GetStakeCandidates(uint32_t nCoinStakeTime, std::vector<CStakeKernelCandidate>& vCandidates)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    LOCK2(cs_main, cs_wallet);
+
+    vCandidates.clear();
+    std::set<CInputCoin> setCoins;
+    CAmount nBalance, nReserveBalance;
+    if (!SelectStakeCoins(nCoinStakeTime, setCoins, nBalance, nReserveBalance))
+        return false;
+
+    for (const CInputCoin& pcoin : setCoins)
+    {
+        CStakeTxPos pos;
+        if (!GetStakeTxPos(mapWallet.at(pcoin.outpoint.hash), pos))
+            continue;
+
+        // Only for PostFork transaction
+        if(!pos.IsNewFormatBlock())
+            continue;
+
+        // Coins maturing before nCoinStakeTime are kept: the kernel search
+        // checks the min age at each timestamp it tries
+        if (pos.GetBlockTime() + consensusParams.nStakeMinAge > nCoinStakeTime)
+        {
+            continue; // only count coins meeting min age requirement
+        }
+
+        vCandidates.push_back(CStakeKernelCandidate{pos.nTimeBlock, pos.nTxOffset, pcoin.outpoint, pcoin.txout.nValue});
+    }
+    return !vCandidates.empty();
+}
+
+void CWallet::MarkMintingDirty(const CTransaction& tx)
+{
+    AssertLockHeld(cs_wallet);
+    setMintingDirty.insert(tx.GetHash());
+    if (!tx.IsCoinBase()) {
+        for (const CTxIn& txin : tx.vin)
+            setMintingDirty.insert(txin.prevout.hash);
+    }
+}
+
+void CWallet::UpdateMintingCoins(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // The outputs AvailableCoins(vCoins, true, nullptr, 0, 0, MAX_MONEY, MAX_MONEY, 0, 1) returns
+    std::vector<CMintableCoin> vCoins;
+    setMintingImmature.erase(hash);
+    auto it = mapWallet.find(hash);
+    if (it != mapWallet.end()) {
+        const CWalletTx& wtx = it->second;
+        const CBlockIndex* pindex = nullptr;
+        const int nDepth = wtx.GetDepthInMainChain(pindex);
+        if (nDepth >= 1 && CheckFinalTx(*wtx.tx)) {
+            if (wtx.IsCoinBase() && wtx.GetBlocksToMaturity(nDepth) > 0) {
+                setMintingImmature.insert(hash);
+            } else {
+                for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                    const CTxOut& txout = wtx.tx->vout[i];
+                    if (txout.nValue == 0 || IsLockedCoin(hash, i) || IsSpent(hash, i) || IsMine(txout) == ISMINE_NO)
+                        continue;
+                    vCoins.push_back(CMintableCoin{COutPoint(hash, i), txout.scriptPubKey, txout.nValue, pindex->GetBlockTime(), 0});
+                }
+            }
+        }
+    }
 
-    return pbo;
+    // Replace the outputs of the transaction, unless they are the same
+    auto first = mapMintingCoins.lower_bound(COutPoint(hash, 0));
+    auto last = first;
+    bool fSame = true;
+    for (const CMintableCoin& coin : vCoins) {
+        if (last == mapMintingCoins.end() || last->first != coin.outpoint || last->second.nTime != coin.nTime)
+            fSame = false;
+        if (last != mapMintingCoins.end() && last->first.hash == hash)
+            ++last;
+    }
+    while (last != mapMintingCoins.end() && last->first.hash == hash) {
+        fSame = false;
+        ++last;
+    }
+    if (fSame)
+        return;
+    mapMintingCoins.erase(first, last);
+    for (CMintableCoin& coin : vCoins)
+        mapMintingCoins.emplace(coin.outpoint, std::move(coin));
+    nCoinsVersion++;
+}
+
+std::shared_ptr<const CMintingIndex> CWallet::GetMintingIndex()
+{
+    const int64_t nNow = GetAdjustedTime();
+    uint64_t nVersion;
+    std::vector<CMintableCoin> vCoins;
+    {
+        LOCK(cs_wallet);
+        if (setMintingDirty.empty() && !fMintingRescan && pMintingIndex && pMintingIndex->nCoinsVersion == nCoinsVersion &&
+            nNow - pMintingIndex->nTime < MINTING_INDEX_MAX_AGE)
+            return pMintingIndex;
+    }
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (fMintingRescan) {
+            mapMintingCoins.clear();
+            setMintingImmature.clear();
+            setMintingDirty.clear();
+            nCoinsVersion++;
+            for (const std::pair<const uint256, CWalletTx>& item : mapWallet)
+                UpdateMintingCoins(item.first);
+            fMintingRescan = false;
+        }
+        for (const uint256& hash : setMintingDirty)
+            UpdateMintingCoins(hash);
+        setMintingDirty.clear();
+        if (pMintingIndex && pMintingIndex->nCoinsVersion == nCoinsVersion && nNow - pMintingIndex->nTime < MINTING_INDEX_MAX_AGE)
+            return pMintingIndex;
+        nVersion = nCoinsVersion;
+        vCoins.reserve(mapMintingCoins.size());
+        for (const std::pair<const COutPoint, CMintableCoin>& item : mapMintingCoins)
+            vCoins.push_back(item.second);
+    }
+
+    // Weigh and sort the copy without holding any lock
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::shared_ptr<CMintingIndex> index = std::make_shared<CMintingIndex>();
+    index->nTime = nNow;
+    index->nCoinsVersion = nVersion;
+    index->vCoins = std::move(vCoins);
+    for (CMintableCoin& coin : index->vCoins) {
+        const int64_t nDayWeight = (std::min(index->nTime - coin.nTime, consensusParams.nStakeMaxAge) - consensusParams.nStakeMinAge) / (24 * 60 * 60);
+        coin.nWeight = std::max(coin.nValue * nDayWeight / COIN, (int64_t)0);
+    }
+    std::sort(index->vCoins.begin(), index->vCoins.end(), [](const CMintableCoin& a, const CMintableCoin& b) {
+        if (a.nWeight != b.nWeight)
+            return a.nWeight > b.nWeight;
+        if (a.nTime != b.nTime)
+            return a.nTime < b.nTime;
+        return a.outpoint < b.outpoint;
+    });
+
+    LOCK(cs_wallet);
+    // Unless another caller built one of newer outputs meanwhile
+    if (!pMintingIndex || std::make_pair(pMintingIndex->nCoinsVersion, pMintingIndex->nTime) <= std::make_pair(index->nCoinsVersion, index->nTime))
+        pMintingIndex = index;
+    return index;
 }
 
 // pos: create coin stake transaction
@@ -3110,6 +3310,29 @@ uint256HashMap<std::pair<CBlockHeader*, unsigned int> >::Data* TryGetBlockOffset
 // and reduce blocks size.
 //
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, uint32_t& nCoinStakeTime, CAmount& nPosReward)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    std::vector<CStakeKernelCandidate> vCandidates;
+    if (!GetStakeCandidates(nCoinStakeTime, vCandidates))
+        return false;
+
+    // Search backward in time from the given txNew timestamp
+    // Search nSearchInterval seconds back up to MAX_STAKE_SEARCH_INTERVAL
+    const int64_t nStakeSearchInterval = std::min(nSearchInterval, MAX_STAKE_SEARCH_INTERVAL);
+    size_t nKernel;
+    uint32_t nKernelTime;
+    uint256 hashProofOfStake;
+    if (nStakeSearchInterval <= 0 || !FindStakeKernel(chainActive.Tip(), nBits, vCandidates, nCoinStakeTime, nStakeSearchInterval, nKernel, nKernelTime, hashProofOfStake))
+        return false;
+
+    if (!CreateCoinStake(keystore, nBits, vCandidates[nKernel], nKernelTime, txNew, nPosReward))
+        return false;
+    nCoinStakeTime = nKernelTime;
+    return true;
+}
+
+bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, const CStakeKernelCandidate& kernel, uint32_t nCoinStakeTime, CMutableTransaction& txNew, CAmount& nPosReward)
 {
     // The following split & combine thresholds are important to security
     // Should not be adjusted if you don't understand the consequences
@@ -3120,124 +3343,81 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     CAmount nPoWReward = GetBlockSubsidy(chainActive.Tip()->nPowHeight, consensusParams);
     CAmount nCombineThreshold = nPoWReward / 3;
 
-    arith_uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-
-    // Transaction index is required to get to block header
-    if (!fTxIndex)
-        return error("CreateCoinStake : transaction index unavailable");
-
     LOCK2(cs_main, cs_wallet);
 
     txNew.vin.clear();
     txNew.vout.clear();
     // Choose coins to use
-    CAmount nBalance = GetBalance();
-    CAmount nReserveBalance = 0;
-
-    if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
-        return error("CreateCoinStake : invalid reserve balance amount");
-
-    if (nBalance <= nReserveBalance)
-        return false;
-
     std::set<CInputCoin> setCoins;
-    CAmount nValueIn = 0;
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, nullptr, nCoinStakeTime);
-    if (!SelectCoins(vCoins, nBalance - nReserveBalance, setCoins, nValueIn))
-        return false;
-    if (setCoins.empty())
+    CAmount nBalance, nReserveBalance;
+    if (!SelectStakeCoins(nCoinStakeTime, setCoins, nBalance, nReserveBalance))
         return false;
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
 
-    // This is static cache for minimize block loads for each POS-attempt
-    // Possible values of ->value.first
-    // Addr > 0x4 -- This is pointer to blockheader in the memory
-    // Addr = 0x1 -- Was read error, don't load this block anymore
-    // NULL -- Block removed after mint, but maybe need reload again into same cell
-    static uint256HashMap<std::pair<CBlockHeader*, unsigned int> > CacheBlockOffset;
-    CacheBlockOffset.Set(setCoins.size() * 2); // 2x pointers
-
-    uint256HashMap<std::pair<CBlockHeader*, unsigned int> >::Data *pbo = NULL;
-
     CReserveKey key0(this);
 
-    for (const CInputCoin& pcoin : setCoins)
-    {
-        pbo = TryGetBlockOffset(CacheBlockOffset, pcoin.outpoint.hash);
-        if (pbo == nullptr)
-            continue;
+    // The kernel may have been found without holding the locks: its coin
+    // must still be ours to stake, and its hash must still meet the target
+    // on the current tip.
+    auto itKernel = std::find_if(setCoins.begin(), setCoins.end(),
+        [&kernel](const CInputCoin& coin) { return coin.outpoint == kernel.prevout; });
+    if (itKernel == setCoins.end())
+        return false;
+    const CInputCoin& pcoin = *itKernel;
 
-        CBlockHeader& header = *(pbo->value.first);
-        unsigned int offset  = pbo->value.second;
+    CStakeTxPos posKernel;
+    if (!GetStakeTxPos(mapWallet.at(kernel.prevout.hash), posKernel))
+        return false;
+    if (posKernel.nTimeBlock != kernel.nTimeBlockFrom || posKernel.nTxOffset != kernel.nTxPrevOffset)
+        return false;
 
-        // Only for PostFork transaction
-        if(!header.IsNewFormatBlock())
-            continue;
+    CBlock blockFrom;
+    blockFrom.nTime = posKernel.nTimeBlock;
+    blockFrom.nFlags = posKernel.nFlagsBlock;
+    uint256 hashProofOfStake;
+    if (!CheckStakeKernelHash(nBits, blockFrom, kernel.nTxPrevOffset, pcoin.txout, kernel.prevout, nCoinStakeTime, hashProofOfStake))
+        return false;
 
-        static int nMaxStakeSearchInterval = 60;
-        if (header.GetBlockTime() + consensusParams.nStakeMinAge > nCoinStakeTime - nMaxStakeSearchInterval)
-        {
-            continue; // only count coins meeting min age requirement
-        }
+    LogPrint(BCLog::COINSTAKE, "CreateCoinStake : kernel found, hashProof=%s\n", hashProofOfStake.ToString());
+    scriptPubKeyKernel = pcoin.txout.scriptPubKey;
 
-        bool fKernelFound = false;
-        for (uint32_t n = 0; n < std::min(nSearchInterval, (int64_t)nMaxStakeSearchInterval) && !fKernelFound; n++)
-        {
-            // Search backward in time from the given txNew timestamp
-            // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            uint256 hashProofOfStake;
-            if (CheckStakeKernelHash(nBits, header, offset, pcoin.txout, pcoin.outpoint, nCoinStakeTime - n, hashProofOfStake))
-            {
-                LogPrint(BCLog::COINSTAKE, "CreateCoinStake : kernel found\n");
-                scriptPubKeyKernel = pcoin.txout.scriptPubKey;
-
-                nCoinStakeTime -= n;
-
-                nCredit += pcoin.txout.nValue;
-
-                txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
-
-                // Try to add outStakeReward as input if it hasn't already been spent.
-                if (header.IsProofOfStake()) {
-                    const CWalletTx* wtx = GetWalletTx(pcoin.outpoint.hash);
-                    const CBlockIndex* blockIndex;
-                    wtx->GetDepthInMainChain(blockIndex);
-                    if (blockIndex != nullptr) {
-                        const CWalletTx* stakeRewardWtx = GetWalletTx(blockIndex->outStakeReward.hash);
-                        if (stakeRewardWtx != nullptr) {
-                            CInputCoin stakeRewardInput = CInputCoin(stakeRewardWtx, blockIndex->outStakeReward.n);
-                            if ((stakeRewardInput.txout.scriptPubKey == scriptPubKeyKernel)
-                                    && setCoins.count(stakeRewardInput))
-                            {
-                                txNew.vin.push_back(CTxIn(stakeRewardInput.outpoint.hash, stakeRewardInput.outpoint.n));
-                                nCredit += stakeRewardInput.txout.nValue;
-                            }
-                        }
-                    }
-                }
+    nCredit += pcoin.txout.nValue;
 
-                CPubKey vchPubKey;
-                bool ret = key0.GetReservedKey(vchPubKey, true);
-                if (!ret) {
-                    return error("CreateCoinStake: Keypool ran out, please call keypoolrefill first");
+    txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
+
+    // Try to add outStakeReward as input if it hasn't already been spent.
+    if (posKernel.IsProofOfStake()) {
+        const CWalletTx* wtx = GetWalletTx(pcoin.outpoint.hash);
+        const CBlockIndex* blockIndex;
+        wtx->GetDepthInMainChain(blockIndex);
+        if (blockIndex != nullptr) {
+            const CWalletTx* stakeRewardWtx = GetWalletTx(blockIndex->outStakeReward.hash);
+            if (stakeRewardWtx != nullptr) {
+                CInputCoin stakeRewardInput = CInputCoin(stakeRewardWtx, blockIndex->outStakeReward.n);
+                if ((stakeRewardInput.txout.scriptPubKey == scriptPubKeyKernel)
+                        && setCoins.count(stakeRewardInput))
+                {
+                    txNew.vin.push_back(CTxIn(stakeRewardInput.outpoint.hash, stakeRewardInput.outpoint.n));
+                    nCredit += stakeRewardInput.txout.nValue;
                 }
+            }
+        }
+    }
 
-                LearnRelatedScripts(vchPubKey, OUTPUT_TYPE_BECH32); // Force bech32 addresess usage
-                CScript scriptPubKeyOut = GetScriptForDestination(GetDestinationForKey(vchPubKey, OUTPUT_TYPE_BECH32));
+    {
+        CPubKey vchPubKey;
+        bool ret = key0.GetReservedKey(vchPubKey, true);
+        if (!ret) {
+            return error("CreateCoinStake: Keypool ran out, please call keypoolrefill first");
+        }
 
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
-                if (header.GetBlockTime() + nStakeSplitAge > nCoinStakeTime && nCredit > nPoWReward && gArgs.GetBoolArg("-splitpos", true))
-                    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake if (age < 90 && value > POW)
+        LearnRelatedScripts(vchPubKey, OUTPUT_TYPE_BECH32); // Force bech32 addresess usage
+        CScript scriptPubKeyOut = GetScriptForDestination(GetDestinationForKey(vchPubKey, OUTPUT_TYPE_BECH32));
 
-                fKernelFound = true;
-                break;
-            }
-        }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        if (posKernel.GetBlockTime() + nStakeSplitAge > nCoinStakeTime && nCredit > nPoWReward && gArgs.GetBoolArg("-splitpos", true))
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake if (age < 90 && value > POW)
     }
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
@@ -3263,21 +3443,16 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             if (pcoin.txout.nValue > nCombineThreshold)
                 continue;
 
-            auto bo = TryGetBlockOffset(CacheBlockOffset, pcoin.outpoint.hash);
-            if (bo == nullptr)
+            CStakeTxPos pos;
+            if (!GetStakeTxPos(mapWallet.at(pcoin.outpoint.hash), pos))
                 continue;
-            CBlockHeader& header = *(bo->value.first);
 
             // Do not add input that is still too young
-            if (header.GetBlockTime() + consensusParams.nStakeMaxAge > nCoinStakeTime)
+            if (pos.GetBlockTime() + consensusParams.nStakeMaxAge > nCoinStakeTime)
                 continue;
 
             txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
             nCredit += pcoin.txout.nValue;
-
-            delete bo->value.first;
-            bo->value.first = NULL; // Set "temporary removed"
-            CacheBlockOffset.MarkDel(bo);
         }
     }
 
@@ -3348,10 +3523,6 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     nPosReward += nMinFee; // recover paid fee in coinbase transaction
 
     // Successfully generated coinstake
-    // Remove block reference from the cache
-    delete pbo->value.first;
-    pbo->value.first = NULL; // Set "temporary removed"
-    CacheBlockOffset.MarkDel(pbo);
     return true;
 }
 
@@ -4003,18 +4174,21 @@ void CWallet::LockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    setMintingDirty.insert(output.hash);
 }
 
 void CWallet::UnlockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    setMintingDirty.insert(output.hash);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    fMintingRescan = true;
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -8,9 +8,11 @@
 
 #include <amount.h>
 #include <policy/feerate.h>
+#include <primitives/block.h>
 #include <streams.h>
 #include <tinyformat.h>
 #include <ui_interface.h>
+#include <uint256hm.h>
 #include <utilstrencodings.h>
 #include <validationinterface.h>
 #include <script/ismine.h>
@@ -65,6 +67,10 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 static const bool DEFAULT_WALLET_RBF = false;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
+//! Seconds back from the coinstake time a stake kernel search goes at most
+static const int64_t MAX_STAKE_SEARCH_INTERVAL = 60;
+//! Seconds a minting index is reused for before coin day weights are computed again
+static const int64_t MINTING_INDEX_MAX_AGE = 60;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -79,6 +85,7 @@ class CScheduler;
 class CTxMemPool;
 class CBlockPolicyEstimator;
 class CWalletTx;
+struct CStakeKernelCandidate;
 struct FeeCalculation;
 enum class FeeEstimateMode;
 
@@ -490,6 +497,62 @@ public:
 };
 
 
+/**
+ * Where a wallet transaction is in the chain, as far as the stake kernel
+ * protocol is concerned: the time and flags of its block, and its offset in
+ * the block. Kept in CWallet::mapStakeTxPos, and in the wallet database, so
+ * that staking does not read block headers back from disk.
+ */
+class CStakeTxPos
+{
+public:
+    uint256 hashBlock;
+    uint32_t nTimeBlock;
+    uint32_t nFlagsBlock;
+    uint32_t nTxOffset;
+
+    CStakeTxPos() : nTimeBlock(0), nFlagsBlock(0), nTxOffset(0) {}
+    CStakeTxPos(const uint256& hashBlockIn, const CBlockHeader& header, uint32_t nTxOffsetIn) :
+        hashBlock(hashBlockIn), nTimeBlock(header.nTime), nFlagsBlock(header.nFlags), nTxOffset(nTxOffsetIn) {}
+
+    int64_t GetBlockTime() const { return nTimeBlock; }
+    bool IsProofOfStake() const { return nFlagsBlock & BLOCK_PROOF_OF_STAKE; }
+    bool IsNewFormatBlock() const { return nFlagsBlock & BLOCK_NEW_FORMAT; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTimeBlock);
+        READWRITE(nFlagsBlock);
+        READWRITE(nTxOffset);
+    }
+};
+
+/** A mintable output of the wallet, as listed by listminting */
+struct CMintableCoin
+{
+    COutPoint outpoint;
+    CScript scriptPubKey;
+    CAmount nValue;
+    int64_t nTime;   //!< time of the block the output was confirmed in
+    int64_t nWeight; //!< coin day weight at CMintingIndex::nTime
+};
+
+/**
+ * The mintable outputs of a wallet at nTime, by decreasing coin day weight
+ * and then by increasing block time, so that listminting can filter them on
+ * weight with a binary search and page through them without a wallet scan.
+ * Never modified once built, so it can be read without the wallet lock.
+ */
+struct CMintingIndex
+{
+    int64_t nTime;
+    uint64_t nCoinsVersion;
+    std::vector<CMintableCoin> vCoins;
+};
+
 class CInputCoin {
 public:
     CInputCoin(const CWalletTx* walletTx, unsigned int i)
@@ -681,6 +744,12 @@ private:
      * if they are not ours
      */
     bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = nullptr) const;
+    /** Select the coins that may be staked at nCoinStakeTime, within the balance -reservebalance leaves */
+    bool SelectStakeCoins(uint32_t nCoinStakeTime, std::set<CInputCoin>& setCoins, CAmount& nBalance, CAmount& nReserveBalance) const;
+    /** Look up the kernel position of a confirmed wallet transaction; read from disk only for one the index has never seen */
+    bool GetStakeTxPos(const CWalletTx& wtx, CStakeTxPos& pos);
+    /** Index the kernel positions of the wallet transactions in a block of the active chain */
+    void AddStakeTxPos(const CBlock& block, const CBlockIndex* pindex);
 
     CWalletDB *pwalletdbEncryption;
 
@@ -751,6 +820,26 @@ private:
      */
     const CBlockIndex* m_last_block_processed;
 
+    /**
+     * The mintable outputs of the wallet, without their weights, kept up to
+     * date from the transaction notifications rather than by a wallet scan:
+     * the transactions in setMintingDirty are checked again before the next
+     * minting index is built, and every transaction once fMintingRescan is
+     * set. Coinbases waiting to mature are checked again on each block.
+     * nCoinsVersion is bumped whenever mapMintingCoins changes.
+     */
+    std::map<COutPoint, CMintableCoin> mapMintingCoins;
+    std::set<uint256> setMintingDirty;
+    std::set<uint256> setMintingImmature;
+    bool fMintingRescan = true;
+    uint64_t nCoinsVersion = 0;
+    std::shared_ptr<const CMintingIndex> pMintingIndex;
+
+    /** Have the outputs of tx and of the wallet transactions it spends checked again for mapMintingCoins */
+    void MarkMintingDirty(const CTransaction& tx);
+    /** Check the outputs of a transaction for mapMintingCoins again, with the same rules as AvailableCoins() */
+    void UpdateMintingCoins(const uint256& hash);
+
 public:
     /*
      * Main wallet lock.
@@ -828,6 +917,9 @@ public:
     std::map<uint256, CWalletTx> mapWallet;
     std::list<CAccountingEntry> laccentries;
 
+    //! Kernel positions of the confirmed wallet transactions, by txid
+    uint256HashMap<CStakeTxPos> mapStakeTxPos;
+
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
@@ -913,6 +1005,8 @@ public:
     bool EraseDestData(const CTxDestination &dest, const std::string &key);
     //! Adds a destination data tuple to the store, without saving it to disk
     bool LoadDestData(const CTxDestination &dest, const std::string &key, const std::string &value);
+    //! Adds a kernel position to the stake index, without saving it to disk
+    void LoadStakeTxPos(const uint256& hash, const CStakeTxPos& pos);
     //! Look up a destination data tuple in the store, return true if found false otherwise
     bool GetDestData(const CTxDestination &dest, const std::string &key, std::string *value) const;
     //! Get all destination values matching a prefix.
@@ -982,7 +1076,23 @@ public:
      */
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosInOut,
                            std::string& strFailReason, const CCoinControl& coin_control, bool sign = true);
+    /**
+     * Snapshot the coins that may stake at nCoinStakeTime, the latest kernel
+     * timestamp to be searched, so that their kernels can be searched with
+     * FindStakeKernel() without holding the locks
+     */
+    bool GetStakeCandidates(uint32_t nCoinStakeTime, std::vector<CStakeKernelCandidate>& vCandidates);
+    /** Search up to nSearchInterval seconds back from nCoinStakeTime for a kernel and create its coinstake */
     bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction &txNew, uint32_t& nCoinStakeTime, CAmount& posReward);
+    /** Create the coinstake of a kernel found among GetStakeCandidates(), after checking it again under the locks */
+    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, const CStakeKernelCandidate& kernel, uint32_t nCoinStakeTime, CMutableTransaction &txNew, CAmount& posReward);
+    /**
+     * The mintable outputs of the wallet sorted by coin day weight. Built
+     * again once the mintable outputs changed, or after MINTING_INDEX_MAX_AGE
+     * seconds since weights grow with time, outside of the locks; until
+     * then, the same index is returned without taking cs_main.
+     */
+    std::shared_ptr<const CMintingIndex> GetMintingIndex();
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state);
 
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries);
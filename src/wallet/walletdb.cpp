@@ -495,6 +495,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "stakepos")
+        {
+            uint256 hash;
+            ssKey >> hash;
+            CStakeTxPos pos;
+            ssValue >> pos;
+            pwallet->LoadStakeTxPos(hash, pos);
+        }
         else if (strType == "hdchain")
         {
             CHDChain chain;
@@ -826,6 +834,16 @@ bool CWalletDB::EraseDestData(const std::string &address, const std::string &key
     return EraseIC(std::make_pair(std::string("destdata"), std::make_pair(address, key)));
 }
 
+bool CWalletDB::WriteStakeTxPos(const uint256& hash, const CStakeTxPos& pos)
+{
+    return WriteIC(std::make_pair(std::string("stakepos"), hash), pos);
+}
+
+bool CWalletDB::EraseStakeTxPos(const uint256& hash)
+{
+    return EraseIC(std::make_pair(std::string("stakepos"), hash));
+}
+
 
 bool CWalletDB::WriteHDChain(const CHDChain& chain)
 {
@@ -40,6 +40,7 @@ struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
 class CScript;
+class CStakeTxPos;
 class CWallet;
 class CWalletTx;
 class uint160;
@@ -210,6 +211,11 @@ public:
     /// Erase destination data tuple from wallet database
     bool EraseDestData(const std::string &address, const std::string &key);
 
+    /// Write the kernel position of a wallet transaction to the stake index
+    bool WriteStakeTxPos(const uint256& hash, const CStakeTxPos& pos);
+    /// Erase the kernel position of a wallet transaction from the stake index
+    bool EraseStakeTxPos(const uint256& hash);
+
     CAmount GetAccountCreditDebit(const std::string& strAccount);
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
 
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Taler Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and loadtxoutset.
+
+- Mine past the end of the legacy block format on node0 and dump its UTXO set.
+- Check that a node without -prune, a snapshot with a bad hash and one that is
+  not of the expected block or muhash are refused.
+- Load the snapshot on the pruned node1 and compare gettxoutsetinfo with node0,
+  also after a restart of node1.
+- Load the snapshot on node2 at startup with -loadsnapshot.
+- Connect a block on top of the snapshot that spends coins of it.
+"""
+
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes_bi,
+    sync_blocks,
+)
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [[], ["-prune=550"], ["-prune=550"]]
+
+    def setup_network(self):
+        # node1 and node2 must not get any block before they load the snapshot
+        self.setup_nodes()
+
+    def assert_same_utxo_set(self, hash_type):
+        info0 = self.nodes[0].gettxoutsetinfo(hash_type)
+        info1 = self.nodes[1].gettxoutsetinfo(hash_type)
+        for key in ("height", "bestblock", "txouts", "muhash", "total_amount"):
+            assert_equal(info0[key], info1[key])
+        if hash_type == "hash_serialized_2":
+            assert_equal(info0["hash_serialized_2"], info1["hash_serialized_2"])
+
+    def run_test(self):
+        node0, node1, node2 = self.nodes
+        node0.generate(130)
+        node0.sendtoaddress(node0.getnewaddress(), 10)
+        node0.generate(1)
+
+        self.log.info("Dump the UTXO set of node0")
+        dump = node0.dumptxoutset("utxo.dat")
+        assert_equal(dump["base_height"], 131)
+        assert_equal(dump["base_hash"], node0.getbestblockhash())
+        assert_equal(dump["muhash"], node0.gettxoutsetinfo()["muhash"])
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, "utxo.dat")
+
+        self.log.info("Check that bad loads are refused")
+        anchor = [dump["base_hash"], dump["muhash"]]
+        assert_raises_rpc_error(-1, "requires -prune", node0.loadtxoutset, dump["path"], *anchor)
+        assert_raises_rpc_error(-1, "not of the expected block", node1.loadtxoutset, dump["path"], node0.getblockhash(130), dump["muhash"])
+        assert_raises_rpc_error(-1, "not the expected", node1.loadtxoutset, dump["path"], dump["base_hash"], "00" * 32)
+        badpath = os.path.join(self.options.tmpdir, "utxo-bad.dat")
+        shutil.copyfile(dump["path"], badpath)
+        with open(badpath, "r+b") as f:
+            # The last byte of the file is one of the hash of the coins
+            f.seek(-1, os.SEEK_END)
+            last = f.read(1)
+            f.seek(-1, os.SEEK_END)
+            f.write(bytes([last[0] ^ 1]))
+        assert_raises_rpc_error(-1, "do not match its hash", node1.loadtxoutset, badpath, *anchor)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Load the snapshot on the pruned node1")
+        load = node1.loadtxoutset(dump["path"], *anchor)
+        assert_equal(load["coins_loaded"], dump["coins_written"])
+        assert_equal(load["base_hash"], dump["base_hash"])
+        assert_equal(load["base_height"], dump["base_height"])
+        assert_equal(load["muhash"], dump["muhash"])
+        self.assert_same_utxo_set("muhash")
+        self.assert_same_utxo_set("hash_serialized_2")
+
+        self.log.info("Check that node1 keeps the snapshot block as its tip on restart")
+        self.restart_node(1, ["-prune=550"])
+        node1 = self.nodes[1]
+        assert_equal(node1.getbestblockhash(), dump["base_hash"])
+        self.assert_same_utxo_set("muhash")
+
+        self.log.info("Load the snapshot on node2 at startup")
+        self.stop_node(2)
+        self.assert_start_raises_init_error(2, ["-prune=550", "-loadsnapshot=" + dump["path"]], "-loadsnapshot requires -snapshotblock")
+        self.start_node(2, ["-prune=550", "-loadsnapshot=" + dump["path"], "-snapshotblock=" + dump["base_hash"], "-snapshotmuhash=" + dump["muhash"]])
+        assert_equal(self.nodes[2].getbestblockhash(), dump["base_hash"])
+        assert_equal(self.nodes[2].gettxoutsetinfo("muhash")["muhash"], dump["muhash"])
+
+        self.log.info("Connect blocks that spend coins of the snapshot on top of it")
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        node0.sendtoaddress(node0.getnewaddress(), node0.getbalance() - 1)
+        node0.generate(2)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getblockcount(), 133)
+        assert_equal(self.nodes[2].getblockcount(), 133)
+        self.assert_same_utxo_set("muhash")
+        self.assert_same_utxo_set("hash_serialized_2")
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
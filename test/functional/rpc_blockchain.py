@@ -144,6 +144,15 @@ class BlockchainTest(BitcoinTestFramework):
         assert size < 64000
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized_2']), 64)
+        assert_equal(len(res['muhash']), 64)
+
+        self.log.info("Test that the running statistics match a full scan")
+        res_muhash = node.gettxoutsetinfo("muhash")
+        assert 'transactions' not in res_muhash
+        assert 'hash_serialized_2' not in res_muhash
+        for key in ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']:
+            assert_equal(res_muhash[key], res[key])
+        assert_raises_rpc_error(-8, "Unknown hash_type", node.gettxoutsetinfo, "sha256")
 
         self.log.info("Test that gettxoutsetinfo() works for blockchain with just the genesis block")
         b1hash = node.getblockhash(1)
@@ -157,6 +166,7 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res2['bogosize'], 0),
         assert_equal(res2['bestblock'], node.getblockhash(0))
         assert_equal(len(res2['hash_serialized_2']), 64)
+        assert_equal(node.gettxoutsetinfo("muhash")['muhash'], res2['muhash'])
 
         self.log.info("Test that gettxoutsetinfo() returns the same result after invalidate/reconsider block")
         node.reconsiderblock(b1hash)
@@ -169,6 +179,8 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['bogosize'], res3['bogosize'])
         assert_equal(res['bestblock'], res3['bestblock'])
         assert_equal(res['hash_serialized_2'], res3['hash_serialized_2'])
+        assert_equal(res['muhash'], res3['muhash'])
+        assert_equal(node.gettxoutsetinfo("muhash")['muhash'], res3['muhash'])
 
     def _test_getblockheader(self):
         node = self.nodes[0]